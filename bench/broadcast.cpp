@@ -0,0 +1,70 @@
+// Time the logic thread spends per recipient of a channel broadcast, for
+// channels of 100, 10k and 100k members:
+//   ./bench/broadcast [deliveries per size]
+// The members are fake clients on fds that don't exist, so what's measured is
+// the fan-out loop and the batching of the output, not the socket writes.
+
+#include "Server.hpp"
+#include "Channel.hpp"
+#include <chrono>
+
+#define BENCH_FD_BASE 1000000 // above any open file descriptor
+
+// A channel with `size` members, built the way a hot upgrade restores one
+static Channel *make_channel(std::vector<Client *> const &members, Server &server)
+{
+	Archive state;
+	state.put_str("#bench");
+	state.put_str(""); // key
+	state.put_str(""); // topic
+	state.put_u64(0);  // topic time
+	state.put_u8(0);   // modes
+	state.put_u32(0);  // limit
+	state.put_u32(members.size());
+	for (size_t i = 0; i < members.size(); i++)
+		state.put_u32(i);
+	state.put_u32(0); // ops
+	state.put_u32(0); // invites
+	History().save(state);
+	for (int list = 0; list < 3; list++)
+		MaskList().save(state);
+	Reader in(state.data());
+	return (Channel::load(in, members, server));
+}
+
+int main(int argc, char **argv)
+{
+	size_t deliveries = argc > 1 ? std::atol(argv[1]) : 2000000;
+	size_t sizes[] = {100, 10000, 100000};
+	Server server(6667, "bench");
+	for (size_t size : sizes)
+	{
+		std::vector<Client *> members;
+		for (size_t i = 0; i < size; i++)
+		{
+			members.push_back(new Client("user" + std::to_string(i), "user", BENCH_FD_BASE + i));
+			members.back()->set_caps(i % 4 == 0 ? CAP_SERVER_TIME : 0); // a quarter of them get a tagged variant
+		}
+		Channel *channel = make_channel(members, server);
+		Client *sender = members[size / 2];
+		std::string line = ":user!~user@localhost PRIVMSG #bench :hello there" CRLF;
+		size_t rounds = std::max<size_t>(deliveries / size, 1);
+		std::chrono::nanoseconds spent(0);
+		std::cerr.setstate(std::ios::failbit); // the sends to the fake fds failing
+		for (size_t round = 0; round < rounds; round++)
+		{
+			server.tick();
+			server.begin_batch();
+			auto start = std::chrono::steady_clock::now();
+			channel->broadcast(sender, line);
+			spent += std::chrono::steady_clock::now() - start;
+			server.end_batch(); // not timed, the fds don't exist
+		}
+		std::cerr.clear();
+		std::cout << size << " members: " << (double)spent.count() / (rounds * (size - 1)) << " ns/recipient (" << rounds << " broadcasts)" << std::endl;
+		delete channel;
+		for (auto member : members)
+			delete member;
+	}
+	return (0);
+}
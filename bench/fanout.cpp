@@ -0,0 +1,224 @@
+// Fan-out throughput of a running server, over plain TCP or TLS:
+//   ./bench/fanout <port> <password> [tls] [receivers] [messages] [size]
+// Connects the receivers and a sender to #bench, then the sender sends the
+// messages as fast as the server takes them and the time until every receiver
+// got all of them is measured.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+struct Conn
+{
+	int fd;
+	SSL *ssl;
+	std::string in;
+	size_t received;
+};
+
+static SSL_CTX *ctx = NULL;
+
+static void fail(std::string const &what)
+{
+	std::cerr << "fanout: " << what << std::endl;
+	exit(1);
+}
+
+// Reading what is there, -1 once the server closed the connection
+static ssize_t receive(Conn &c, char *buff, size_t size)
+{
+	if (!c.ssl)
+	{
+		ssize_t n = recv(c.fd, buff, size, 0);
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return (0);
+		return (n > 0 ? n : -1);
+	}
+	int n = SSL_read(c.ssl, buff, size);
+	if (n > 0)
+		return (n);
+	int err = SSL_get_error(c.ssl, n);
+	return (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? 0 : -1);
+}
+
+static ssize_t transmit(Conn &c, char const *data, size_t size)
+{
+	if (!c.ssl)
+	{
+		ssize_t n = send(c.fd, data, size, MSG_NOSIGNAL);
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return (0);
+		return (n);
+	}
+	int n = SSL_write(c.ssl, data, size);
+	if (n > 0)
+		return (n);
+	int err = SSL_get_error(c.ssl, n);
+	return (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? 0 : -1);
+}
+
+// Counting the complete lines that carry `marker`, dropping the rest
+static void consume(Conn &c, std::string const &marker)
+{
+	size_t start = 0, end;
+	while ((end = c.in.find('\n', start)) != std::string::npos)
+	{
+		if (c.in.find(marker, start) < end)
+			c.received++;
+		start = end + 1;
+	}
+	c.in.erase(0, start);
+}
+
+static void send_line(Conn &c, std::string const &line)
+{
+	std::string data = line + "\r\n";
+	for (size_t sent = 0; sent < data.size();)
+	{
+		ssize_t n = transmit(c, data.c_str() + sent, data.size() - sent);
+		if (n < 0)
+			fail("send failed");
+		sent += n;
+	}
+}
+
+// Blocking until a line containing `what` arrives
+static void wait_for(Conn &c, std::string const &what)
+{
+	char buff[4096];
+	while (c.in.find(what) == std::string::npos)
+	{
+		struct pollfd p = {c.fd, POLLIN, 0};
+		if (!c.ssl || SSL_pending(c.ssl) == 0)
+			poll(&p, 1, 5000);
+		ssize_t n = receive(c, buff, sizeof(buff));
+		if (n < 0)
+			fail("connection closed while waiting for " + what);
+		c.in.append(buff, n);
+	}
+	c.in.clear();
+}
+
+static Conn join(int port, std::string const &password, std::string const &nick)
+{
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo("127.0.0.1", std::to_string(port).c_str(), &hints, &res) != 0)
+		fail("getaddrinfo failed");
+	Conn c = {socket(res->ai_family, SOCK_STREAM, 0), NULL, std::string(), 0};
+	if (c.fd == -1 || connect(c.fd, res->ai_addr, res->ai_addrlen) == -1)
+		fail("connect failed");
+	freeaddrinfo(res);
+	if (ctx)
+	{
+		c.ssl = SSL_new(ctx);
+		SSL_set_fd(c.ssl, c.fd);
+		if (SSL_connect(c.ssl) != 1)
+			fail("TLS handshake failed");
+	}
+	fcntl(c.fd, F_SETFL, O_NONBLOCK);
+	send_line(c, "PASS " + password);
+	send_line(c, "NICK " + nick);
+	send_line(c, "USER " + nick + " 0 * :" + nick);
+	wait_for(c, " 001 ");
+	send_line(c, "JOIN #bench");
+	wait_for(c, " 366 ");
+	return (c);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		std::cerr << "usage: " << argv[0] << " <port> <password> [tls] [receivers] [messages] [size]" << std::endl;
+		return (1);
+	}
+	int port = std::atoi(argv[1]);
+	std::string password = argv[2];
+	int arg = 3;
+	if (argc > arg && std::string(argv[arg]) == "tls")
+	{
+		ctx = SSL_CTX_new(TLS_client_method());
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+		arg++;
+	}
+	size_t receivers = argc > arg ? std::atoi(argv[arg++]) : 100;
+	size_t messages = argc > arg ? std::atoi(argv[arg++]) : 2000;
+	size_t size = argc > arg ? std::atoi(argv[arg++]) : 200;
+	std::signal(SIGPIPE, SIG_IGN);
+
+	std::vector<Conn> conns;
+	for (size_t i = 0; i < receivers; i++)
+		conns.push_back(join(port, password, "r" + std::to_string(i)));
+	Conn sender = join(port, password, "sender");
+
+	std::string line = "PRIVMSG #bench :" + std::string(size, 'x') + "\r\n";
+	std::string out;
+	for (size_t i = 0; i < messages; i++)
+		out += line;
+	std::string marker = "PRIVMSG #bench :";
+	size_t sent = 0, done = 0;
+	char buff[65536];
+	std::vector<struct pollfd> set(receivers + 1);
+	auto start = std::chrono::steady_clock::now();
+	while (done < receivers)
+	{
+		for (size_t i = 0; i < receivers; i++)
+			set[i] = {conns[i].fd, POLLIN, 0};
+		set[receivers] = {sender.fd, (short)(sent < out.size() ? POLLOUT : 0), 0};
+		if (poll(set.data(), set.size(), 10000) <= 0)
+			fail("timed out, " + std::to_string(done) + " receivers done");
+		if (set[receivers].revents & POLLOUT)
+		{
+			ssize_t n = transmit(sender, out.c_str() + sent, std::min<size_t>(out.size() - sent, 65536));
+			if (n < 0)
+				fail("sender lost");
+			sent += n;
+		}
+		for (size_t i = 0; i < receivers; i++)
+		{
+			Conn &c = conns[i];
+			if (!(set[i].revents & POLLIN) || c.received == messages)
+				continue;
+			ssize_t n;
+			while ((n = receive(c, buff, sizeof(buff))) > 0)
+				c.in.append(buff, n);
+			if (n < 0)
+				fail("receiver " + std::to_string(i) + " lost");
+			consume(c, marker);
+			if (c.received >= messages)
+				done++;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double delivered = (double)messages * receivers;
+	double bytes = delivered * (line.size() + sizeof(":sender!~sender@localhost ") - 1);
+	std::cout << (ctx ? "tls  " : "plain") << " receivers " << receivers << " messages " << messages << " size " << size << ": "
+			  << seconds << " s, " << (size_t)(delivered / seconds) << " msgs/s, " << bytes / seconds / 1e6 << " MB/s" << std::endl;
+	for (auto &c : conns)
+	{
+		if (c.ssl)
+			SSL_free(c.ssl);
+		close(c.fd);
+	}
+	if (sender.ssl)
+		SSL_free(sender.ssl);
+	close(sender.fd);
+	if (ctx)
+		SSL_CTX_free(ctx);
+	return (0);
+}
@@ -0,0 +1,210 @@
+// Playing a capture (IRCSERV_CAPTURE) back against a running server:
+//   ./bench/replay <port> <capture file> [fast]
+// Every captured connection is opened, sends its lines and is closed in the
+// order they were recorded, with the recorded delays in between or, with
+// `fast`, as fast as the server takes them. What the server sends back is read
+// and counted but not checked. The password is the one that was captured.
+
+#include "Archive.hpp"
+#include "Capture.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#define REPLAY_DRAIN_EVERY 64 // records sent between two reads in fast mode
+#define REPLAY_LINGER 500	  // milliseconds to keep reading once everything is sent
+
+struct Event
+{
+	uint8_t kind;
+	uint32_t connection;
+	uint32_t delay; // milliseconds after the previous event
+	std::string line;
+};
+
+struct Conn
+{
+	int fd;
+	std::string out;
+};
+
+static int port;
+static std::unordered_map<uint32_t, Conn> conns;
+static std::vector<Conn> closing;
+static unsigned long long received = 0;
+
+static void fail(std::string const &what)
+{
+	std::cerr << "replay: " << what << std::endl;
+	exit(1);
+}
+
+static std::vector<Event> load(char const *path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		fail(std::string("can't open ") + path);
+	std::stringstream content;
+	content << file.rdbuf();
+	std::string data = content.str();
+	Reader in(data);
+	std::vector<Event> events;
+	try
+	{
+		if (in.get_str() != CAPTURE_MAGIC || in.get_u32() != CAPTURE_VERSION)
+			fail(std::string(path) + " is not a capture");
+		while (!in.at_end())
+		{
+			Event event;
+			event.kind = in.get_u8();
+			event.connection = in.get_u32();
+			event.delay = in.get_u32();
+			if (event.kind == CAPTURE_LINE)
+				event.line = in.get_str() + "\r\n";
+			events.push_back(event);
+		}
+	}
+	catch (std::exception &e) // a capture cut short by a crash, playing what is there
+	{
+		std::cerr << "replay: " << e.what() << ", " << events.size() << " records read" << std::endl;
+	}
+	return (events);
+}
+
+static int open_connection()
+{
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo("127.0.0.1", std::to_string(port).c_str(), &hints, &res) != 0)
+		fail("getaddrinfo failed");
+	int fd = socket(res->ai_family, SOCK_STREAM, 0);
+	if (fd == -1 || connect(fd, res->ai_addr, res->ai_addrlen) == -1)
+		fail("connect failed");
+	freeaddrinfo(res);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return (fd);
+}
+
+// Sending what the connection can take, false once it's gone
+static bool flush(Conn &c)
+{
+	while (!c.out.empty())
+	{
+		ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return (true);
+		if (n <= 0)
+			return (false);
+		c.out.erase(0, n);
+	}
+	return (true);
+}
+
+// Reading and flushing every connection until `deadline`, or once if it has passed
+static void pump(std::chrono::steady_clock::time_point deadline)
+{
+	char buff[65536];
+	do
+	{
+		std::vector<struct pollfd> fds;
+		std::vector<Conn *> owners;
+		for (auto &entry : conns)
+			owners.push_back(&entry.second);
+		for (auto &c : closing)
+			owners.push_back(&c);
+		for (auto c : owners)
+			fds.push_back({c->fd, (short)(POLLIN | (c->out.empty() ? 0 : POLLOUT)), 0});
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		poll(fds.data(), fds.size(), left > 0 ? left : 0);
+		for (size_t i = 0; i < fds.size(); i++)
+		{
+			if (fds[i].revents & POLLOUT)
+				flush(*owners[i]);
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+			{
+				ssize_t n = recv(fds[i].fd, buff, sizeof(buff), 0);
+				if (n > 0)
+					received += n;
+				else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+					owners[i]->out.clear(); // the server closed it
+			}
+		}
+		for (auto it = closing.begin(); it != closing.end();)
+		{
+			if (!it->out.empty())
+			{
+				++it;
+				continue;
+			}
+			close(it->fd);
+			it = closing.erase(it);
+		}
+	} while (std::chrono::steady_clock::now() < deadline);
+}
+
+static void play(Event const &event)
+{
+	auto it = conns.find(event.connection);
+	if (event.kind == CAPTURE_CLOSE)
+	{
+		if (it == conns.end())
+			return;
+		closing.push_back(it->second);
+		conns.erase(it);
+		return;
+	}
+	if (it == conns.end())
+		it = conns.insert(std::make_pair(event.connection, Conn{open_connection(), std::string()})).first;
+	if (event.kind == CAPTURE_LINE)
+	{
+		it->second.out += event.line;
+		flush(it->second);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3 && argc != 4)
+		fail("usage: ./bench/replay <port> <capture file> [fast]");
+	port = std::atoi(argv[1]);
+	bool fast = argc == 4 && std::string(argv[3]) == "fast";
+	std::vector<Event> events = load(argv[2]);
+	size_t lines = 0, connections = 0;
+	auto start = std::chrono::steady_clock::now();
+	auto due = start;
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		due += std::chrono::milliseconds(events[i].delay);
+		if (!fast)
+			pump(due);
+		else if (i % REPLAY_DRAIN_EVERY == 0)
+			pump(std::chrono::steady_clock::now());
+		play(events[i]);
+		lines += events[i].kind == CAPTURE_LINE;
+		connections += events[i].kind == CAPTURE_OPEN;
+	}
+	while (!closing.empty()) // the lines before a close are all sent first
+		pump(std::chrono::steady_clock::now() + std::chrono::milliseconds(10));
+	double sent = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	pump(std::chrono::steady_clock::now() + std::chrono::milliseconds(REPLAY_LINGER));
+	std::cout << "replayed " << lines << " lines on " << connections << " connections in " << sent << "s ("
+			  << (sent > 0 ? lines / sent : 0) << " lines/s), captured duration "
+			  << std::chrono::duration<double>(due - start).count() << "s, received " << received << " bytes" << std::endl;
+	for (auto &entry : conns)
+		close(entry.second.fd);
+	return (0);
+}
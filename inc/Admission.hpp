@@ -0,0 +1,79 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#define ADMISSION_DEPTH 4		  // rows of the sketch, each with its own hash
+#define ADMISSION_WIDTH 4096	  // counters per row, a power of two
+#define ADMISSION_KEY_SIZE 17	  // kind byte and an IPv6 address
+#define ADMISSION_HALF_LIFE 60	  // seconds after which a connect counts half
+#define ADMISSION_DECAY_STEP 5	  // seconds between two decays of the connect rates
+#define ADMISSION_OFFENDERS 10	  // refused sources kept for the report
+#define ADMISSION_ADDRESS_OPEN 10 // default limits, see AdmissionLimits
+#define ADMISSION_PREFIX_OPEN 50
+#define ADMISSION_ADDRESS_RATE 30
+#define ADMISSION_PREFIX_RATE 100
+
+// Limits on the connections of one source, 0 for none
+struct AdmissionLimits
+{
+	unsigned address_open; // connections open from one address
+	unsigned prefix_open;  // connections open from one IPv6 /64
+	unsigned address_rate; // recent connects from one address
+	unsigned prefix_rate;  // recent connects from one IPv6 /64
+};
+
+// Admission control for new connections, decided before anything is
+// allocated for them. The open connections and the recent connects of every
+// address and IPv6 /64 are counted in a count-min sketch: each source adds to
+// one counter in every row and its count is the smallest of them, so
+// collisions only ever overestimate and the memory is fixed however many
+// sources there are. The connect counts decay by half every minute. Loopback
+// connections are neither counted nor limited.
+class Admission
+{
+public:
+	Admission();
+
+	void set_limits(AdmissionLimits const &limits);
+	AdmissionLimits const &get_limits() const;
+	std::string admit(std::string const &address, time_t now); // empty if admitted, why not otherwise
+	void opened(std::string const &address);					// a connection admitted elsewhere, e.g. before a hot upgrade
+	void closed(std::string const &address);
+	std::string report() const;
+
+private:
+	struct Cell
+	{
+		uint32_t open;
+		float recent;
+	};
+
+	struct Offender
+	{
+		std::string source;
+		unsigned long refused;
+		std::string reason;
+	};
+
+	std::vector<Cell> cells; // ADMISSION_DEPTH rows of ADMISSION_WIDTH
+	AdmissionLimits limits;
+	time_t last_decay;
+	unsigned long refused;
+	std::vector<Offender> offenders; // the most refused sources, approximately
+
+	static bool parse(std::string const &address, unsigned char key[ADMISSION_KEY_SIZE]);
+	static std::string prefix_text(unsigned char const key[ADMISSION_KEY_SIZE]);
+	void locate(unsigned char const key[ADMISSION_KEY_SIZE], size_t slots[ADMISSION_DEPTH]) const;
+	uint32_t open_count(size_t const slots[ADMISSION_DEPTH]) const;
+	float recent_count(size_t const slots[ADMISSION_DEPTH]) const;
+	void add(size_t const slots[ADMISSION_DEPTH], int open, float recent);
+	void decay(time_t now);
+	void refuse(std::string const &source, std::string const &reason);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Minimal binary encoding used to hand state over to another process
+class Archive
+{
+public:
+	void put_u8(uint8_t value);
+	void put_u32(uint32_t value);
+	void put_u64(uint64_t value);
+	void put_str(std::string const &value);
+	std::string const &data() const;
+
+private:
+	std::string buffer;
+};
+
+// Reading back what an Archive wrote, throws if the data is truncated
+class Reader
+{
+public:
+	Reader(std::string const &data);
+	uint8_t get_u8();
+	uint32_t get_u32();
+	uint64_t get_u64();
+	std::string get_str();
+	bool at_end() const;
+
+private:
+	std::string const &buffer;
+	size_t pos;
+	void need(size_t n);
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef CAPABILITIES_H
+#define CAPABILITIES_H
+
+#include <string>
+
+// IRCv3 capabilities a client can enable with CAP REQ, one bit each
+#define CAP_SERVER_TIME 0b00000001
+#define CAP_MESSAGE_TAGS 0b00000010
+#define CAP_ACCOUNT_TAG 0b00000100
+#define CAP_ECHO_MESSAGE 0b00001000
+
+#define CAP_RENDERED (CAP_SERVER_TIME | CAP_MESSAGE_TAGS | CAP_ACCOUNT_TAG) // the ones that change how a line looks
+#define CAP_CLASSES 8																// combinations of the CAP_RENDERED bits
+
+unsigned char capability_bit(std::string const &name);
+std::string capability_names(unsigned char caps);
+
+// A line sent to many clients, rendered at most once per capability class:
+// clients whose capabilities add the same tags share one string.
+class Variants
+{
+public:
+	Variants(std::string const &line, std::string const &time, std::string const &msgid, std::string const &account);
+
+	std::string const &get(unsigned char caps);
+	std::string const &get_line() const;
+
+private:
+	std::string line;
+	std::string time;	 // server-time, "2024-01-01T00:00:00.000Z"
+	std::string msgid;	 // message-tags, empty if the line has none
+	std::string account; // account-tag, empty if the sender isn't logged into an account
+	std::string rendered[CAP_CLASSES]; // empty until a member of the class needs it
+};
+
+#endif
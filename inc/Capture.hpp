@@ -0,0 +1,48 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "Archive.hpp"
+#include <string>
+#include <unordered_set>
+
+#define CAPTURE_ENV "IRCSERV_CAPTURE" // file the inbound traffic is appended to
+#define CAPTURE_MAGIC "ircserv-capture"
+#define CAPTURE_VERSION 1
+#define CAPTURE_FLUSH_SIZE (64 * 1024) // bytes of records buffered before a write
+
+enum CaptureRecord
+{
+	CAPTURE_OPEN = 'O',	 // a connection sent its first line
+	CAPTURE_LINE = 'L',	 // a line it sent, with its tags
+	CAPTURE_CLOSE = 'C', // it went away or was closed
+};
+
+// Recording of the lines the clients send, for bench/replay to play back
+// against another server. The file starts with the magic string and the
+// version, then every record is
+//   u8 kind, u32 connection, u32 milliseconds since the previous record[, str line]
+// in the Archive encoding. Connections are numbered by their serial. A
+// process appends to an existing file, e.g. after a hot upgrade, and its
+// first record has 0 as delay.
+class Capture
+{
+public:
+	Capture();
+	~Capture();
+
+	void open(std::string const &path);
+	bool is_open() const;
+	void line(unsigned long connection, std::string const &line, long long now);
+	void close(unsigned long connection, long long now);
+	void flush();
+
+private:
+	int fd;
+	Archive pending;
+	long long last;							  // time of the previous record, 0 before the first
+	std::unordered_set<unsigned long> opened; // connections that have an open record
+
+	void record(CaptureRecord kind, unsigned long connection, long long now);
+};
+
+#endif
@@ -5,13 +5,27 @@
 #include <vector>
 #include <algorithm>
 #include <memory>
-
-#define MODE_I 0b00000001
-#define MODE_K 0b00000010
-#define MODE_L 0b00000100
+#include "History.hpp"
+#include "Snapshot.hpp"
+#include "Archive.hpp"
+#include "MaskList.hpp"
+#include "Memory.hpp"
+#include "ChannelRegistry.hpp"
+#include "Symbol.hpp"
+#include "Capabilities.hpp"
+#include "Modes.hpp"
+#include <map>
+#include <unordered_map>
 
 #define NO_KEY std::string()
 
+#define NAMES_LINE_MAX 512	 // RPL_NAMREPLY lines are packed to fit in one IRC line
+#define NICKLEN 30				   // longest nickname NICK accepts, ISUPPORT NICKLEN
+#define NAMES_NICK_RESERVE NICKLEN // room left for the nickname of the client receiving the reply
+#define CHANNEL_NODE_OVERHEAD 32  // estimated bytes of a hash map node besides its value
+#define CHANNEL_MASK_FOOTPRINT 160 // estimated bytes of one +b/+e/+I entry with its trie nodes
+#define NO_SLOT ((size_t)-1)
+
 enum ModeAction
 {
 	REMOVE,
@@ -25,54 +39,108 @@ class Channel
 {
 public:
 	Channel(std::string const &name, Client *client, Server &server);
+	Channel(std::string const &name, ChannelRecord const &record, Server &server);
+	Channel(std::string const &name, Server &server);
+	~Channel();
 
 	void join(Client *client, std::string const &key);
 	void invite(Client *commander, std::string const &nickname);
 	void kick(Client *commander, std::string const &nickname);
 	void kick(Client *commander, std::string const &nickname, std::string const &msg);
-	void mode(Client *commander, int action, char const &mode);
-	void op(Client *commander, int action, std::string const &nickname);
+	void mode(Client *commander, std::vector<ModeChange> const &changes);
+	void show_modes(Client *client);
+	void show_list(Client *commander, char const &mode);
 	void topic(Client *commander);
 	void topic(Client *commander, int action, std::string const &topic);
 	void quit(Client *commander);
-	void quit(Client *commander, std::string const &msg);
+	void part(Client *client, std::string const &msg);
+	void sync_join(Client *client, bool op);
+	void sync_modes(unsigned char modes, unsigned int limit, std::string const &key);
+	void names(Client *client);
+	void rename(Client *client);
+	void recap(Client *client);
 	void message(Client *sender, std::string const &message);
+	void message(Client *sender, std::string const &source, std::string const &message);
+	void announce(std::string const &line);
 
 	void broadcast(std::string const &message);
 	void broadcast(Client *sender, std::string const &message);
+	void broadcast(Client *sender, Variants &variants);
 
-	std::vector<Client *> get_clients() const;
+	std::vector<Client *> const &get_clients() const;
 	std::vector<Client *> get_ops() const;
+	std::map<Client *, size_t> const &get_links() const;
 	unsigned char get_modes();
-	std::string get_topic() const;
-
-	void set_key(Client *commander, std::string const &key);
-	void set_limit(Client *commander, unsigned int limit);
+	std::string const &get_topic() const;
+	time_t get_topic_time() const;
+	std::string get_key() const;
+	unsigned int get_limit() const;
+	History const &get_history() const;
+	void trim_history(size_t max_bytes);
+
+	void set_key(std::string const &key);
+	void set_limit(unsigned int limit);
 	void set_topic(std::string topic);
 
 	bool is_client_in_channel(std::string const &nickname);
-	std::string get_channel_name();
+	bool is_op(Client *client);
+	bool is_banned(Client *client);
+	std::string const &get_channel_name() const;
+	ChannelId get_id() const;
+	void set_id(ChannelId id);
 
 	bool is_empty();
 
+	void save(Archive &out, std::map<Client *, uint32_t> const &ids) const;
+	static Channel *load(Reader &in, std::vector<Client *> const &clients, Server &server);
+
 private:
 	Channel();
-	std::string name;
+	Symbol name;
+	ChannelId id; // handle in the server's registry
 	Server &server;
 	std::vector<Client *> clients;
 	std::vector<Client *> ops;
 	std::vector<Client *> invite_list;
 	std::string key;
 	std::string topic_str;
+	time_t topic_time; // when the topic was last set, 0 if unknown
 	unsigned char modes;
 	unsigned int limit;
+	History history;
+	MaskList bans;
+	MaskList excepts;
+	MaskList invexes;
+	std::map<Client *, size_t> links; // members on other servers, counted per server link
+	std::unordered_map<Client *, bool> ban_cache; // members' ban status, dropped when a list or the nick changes
+
+	// NAMES payloads packed into 353-sized chunks, kept up to date on every membership change
+	struct NameSlot
+	{
+		size_t chunk;
+		std::string token;
+	};
+	std::vector<std::string> names_chunks;
+	std::unordered_map<Client *, NameSlot> names_index;
+	size_t names_empty_chunks;
+
+	// The members as parallel arrays indexed by slot, so a broadcast is one linear
+	// pass over fds and capability classes. A removal moves the last slot into the gap.
+	std::vector<int> fanout_fds;
+	std::vector<unsigned char> fanout_caps;
+	std::vector<Client *> fanout_members;
+	std::unordered_map<Client *, size_t> slots; // member -> slot
+	size_t accounted; // bytes this channel added to the memory accounting
 
 	bool invite_check(Client *client);
+	MaskList *get_list(char const &mode);
 	bool key_check(std::string const &key);
 	bool limit_check();
+	size_t footprint() const;
+	void account();
 
-	void add_mode(char const &mode);
-	void remove_mode(char const &mode);
+	bool change_member(Client *commander, bool adding, std::string const &nickname);
+	bool change_list(Client *commander, bool adding, char const &mode, std::string const &mask);
 
 	Client *get_client(Client *client);
 	Client *get_client(std::string const &nickname);
@@ -80,6 +148,17 @@ private:
 	void remove_client(std::string const &nickname);
 	void remove_client(Client *client);
 
+	size_t names_budget() const;
+	void names_add(Client *client);
+	void names_remove(Client *client);
+	void names_refresh(Client *client);
+	void names_rebuild();
+
+	size_t slot_of(Client *client) const;
+	void fanout_add(Client *client);
+	void fanout_remove(Client *client);
+	void fanout_rebuild();
+
 	Client *get_op(Client *client);
 	Client *get_op(std::string const &nickname);
 	void add_op(Client *client);
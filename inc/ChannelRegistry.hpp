@@ -0,0 +1,46 @@
+#ifndef CHANNELREGISTRY_H
+#define CHANNELREGISTRY_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+class Channel;
+
+typedef uint64_t ChannelId; // slot in the low half, the slot's generation in the high half
+
+#define NO_CHANNEL ((ChannelId)0)
+
+// The server's channels, found by name under the rfc1459 casemapping so
+// `#Foo` and `#foo` are the same channel. Every channel gets an id for its
+// lifetime: the id names a slot and the slot's generation, so an id kept
+// after its channel is gone no longer resolves, even once the slot is reused.
+class ChannelRegistry
+{
+public:
+	ChannelRegistry();
+
+	Channel *find(std::string const &name) const;
+	Channel *get(ChannelId id) const;
+	ChannelId add(Channel *channel);
+	void remove(Channel *channel);
+	std::vector<Channel *> list() const;
+	size_t slot_count() const;		  // for walking the slots, e.g. across loop iterations
+	Channel *at(size_t slot) const; // NULL for a free slot
+	size_t size() const;
+	bool empty() const;
+
+private:
+	struct Slot
+	{
+		Channel *channel;
+		uint32_t generation;
+	};
+	std::unordered_map<std::string, uint32_t> index; // casefolded name -> slot
+	std::vector<Slot> slots;
+	std::vector<uint32_t> free_slots;
+	size_t count;
+};
+
+#endif
@@ -12,30 +12,53 @@
 #include <poll.h>
 #include <csignal>
 #include <memory>
+#include <deque>
+#include <functional>
+#include <ctime>
 #include "Channel.hpp"
+#include "Archive.hpp"
+#include "Symbol.hpp"
+#include "Capabilities.hpp"
 
 class Channel;
+class TlsSession;
 class Client
 {
 private:
 	int fd;
-	std::string IPaddr;
+	Symbol IPaddr;
+	Symbol host; // shown in hostmasks: the address's name once resolved, the address until then
 	bool registered;
 	bool logged_in;
-	std::string nickname;
-	std::string username;
+	Symbol nickname;
+	Symbol username;
 	std::string buffer;
-	std::string hostname;
+	Symbol hostname;
 	std::string realname;
 	std::vector<Channel *> channels;
+	std::deque<std::string> deferred; // lines waiting to be paced out by the event loop
+	std::function<bool(size_t)> stream; // refills deferred with up to n lines, false once done
+	Client *link;		// for users on another server: the server connection they are reached through
+	std::string server; // for users on another server: their server, for server links: the peer's name
+	bool server_link;	// the connection is an established link to another server
+	bool introduced;	// the user has been announced to the linked servers
+	time_t nick_ts;		// when the nickname was taken, the oldest wins a collision
+	unsigned long serial; // identifies the connection in the I/O pipeline
+	unsigned long visited; // last fan-out that reached the client, see Server::send_common
+	std::shared_ptr<TlsSession> tls; // set if the client connected to the TLS listener
+	unsigned char caps;	// CAP_* bits the client enabled
+	bool negotiating;	// registration waits for CAP END
+	bool closing;		// quit this tick, deleted by Server::teardown at its end
 
 public:
 	Client();
 	Client(std::string nickname, std::string username, int fd);
+	~Client();
 
 	// Setters
 	void set_fd(int fd);
 	void set_IPaddr(std::string IPaddr);
+	void set_host(std::string const &host);
 	void set_buffer(std::string buff);
 	void set_nickname(std::string &nickname);
 	void set_hostname(std::string &hostname);
@@ -43,18 +66,43 @@ public:
 	void set_username(std::string &username);
 	void set_registered(bool value);
 	void set_logged_in(bool value);
+	void set_link(Client *link, std::string const &server);
+	void set_server_link(std::string const &server);
+	void set_introduced(bool value);
+	void set_nick_ts(time_t ts);
+	void set_serial(unsigned long serial);
+	void set_tls(std::shared_ptr<TlsSession> const &tls);
+	void set_caps(unsigned char caps);
+	void set_negotiating(bool value);
+	void set_closing();
 
 	// Getter
 	int get_fd() const;
 	bool is_registered();
 	bool is_logged_in();
-	std::string get_nickname() const;
-	std::string get_username() const;
+	bool is_welcomed() const;
+	std::string const &get_nickname() const;
+	Symbol const &get_nick_symbol() const;
+	std::string const &get_username() const;
 	std::string get_buffer() const;
-	std::string get_IPaddr() const;
-	std::string get_hostname() const;
-	std::string get_realname() const;
+	std::string const &get_IPaddr() const;
+	std::string const &get_host() const;
+	std::string const &get_hostname() const;
+	std::string const &get_realname() const;
+	std::string get_hostmask() const;
 	std::vector<Channel *> get_channels() const;
+	Client *get_link() const;
+	std::string const &get_server() const;
+	bool is_server_link() const;
+	bool is_remote() const;
+	bool is_introduced() const;
+	time_t get_nick_ts() const;
+	unsigned long get_serial() const;
+	std::shared_ptr<TlsSession> const &get_tls() const;
+	unsigned char get_caps() const;
+	bool has_cap(unsigned char cap) const;
+	bool is_negotiating() const;
+	bool is_closing() const;
 
 	// Add
 	void add_channel(Channel *channel);
@@ -64,6 +112,16 @@ public:
 
 	// Methods
 	void clear_buffer();
+	void defer(std::string const &line);
+	void requeue(std::string const &data);
+	bool visit(unsigned long epoch);
+	bool has_deferred() const;
+	std::string pop_deferred();
+	void add_stream(std::function<bool(size_t)> stream);
+	bool has_stream() const;
+	void run_stream(size_t budget);
+	void save(Archive &out) const;
+	void load(Reader &in);
 };
 
 #endif
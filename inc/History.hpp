@@ -0,0 +1,64 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "Archive.hpp"
+
+#define HISTORY_MAX_LINES 512		   // max messages kept per channel
+#define HISTORY_MAX_BYTES (64 * 1024) // max bytes of message text kept per channel
+#define HISTORY_MAX_QUERY 100		   // max messages returned by one CHATHISTORY query
+
+struct HistoryEntry
+{
+	unsigned long long msgid; // server-wide, strictly increasing within a channel
+	long long time;			  // milliseconds since the epoch
+	std::string line;		  // the full line as it was broadcast (CRLF included)
+};
+
+// Fixed-size ring of the last messages sent to a channel. Bounded both by
+// message count and by the total size of the stored lines; the oldest
+// entries are evicted first.
+class History
+{
+public:
+	History(size_t max_lines = HISTORY_MAX_LINES, size_t max_bytes = HISTORY_MAX_BYTES);
+	~History();
+	History(History const &) = delete; // the bytes are accounted once
+	History &operator=(History const &) = delete;
+
+	bool push(std::string const &line, long long time, unsigned long long msgid);
+	void trim(size_t max_bytes);
+
+	std::vector<HistoryEntry const *> latest(size_t limit) const;
+	std::vector<HistoryEntry const *> before(unsigned long long msgid, size_t limit) const;
+	std::vector<HistoryEntry const *> after(unsigned long long msgid, size_t limit) const;
+	unsigned long long first_at_or_after(long long time) const;
+	unsigned long long last_at_or_before(long long time) const;
+
+	size_t size() const;
+	size_t get_bytes() const;
+
+	void save(Archive &out) const;
+	void load(Reader &in);
+
+	static long long now();
+	static long long parse_timestamp(std::string const &timestamp);
+	static std::string format_timestamp(long long time);
+
+private:
+	std::vector<HistoryEntry> ring;
+	size_t head; // index of the oldest entry
+	size_t count;
+	size_t bytes;
+	size_t max_bytes;
+
+	HistoryEntry const &at(size_t i) const;
+	size_t first_above(unsigned long long msgid) const;
+	std::vector<HistoryEntry const *> range(size_t from, size_t to) const;
+	bool append(std::string const &line, long long time, unsigned long long msgid);
+	void pop_oldest();
+};
+
+#endif
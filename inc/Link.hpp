@@ -0,0 +1,40 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <string>
+#include <ctime>
+
+#define LINK_RETRY 10			// seconds between attempts to open the autoconnect links
+#define LINK_CONNECT_TIMEOUT 2 // seconds a link's connect() may take
+#define LINK_DESCRIPTION ":ft_irc"
+
+class Client;
+
+// A `link` line of the links file: a server we accept a link from or open one to
+struct LinkBlock
+{
+	std::string name;
+	std::string host;
+	std::string port;
+	std::string password;
+	bool autoconnect;
+	bool resolving; // waiting for the resolver to find the host's address
+};
+
+// An outgoing link whose connect() hasn't completed yet
+struct LinkConnect
+{
+	std::string name;
+	time_t started;
+};
+
+// Another server of the network, reached through one of our direct links
+struct NetServer
+{
+	std::string name;
+	std::string uplink; // the server that introduced it
+	Client *link;		// our direct link towards it
+	int hops;
+};
+
+#endif
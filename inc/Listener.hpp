@@ -0,0 +1,46 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <string>
+
+#define LISTENER_BACKLOG SOMAXCONN
+#define LISTENER_UNIX_ADDRESS "localhost" // address and host of the clients of a unix socket
+
+// A socket the server accepts connections on: the command line port, the TLS port
+// and the `listen` lines of the links file, TCP on an address or a unix socket path
+class Listener
+{
+public:
+	Listener(std::string const &address, int port, bool tls); // port 0: address is a unix socket path
+
+	bool set_option(std::string const &option); // "nodelay", "rcvbuf=262144"... false if unknown
+	void open();								  // throws if the socket can't be set up
+	void adopt(int fd);							  // handed over by a hot upgrade, options applied again
+	void own();									  // the hot upgrade went through, the unix socket file is ours
+	void tune(int fd) const;					  // the options an accepted socket doesn't inherit
+	void close();								  // removes the unix socket file if it was bound here
+
+	std::string const &get_name() const;
+	int get_fd() const;
+	bool is_tls() const;
+	bool is_unix() const;
+
+private:
+	std::string address; // "*" for every address, dual-stack
+	int port;
+	bool tls;
+	int fd;
+	bool bound;		  // the unix socket file is ours to remove, not if it came with a hot upgrade
+	std::string name; // "* 6667", "unix /run/ircserv.sock", matched across a hot upgrade
+	int rcvbuf;		  // SO_RCVBUF in bytes, 0 for the system default
+	int sndbuf;		  // SO_SNDBUF
+	bool nodelay;	  // TCP_NODELAY
+	int defer_accept; // TCP_DEFER_ACCEPT, seconds to wait for the first bytes
+	int busy_poll;	  // SO_BUSY_POLL, microseconds
+
+	void apply() const;
+	void bind_tcp();
+	void bind_unix();
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef LOOPSTATS_H
+#define LOOPSTATS_H
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+#define LOOP_BUCKETS 25		  // power of two microsecond buckets, the last one takes everything above 16s
+#define LOOP_COMMAND_KINDS 32 // room for one per IRCCommand, unknown commands are counted as ERROR
+#define SLOW_COMMAND_US 10000 // commands running longer are logged
+
+// Where the time of the main loop goes: waiting in poll() versus running
+// what it returned, how many descriptors were ready, and how long every kind
+// of command runs. The processing time of each iteration is what new input
+// may have to wait before it is looked at, it's kept as a histogram.
+class LoopStats
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	LoopStats();
+
+	void polling();			 // right before poll()
+	void polled(int ready); // right after it
+	void command(int kind, Clock::duration spent);
+	std::string report() const;
+
+	static long long micros(Clock::duration spent);
+
+private:
+	struct Histogram
+	{
+		uint64_t counts[LOOP_BUCKETS];
+		void add(long long micros);
+		std::string report(std::string const &indent) const;
+	};
+
+	struct CommandStats
+	{
+		uint64_t count;
+		long long total; // microseconds
+		long long max;
+	};
+
+	Clock::time_point poll_start;
+	Clock::time_point poll_end; // start of the iteration's processing, unset before the first poll
+	uint64_t ticks;
+	uint64_t ready;
+	uint64_t idle; // iterations where poll() returned nothing, e.g. timeouts
+	long long waiting;
+	long long processing;
+	Histogram lag;
+	CommandStats commands[LOOP_COMMAND_KINDS];
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef MASK_H
+#define MASK_H
+
+#include <string>
+#include <vector>
+
+char irc_tolower(char c);
+std::string irc_lower(std::string const &str);
+
+// A glob mask (`*` any run, `?` any character) compiled once into its
+// literal segments, matched case-insensitively with the rfc1459 casemapping.
+class Mask
+{
+public:
+	Mask();
+	Mask(std::string const &mask);
+
+	bool match(std::string const &str) const;
+	bool has_wildcards() const;
+	std::string const &get_mask() const;
+
+private:
+	std::string mask;
+	std::string prefix;				  // literal anchored at the start
+	std::string suffix;				  // literal anchored at the end
+	std::vector<std::string> middle;  // literals between stars, matched left to right
+	bool star;						  // false if the mask has no `*` at all
+	bool wildcards;
+	size_t min_length;
+
+	static bool match_at(std::string const &str, size_t pos, std::string const &literal);
+	static size_t find(std::string const &str, size_t from, size_t to, std::string const &literal);
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef MASKLIST_H
+#define MASKLIST_H
+
+#include "Mask.hpp"
+#include "Archive.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <ctime>
+
+#define MASKLIST_MAX 1000 // max entries per list (+b, +e, +I)
+
+struct MaskEntry
+{
+	Mask mask;
+	std::string setter;
+	time_t time;
+	bool in_use;
+};
+
+// A channel's +b/+e/+I list. Masks are indexed by their literal prefix in a
+// trie (or by their reversed literal suffix when they start with `*`), so a
+// lookup walks the hostmask once and only runs the glob on the candidates;
+// masks with neither literal are checked one by one. Removing a mask leaves
+// its trie nodes behind, so the tries are rebuilt once they hold more than
+// twice the nodes the live masks need.
+class MaskList
+{
+public:
+	MaskList();
+
+	bool add(std::string const &mask, std::string const &setter);
+	bool remove(std::string const &mask);
+	bool match(std::string const &hostmask) const;
+	std::vector<MaskEntry const *> entries() const;
+	size_t size() const;
+
+	void save(Archive &out) const;
+	void load(Reader &in);
+
+private:
+	struct Node
+	{
+		std::map<char, size_t> next;
+		std::vector<size_t> masks; // entries whose literal ends at this node
+	};
+
+	std::vector<MaskEntry> slots;
+	std::vector<size_t> free_slots;
+	std::vector<Node> prefixes; // root is node 0
+	std::vector<Node> suffixes; // keyed by the reversed suffix
+	std::vector<size_t> others;
+	std::unordered_map<std::string, size_t> slot_of; // lower-cased mask to its slot
+	size_t count;
+	size_t literals; // trie key characters of the live masks, the nodes they need at most
+
+	size_t find(std::string const &mask) const;
+	std::vector<size_t> *bucket(std::string const &mask, bool create);
+	static size_t walk(std::vector<Node> &trie, std::string const &key, bool create);
+	static size_t key_length(std::string const &mask);
+	void rebuild();
+	bool check(std::vector<size_t> const &candidates, std::string const &hostmask) const;
+};
+
+#endif
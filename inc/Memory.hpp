@@ -0,0 +1,42 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+#define MEMORY_BUDGET (256UL * 1024 * 1024)	  // bytes all accounted structures may use together
+#define MEMORY_IO_SHARE (MEMORY_BUDGET / 2)		  // of it for input and output buffers, shed by dropping connections
+#define MEMORY_HISTORY_SHARE (MEMORY_BUDGET / 4)  // for channel history, trimmed oldest first
+#define MEMORY_CHANNELS_SHARE (MEMORY_BUDGET / 8) // for channels, no channel is created over it
+#define SENDQ_MAX (1024 * 1024)				// bytes of output waiting for one connection
+#define RECVQ_MAX (8 * 1024)				// bytes of input without a line end from one connection
+
+enum MemoryKind
+{
+	MEM_RECV,	  // partial input lines held by the reader
+	MEM_SEND,	  // output waiting in the writer for a socket to drain
+	MEM_DEFERRED, // paced output waiting in the clients
+	MEM_HISTORY,  // channel message history
+	MEM_CHANNELS, // channel members, names cache and mask lists
+	MEM_CLIENTS,  // client records
+	MEM_KINDS
+};
+
+// Process-wide byte counters, updated where the memory is taken or given back.
+// The I/O threads update theirs too, so the counters are atomic.
+class Memory
+{
+public:
+	static void add(MemoryKind kind, long long delta);
+	static long long used(MemoryKind kind);
+	static long long total();
+	static bool io_over_budget();
+	static bool over_share(MemoryKind kind, unsigned long share);
+	static std::string report();
+
+private:
+	static std::atomic<long long> counters[MEM_KINDS];
+};
+
+#endif
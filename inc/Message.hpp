@@ -24,26 +24,37 @@ enum IRCCommand {
     PART,
     WHO,
     WHOIS,
+    CHATHISTORY,
+    NAMES,
+    LIST,
+    SERVER,
     ERROR,
 };
 
 IRCCommand assignCommand(std::string cmd);
+const std::string &commandName(IRCCommand command);
 
 // Class to represent an IRC message
 class Message {
 private:
     std::string rawMessage;
+    std::string tags; // IRCv3 tags the client sent, without the '@'
     std::string prefix;
     std::string rawCmd;
     IRCCommand command;
     std::vector<std::string> params;
+    size_t bodyStart;
     void parse();
 public:
     Message(const std::string& msg);
     std::string getPrefix() const;
+    const std::string &getTags() const;
     IRCCommand getCommand() const;
     std::vector<std::string> getParams() const;
     const std::string &getRawCmd();
+    std::string getBody() const;
+    std::string getSourceNick() const;
+    const std::string &getRawMessage() const;
 };
 
 #endif
@@ -0,0 +1,68 @@
+#ifndef MODES_H
+#define MODES_H
+
+#include <string>
+
+#define MODE_I 0b00000001
+#define MODE_K 0b00000010
+#define MODE_L 0b00000100
+
+#define MODES_PER_LINE 4	// changes with a parameter per MODE line, ISUPPORT MODES
+#define MODE_LINE_MAX 400	// room for the changes of one MODE line, the prefix takes the rest
+#define CHANNEL_KEY_MAX 23 // longest key +k takes
+
+// How a channel mode takes its parameter, the classes of ISUPPORT CHANMODES
+enum ModeKind
+{
+	MODE_LIST,	 // A: a mask to add or remove, none to show the list
+	MODE_MEMBER, // PREFIX: a nickname, set and unset
+	MODE_ALWAYS, // B: a parameter when set and when unset
+	MODE_SET,	 // C: a parameter when set only
+	MODE_FLAG	 // D: never a parameter
+};
+
+struct ModeSpec
+{
+	char letter;
+	ModeKind kind;
+	unsigned char flag; // bit in the channel's modes, 0 for the ones kept elsewhere
+};
+
+// Every channel mode, MODE parses its mode string against this
+constexpr ModeSpec MODE_TABLE[] = {
+	{'b', MODE_LIST, 0},
+	{'e', MODE_LIST, 0},
+	{'I', MODE_LIST, 0},
+	{'o', MODE_MEMBER, 0},
+	{'k', MODE_ALWAYS, MODE_K},
+	{'l', MODE_SET, MODE_L},
+	{'i', MODE_FLAG, MODE_I},
+};
+
+// The entry of a mode letter, nullptr for an unknown one
+constexpr ModeSpec const *find_mode(char letter)
+{
+	for (ModeSpec const &spec : MODE_TABLE)
+		if (spec.letter == letter)
+			return (&spec);
+	return (nullptr);
+}
+
+// Whether a change consumes one of the MODE parameters. -k takes one but doesn't need it.
+constexpr bool takes_param(ModeSpec const &spec, bool adding)
+{
+	return (spec.kind != MODE_FLAG && (spec.kind != MODE_SET || adding));
+}
+
+static_assert(find_mode('k')->flag == MODE_K && find_mode('l')->flag == MODE_L && find_mode('i')->flag == MODE_I, "mode table out of sync with the mode bits");
+static_assert(find_mode('+') == nullptr && find_mode('-') == nullptr, "signs are not modes");
+
+// One change of a MODE command, checked against the table
+struct ModeChange
+{
+	bool adding;
+	ModeSpec const *spec;
+	std::string param;
+};
+
+#endif
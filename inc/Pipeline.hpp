@@ -0,0 +1,142 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "SpscQueue.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <memory>
+#include <poll.h>
+
+#define PIPELINE_QUEUE_SIZE 1024 // batches in flight between two stages
+#define PIPELINE_READ_SIZE 4096	 // bytes read from a socket at once
+#define PIPELINE_TRACKED_FDS 65536 // fds whose send queue size the logic thread can see
+
+class Message;
+class TlsSession;
+
+// Complete lines read from one connection, already parsed
+struct Inbound
+{
+	int fd;
+	unsigned long serial; // tells a closed connection from a new one on the same fd
+	std::vector<Message> messages;
+	bool closed;		// the peer went away after these lines
+	std::string reason; // why the connection was dropped, empty if the peer closed it
+};
+
+// Output for one connection, closing it once the data is sent if `close` is set
+struct Outbound
+{
+	int fd;
+	std::string data;
+	bool close;
+};
+
+// A connection the writer dropped, for the reader to report
+struct Shed
+{
+	int fd;
+	std::string reason;
+};
+
+// A connection handed to the reader, with input left over from before
+struct Watch
+{
+	int fd;
+	unsigned long serial;
+	std::string partial;
+	std::shared_ptr<TlsSession> tls; // set for TLS connections
+};
+
+// Socket I/O staged around the thread running the commands: a reader thread
+// receives, frames and parses the input, a writer thread sends the output.
+// The stages exchange batches through single producer single consumer queues
+// and wake each other with pipes.
+//
+//   reader --input--> logic --output--> writer --retired--> reader
+//
+// TLS connections go through their session, which is plain recv()/send() once
+// the kernel took over the record layer.
+//
+// A socket is only ever closed by the reader, after the writer has sent what
+// was left for it, so its number can't be reused while a stage still uses it.
+class Pipeline
+{
+public:
+	Pipeline();
+	~Pipeline();
+
+	void start();
+	void stop(std::map<int, std::string> &partial, std::map<int, std::string> &unsent);
+	bool is_running() const;
+
+	// Logic thread side
+	int get_wakeup_fd() const; // readable when input is waiting
+	void acknowledge();
+	bool receive(std::vector<Inbound> &batch);
+	void watch(int fd, unsigned long serial, std::string const &partial, std::shared_ptr<TlsSession> const &tls);
+	void send(std::vector<Outbound> &batch);
+	void close(int fd, std::string const &data);
+	size_t backlog(int fd) const; // bytes the writer holds for the connection, 0 above PIPELINE_TRACKED_FDS
+
+private:
+	struct Connection
+	{
+		unsigned long serial;
+		std::string partial;
+		std::shared_ptr<TlsSession> tls;
+	};
+
+	SpscQueue<std::vector<Inbound> > input;	  // reader -> logic
+	SpscQueue<std::vector<Outbound> > output; // logic -> writer
+	SpscQueue<Watch> watches;				  // logic -> reader
+	SpscQueue<int> retired;					  // writer -> reader
+	SpscQueue<Shed> shed;					  // writer -> reader
+	SpscQueue<Watch> secured;				  // logic -> writer, the TLS sessions of new connections
+	int logic_wake[2];
+	int reader_wake[2];
+	int writer_wake[2];
+	std::atomic<bool> stopping;
+	bool running;
+	std::thread reader;
+	std::thread writer;
+
+	// owned by the reader thread
+	std::vector<struct pollfd> reader_fds;
+	std::unordered_map<int, Connection> connections;
+	std::vector<Inbound> held; // input waiting for room in the queue
+
+	// owned by the writer thread
+	std::unordered_map<int, std::string> pending;
+	std::unordered_set<int> dropped; // output for these is discarded until they are closed
+	std::unordered_map<int, std::shared_ptr<TlsSession> > sessions;
+	std::unique_ptr<std::atomic<uint32_t>[]> backlogs; // size of pending per fd, read by the logic thread
+
+	void reader_loop();
+	void writer_loop();
+	void apply_watches(std::vector<Inbound> &batch);
+	void apply_retired();
+	void apply_shed(std::vector<Inbound> &batch);
+	void apply_secured();
+	void end_session(int fd);
+	void forget(int fd);
+	bool read_from(size_t i, std::vector<Inbound> &batch);
+	void frame(int fd, Connection &connection, std::vector<Inbound> &batch);
+	bool flush(int fd);
+	void queue(int fd, std::string const &data);
+	void drop_pending(int fd);
+	void set_backlog(int fd, size_t size);
+	void drop_connection(int fd, std::string const &reason);
+	void enforce_budget();
+
+	static void wake(int fd);
+	static void drain(int fd);
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <string>
+#include <vector>
+
+// The interface between the server and the plugins it loads with dlopen().
+// A plugin is a shared object exporting
+//   extern "C" Plugin *ircserv_plugin(int api_version);
+// which returns a new Plugin, or NULL if it doesn't support the version. It
+// runs on the thread running the commands, inside the event loop, so every
+// hook should return quickly: a hook that takes longer than its budget is
+// logged, and a plugin that keeps doing so or throws is disabled.
+
+#define PLUGIN_API_VERSION 1
+#define PLUGIN_ENTRY "ircserv_plugin"
+
+// What a plugin can do, from within its hooks
+class PluginHost
+{
+public:
+	virtual ~PluginHost() {}
+
+	virtual std::string const &server_name() const = 0;
+	// PRIVMSG to a channel or a user, from `service!service@<server>`. False if there is no such target.
+	virtual bool say(std::string const &service, std::string const &target, std::string const &text) = 0;
+	// NOTICE to a user
+	virtual bool notice(std::string const &service, std::string const &nickname, std::string const &text) = 0;
+	virtual std::vector<std::string> members(std::string const &channel) const = 0;
+};
+
+// The hooks, the default ones do nothing
+class Plugin
+{
+public:
+	virtual ~Plugin() {}
+
+	virtual std::string name() const = 0;
+	// Before the server runs a command of a registered local client, true if the plugin took care of it
+	virtual bool on_command(PluginHost &, std::string const & /* nickname */, std::string const & /* command */, std::vector<std::string> const & /* params */) { return (false); }
+	virtual void on_join(PluginHost &, std::string const & /* channel */, std::string const & /* nickname */) {}
+	virtual void on_part(PluginHost &, std::string const & /* channel */, std::string const & /* nickname */, std::string const & /* reason */) {}
+	virtual void on_message(PluginHost &, std::string const & /* channel */, std::string const & /* nickname */, std::string const & /* text */) {}
+	virtual void on_kick(PluginHost &, std::string const & /* channel */, std::string const & /* kicker */, std::string const & /* kicked */, std::string const & /* reason */) {}
+};
+
+extern "C"
+{
+	typedef Plugin *(*PluginEntry)(int api_version);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef PLUGINS_H
+#define PLUGINS_H
+
+#include "Plugin.hpp"
+#include <string>
+#include <vector>
+
+#define PLUGIN_BUDGET_US 1000 // default time a hook may take, in microseconds
+#define PLUGIN_STRIKES 16	  // hooks over budget before a plugin is disabled
+
+// The loaded plugins, with every hook call timed against the plugin's budget
+class Plugins
+{
+public:
+	Plugins(PluginHost &host);
+	~Plugins();
+
+	void load(std::string const &path, long budget); // throws if the plugin can't be loaded
+	bool empty() const;
+	std::string report() const;
+
+	bool command(std::string const &nickname, std::string const &command, std::vector<std::string> const &params);
+	void join(std::string const &channel, std::string const &nickname);
+	void part(std::string const &channel, std::string const &nickname, std::string const &reason);
+	void message(std::string const &channel, std::string const &nickname, std::string const &text);
+	void kick(std::string const &channel, std::string const &kicker, std::string const &kicked, std::string const &reason);
+
+private:
+	struct Loaded
+	{
+		std::string path;
+		std::string name;
+		void *handle;
+		Plugin *plugin;
+		long budget; // microseconds
+		unsigned long calls;
+		unsigned long overruns;
+		long long slowest;
+		bool disabled;
+	};
+
+	PluginHost &host;
+	std::vector<Loaded> loaded;
+
+	template <typename Call>
+	bool run(char const *hook, Call call); // true once a plugin's hook returned true
+	void disable(Loaded &plugin, std::string const &why);
+};
+
+#endif
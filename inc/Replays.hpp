@@ -8,26 +8,49 @@
 
 #define RPL_PRIVMSG(CLIENT, target, text) (CLIENT + " PRIVMSG " + target + " " + text + CRLF)
 #define RPL_NICKCHANGECHANNEL(oldnickname, username, hostname, nickname) (":" + oldnickname + "!~" + username + "@" + hostname + " NICK :" + nickname + CRLF)
+#define RPL_HOSTLOOKUP(server) (":" + server + " NOTICE * :*** Looking up your hostname..." + CRLF)
+#define RPL_HOSTFOUND(server, host) (":" + server + " NOTICE * :*** Found your hostname (" + host + ")" + CRLF)
+#define RPL_HOSTNOTFOUND(server) (":" + server + " NOTICE * :*** Couldn't look up your hostname, using your IP address instead" + CRLF)
 #define RPL_CONNECTED(nickname) (": 001 " + nickname + " : Welcome to the IRC server!" + CRLF)
+#define RPL_ISUPPORT(servername, nickname, tokens) (":" + servername + " 005 " + nickname + " " + tokens + " :are supported by this server" + CRLF)
+#define RPL_CAP(servername, nickname, sub, caps) (":" + servername + " CAP " + nickname + " " + sub + " :" + caps + CRLF)
+#define ERR_INVALIDCAPCMD(servername, nickname, sub) (":" + servername + " 410 " + nickname + " " + sub + " :Invalid CAP command" + CRLF)
 #define RPL_NICKCHANGE(oldnickname, nickname) (":" + oldnickname + " NICK " + nickname + CRLF)
 #define RPL_UMODEIS(NICK, modes) (NICK + " " + modes + CRLF)
 #define RPL_CREATIONTIME(nickname, channelname, creationtime) (": 329 " + nickname + " #" + channelname + " " + creationtime + CRLF)
-#define RPL_CHANNELMODES(nickname, channelname, modes) (": 324 " + nickname + " #" + channelname + " " + modes + CRLF)
 #define RPL_CHANGEMODE(hostname, channelname, mode, arguments) (":" + hostname + " MODE #" + channelname + " " + mode + " " + arguments + CRLF)
 #define RPL_JOINMSG(hostname, ipaddress, channelname) (":" + hostname + "@" + ipaddress + " JOIN #" + channelname + CRLF)
-#define RPL_NAMREPLY(nickname, channelname, clientslist) (": 353 " + nickname + " @ #" + channelname + " :" + clientslist + CRLF)
-#define RPL_ENDOFNAMES(nickname, channelname) (": 366 " + nickname + " #" + channelname + " :END of /NAMES list" + CRLF)
+#define RPL_NAMREPLY(nickname, channelname, clientslist) (": 353 " + nickname + " @ " + channelname + " :" + clientslist + CRLF)
+#define RPL_ENDOFNAMES(nickname, channelname) (": 366 " + nickname + " " + channelname + " :END of /NAMES list" + CRLF)
 #define RPL_TOPICIS(nickname, channelname, topic) (": 332 " + nickname + " " + channelname + " :" + topic + CRLF)
 #define RPL_INVITING(nickname, channelname, invited) ("341 " + nickname + " " + invited + " " + channelname + CRLF)
 #define RPL_INVITED(CLIENT, nickname, channelname) (CLIENT + " INVITE " + nickname + " " + channelname + CRLF)
-#define RPL_WHOISUSER(servername, nickname, username, hostname, realname) (":" + servername + " 311 " + nickname + " " + username + " " + hostname + " * :" + realname + CRLF)
-#define RPL_ENDOFWHOIS(servername, nickname) (":" + servername + " 318 " + nickname + " :End of WHOIS list." + CRLF)
+#define RPL_WHOISUSER(servername, me, nickname, username, hostname, realname) (":" + servername + " 311 " + me + " " + nickname + " ~" + username + " " + hostname + " * :" + realname + CRLF)
+#define RPL_WHOISSERVER(servername, me, nickname, server) (":" + servername + " 312 " + me + " " + nickname + " " + server + " :ft_irc" + CRLF)
+#define RPL_WHOISCHANNELS(servername, me, nickname, channels) (":" + servername + " 319 " + me + " " + nickname + " :" + channels + CRLF)
+#define RPL_WHOISSECURE(servername, me, nickname) (":" + servername + " 671 " + me + " " + nickname + " :is using a secure connection" + CRLF)
+#define RPL_ENDOFWHOIS(servername, me, nickname) (":" + servername + " 318 " + me + " " + nickname + " :End of WHOIS list." + CRLF)
+#define RPL_WHOREPLY(servername, me, channel, username, hostname, nickname, flags, realname) (":" + servername + " 352 " + me + " " + channel + " ~" + username + " " + hostname + " " + servername + " " + nickname + " " + flags + " :0 " + realname + CRLF)
+#define RPL_LIST(servername, me, channel, count, topic) (":" + servername + " 322 " + me + " " + channel + " " + count + " :" + topic + CRLF)
+#define RPL_LISTEND(servername, me) (":" + servername + " 323 " + me + " :End of /LIST" + CRLF)
+#define RPL_ENDOFWHO(servername, me, mask) (":" + servername + " 315 " + me + " " + mask + " :End of WHO list." + CRLF)
 #define RPL_NOTOPIC(CLIENT, channelname) (CLIENT + " TOPIC " + channelname + " :" + CRLF)
 #define RPL_TOPIC(CLIENT, channelname, topic) (CLIENT + " TOPIC " + channelname + " " + topic + CRLF)
-#define RPL_YOUREOPER(CLIENT, channel, nickname) (CLIENT + " MODE " + channel + " +o " + nickname + CRLF)
-#define RPL_YOURENOTOPER(CLIENT, channel, nickname) (CLIENT + " MODE " + channel + " -o " + nickname + CRLF)
+#define RPL_MODE(CLIENT, channel, changes) (CLIENT + " MODE " + channel + " " + changes + CRLF)
+#define RPL_CHANNELMODEIS(servername, me, channel, modes) (":" + servername + " 324 " + me + " " + channel + " " + modes + CRLF)
+#define RPL_BANLIST(nickname, channel, mask, setter, time) (": 367 " + nickname + " " + channel + " " + mask + " " + setter + " " + time + CRLF)
+#define RPL_ENDOFBANLIST(nickname, channel) (": 368 " + nickname + " " + channel + " :End of channel ban list" + CRLF)
+#define RPL_EXCEPTLIST(nickname, channel, mask, setter, time) (": 348 " + nickname + " " + channel + " " + mask + " " + setter + " " + time + CRLF)
+#define RPL_ENDOFEXCEPTLIST(nickname, channel) (": 349 " + nickname + " " + channel + " :End of channel exception list" + CRLF)
+#define RPL_INVITELIST(nickname, channel, mask, setter, time) (": 346 " + nickname + " " + channel + " " + mask + " " + setter + " " + time + CRLF)
+#define RPL_ENDOFINVITELIST(nickname, channel) (": 347 " + nickname + " " + channel + " :End of channel invite list" + CRLF)
 #define RPL_KICK(CLIENT, channel, nickname, msg) (CLIENT + " KICK " + channel + " " + nickname + " " + msg + CRLF)
 #define RPL_QUIT(CLIENT, msg) (CLIENT + " QUIT " + msg + CRLF)
+#define RPL_PART(CLIENT, channel, msg) (CLIENT + " PART " + channel + " " + msg + CRLF)
+
+// STANDARD REPLIES
+
+#define FAIL_CHATHISTORY(code, context, description) (std::string("FAIL CHATHISTORY ") + code + " " + context + " :" + description + CRLF)
 
 // ERRORS
 
@@ -37,20 +60,24 @@
 #define ERR_ERRONEUSNICK(nickname) (": 432 " + nickname + " :Erroneus nickname" + CRLF)
 #define ERR_ALREADYREGISTERED(nickname) (": 462 " + nickname + " :You are already registered!" + CRLF)
 #define ERR_INCORPASS(nickname) (": 464 " + nickname + " :Password incorrect! try again!" + CRLF)
-#define ERR_NEEDMODEPARM(channelname, mode) (": 696 #" + channelname + " * You must specify a parameter for the key mode. " + mode + CRLF)
-#define ERR_INVALIDMODEPARM(channelname, mode) (": 696 #" + channelname + " Invalid mode parameter. " + mode + CRLF)
-#define ERR_KEYSET(channelname) (": 467 #" + channelname + " Channel key already set. " + CRLF)
-#define ERR_UNKNOWNMODE(nickname, channelname, mode) (": 472 " + nickname + " #" + channelname + " " + mode + " :is not a recognised channel mode" + CRLF)
+#define ERR_INVALIDMODEPARAM(servername, me, channel, mode, param) (":" + servername + " 696 " + me + " " + channel + " " + mode + " " + param + " :Invalid mode parameter" + CRLF)
+#define ERR_UNKNOWNMODE(servername, me, mode) (":" + servername + " 472 " + me + " " + mode + " :is not a recognised channel mode" + CRLF)
+#define ERR_USERNOTINCHANNEL(servername, me, nickname, channel) (":" + servername + " 441 " + me + " " + nickname + " " + channel + " :They aren't on that channel" + CRLF)
 #define ERR_CHANNELNOTFOUND(nickname, channelname) (": 403 " + nickname + " " + channelname + " :No such channel" + CRLF)
 #define ERR_NOTOPERATOR(channelname) (": 482 #" + channelname + " :You're not a channel operator" + CRLF)
 #define ERR_NOSUCHCHANNEL(channel) ("403 * " + channel + " :No such channel" + CRLF)
 #define ERR_CMDNOTFOUND(nickname, command) (": 421 " + nickname + " " + command + " :Unknown command" + CRLF)
 #define ERR_NOTONCHANNEL(channel) ("442 " + channel + " :You're not on that channel" + CRLF)
+#define ERR_UNAVAILRESOURCE(servername, nickname, channel) (":" + servername + " 437 " + nickname + " " + channel + " :Channel is temporarily unavailable" + CRLF)
 #define ERR_INVITEONLYCHAN(hostname, nickname, channel) (":" + hostname + " 473 " + nickname + " " + channel + " :Cannot join channel (+i)" + CRLF)
+#define ERR_BANNEDFROMCHAN(hostname, nickname, channel) (":" + hostname + " 474 " + nickname + " " + channel + " :Cannot join channel (+b)" + CRLF)
+#define ERR_CANNOTSENDTOCHAN(nickname, channel) (": 404 " + nickname + " " + channel + " :Cannot send to channel" + CRLF)
+#define ERR_MASKLISTFULL(nickname, channel, mask) (": 478 " + nickname + " " + channel + " " + mask + " :Channel list is full" + CRLF)
 #define ERR_BADCHANNELKEY(channel) ("475 " + channel + " :Cannot join channel (+k)" + CRLF)
 #define ERR_CHANNELISFULL(channel) ("471 " + channel + " :Cannot join channel (+l)" + CRLF)
 #define ERR_USERONCHANNEL(hostname, invited, channel) (":" + hostname + " " + invited + " " + channel + " :is already on channel" + CRLF)
 #define ERR_CHANOPRIVSNEEDED(channel) ("482 " + channel + " :You're not a channel operator" + CRLF)
 #define ERR_NOSUCHNICK(nickname) (": 401 " + nickname + " :No such nick/channel" + CRLF)
+#define ERR_NEEDMOREPARAMS(nickname, command) (": 461 " + nickname + " " + command + " :Not enough parameters" + CRLF)
 
 #endif
@@ -0,0 +1,99 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <ctime>
+
+#define RESOLVER_THREADS 2					   // lookups running at once
+#define RESOLVER_CACHE_SIZE 4096			   // addresses remembered, least recently used go first
+#define RESOLVER_TTL 3600					   // seconds a resolved name is trusted
+#define RESOLVER_NEGATIVE_TTL 300			   // seconds a failed lookup is remembered
+#define RESOLVER_HOST_MAX 63				   // longer names are not used
+#define RESOLVER_STUB_ENV "IRCSERV_RESOLVER_STUB" // file of "address name" lines answering instead of the DNS
+
+// The outcome of a lookup for one connection, host is empty if the address has no usable name
+struct Resolution
+{
+	int fd;
+	unsigned long serial;
+	std::string address;
+	std::string host;
+};
+
+// The address a hostname resolves to, empty if it doesn't
+struct HostAddress
+{
+	std::string host;
+	std::string address;
+};
+
+// Reverse DNS lookups on a small pool of threads. An address is turned into a
+// name with getnameinfo() and the name is only used if it resolves back to the
+// address. The pool also finds the address of the hosts the server links to,
+// so the thread running the commands never waits on the DNS. Results come back to the thread running the commands through a
+// queue and a wakeup pipe, and are cached there. The workers share their
+// state with the resolver, so stopping doesn't wait for a lookup in flight.
+class Resolver
+{
+public:
+	Resolver();
+	~Resolver();
+
+	void start();
+	void stop();
+	int get_wakeup_fd() const;
+	bool lookup(std::string const &address, std::string &host); // cached answer, false on a miss
+	void request(int fd, unsigned long serial, std::string const &address);
+	void request_address(std::string const &host);
+	bool receive(std::vector<Resolution> &done, std::vector<HostAddress> &addresses);
+
+private:
+	struct Shared
+	{
+		std::mutex lock;
+		std::condition_variable ready;
+		std::deque<std::string> jobs;							// addresses to look up
+		std::deque<std::pair<std::string, std::string> > done; // address, name
+		std::deque<std::string> hosts;							// names to find the address of
+		std::deque<HostAddress> found;
+		bool stopping;
+		int wake[2];
+		bool stubbed;
+		std::map<std::string, std::string> stub;
+
+		Shared();
+		~Shared();
+	};
+	struct Waiter
+	{
+		int fd;
+		unsigned long serial;
+	};
+	struct CacheEntry
+	{
+		std::string address;
+		std::string host;
+		time_t expires;
+	};
+
+	std::shared_ptr<Shared> shared;
+	bool running;
+	std::unordered_map<std::string, std::vector<Waiter> > inflight; // address -> connections waiting for it
+	std::list<CacheEntry> lru;										  // most recently used first
+	std::unordered_map<std::string, std::list<CacheEntry>::iterator> cache;
+
+	void remember(std::string const &address, std::string const &host);
+	static void worker(std::shared_ptr<Shared> shared);
+	static std::string resolve(Shared &shared, std::string const &address);
+	static std::string address_of(Shared &shared, std::string const &host);
+};
+
+#endif
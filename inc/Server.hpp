@@ -17,14 +17,41 @@
 #include <cstring>
 #include "Replays.hpp"
 #include "Channel.hpp"
+#include "Snapshot.hpp"
+#include "Mask.hpp"
+#include "Link.hpp"
+#include "Pipeline.hpp"
+#include "Memory.hpp"
+#include "Resolver.hpp"
+#include "Tls.hpp"
+#include "Admission.hpp"
+#include "Capture.hpp"
+#include "LoopStats.hpp"
+#include "Plugins.hpp"
+#include "Listener.hpp"
 #include <memory>
 #include <map>
+#include <unordered_map>
 
 #define RED "\033[1;31m"
 #define WHITE "\033[0;37m"
 #define GREEN "\033[1;32m"
 #define YELLOW "\033[1;33m"
 
+#define DEFERRED_PER_TICK 32 // max deferred lines sent to one client per loop iteration
+
+#define WHO_SCAN_PER_TICK 1024 // max clients a mask WHO looks at per loop iteration
+
+#define LIST_SCAN_PER_TICK 1024 // max channels a LIST looks at per loop iteration
+
+#define PACED_BACKLOG (64 * 1024) // bytes in a client's send queue above which its paced output waits
+#define PACED_WAIT 10			  // milliseconds between two looks at send queues that were too full
+
+#define UPGRADE_ENV "IRCSERV_UPGRADE_FD" // set for a process started by a hot upgrade
+#define UPGRADE_VERSION 10
+#define UPGRADE_FDS_PER_MSG 200 // below the kernel's SCM_MAX_FD
+#define UPGRADE_TIMEOUT 10		// seconds to wait for the new process to take over
+
 enum rType
 {
 	ChannelToClients,
@@ -36,17 +63,46 @@ enum rType
 class Client;
 class Channel;
 class Message;
-class Server
+class Server : public PluginHost
 {
 private:
 	int port;
 	std::string name;
 	const std::string password;
-	int server_socket;
-	static bool signal;
+	std::vector<Listener> listeners; // the command line port first, then the links file's
+	TlsContext tls;
+	std::map<int, TlsHandshake> handshakes; // TLS connections not established yet
+	static volatile sig_atomic_t signal;
+	static volatile sig_atomic_t upgrade;
+	static volatile sig_atomic_t report;
+	std::string executable;
+	bool handed_over;
 	std::vector<Client *> clients;
-	std::vector<struct pollfd> fds;
-	std::map<std::string, Channel *> channels;
+	std::unordered_map<int, size_t> slots; // fd -> index in clients, remote users' negative fds included
+	std::vector<Client *> closing;		  // quit this tick, reclaimed at its end
+	ChannelRegistry channels; // by casefolded name, with stable ids
+	std::unordered_map<std::string, Client *> nicks; // exact nickname index
+	std::unordered_map<int, std::string> batched; // output held until the current batch ends
+	int batch_depth;
+	Snapshot snapshot;
+	std::string links_file;
+	std::vector<LinkBlock> link_blocks;
+	std::map<std::string, NetServer> network; // every other server of the network, by name
+	std::map<int, LinkConnect> connecting;	  // link sockets waiting for connect() to complete
+	time_t last_link_attempt;
+	int next_remote_fd; // users of linked servers get unique negative fds
+	Pipeline pipeline;	// socket reads and writes happen on I/O threads
+	Resolver resolver;	// reverse DNS for new connections, addresses of the links
+	Admission admission; // connection limits per source address
+	Capture capture;	 // inbound lines recorded for replay, if IRCSERV_CAPTURE is set
+	LoopStats loop_stats; // time spent waiting and processing, per command
+	unsigned long next_serial;
+	unsigned long fanout_epoch; // stamped on the clients a fan-out reached
+	long long msgid_epoch;		   // start of this server's msgids, kept across hot upgrades
+	unsigned long long next_msgid; // shared by every channel
+	long long clock;			// milliseconds since the epoch, read once per loop iteration
+	std::string clock_text;		// the clock as a server-time tag, formatted on first use
+	Plugins plugins;			// loaded from the links file
 	Client *findClient(std::string &nickname) const;
 
 public:
@@ -57,37 +113,112 @@ public:
 	Client *get_client(int fd);
 	Client *get_client(std::string nickname);
 	std::string get_name();
-	std::vector<std::string> get_clients_channel(std::string const &nickname);
+	Plugins &get_plugins();
+
+	// Plugin host
+	std::string const &server_name() const;
+	bool say(std::string const &service, std::string const &target, std::string const &text);
+	bool notice(std::string const &service, std::string const &nickname, std::string const &text);
+	std::vector<std::string> members(std::string const &channel) const;
 
 	// Methods
-	void create_server_socket();
+	void add_listener(Listener const &listener);
+	void open_listeners();
 	void server_init();
 	void close_fds();
-	void accept_new_client();
-	void receive_new_data(int fd);
+	void accept_new_client(Listener const &listener);
+	void add_client(int fd, std::string const &address, std::shared_ptr<TlsSession> const &tls);
+	void start_handshake(int fd, std::string const &address);
+	void advance_handshake(int fd);
+	void expire_handshakes();
+	void receive_new_data();
+	void watch(Client *client);
+	void lookup_host(Client *client);
+	void receive_resolutions();
+	void start_pipeline();
+	void stop_pipeline();
+	void disconnect(int fd);
+	void track(Client *client);
 	void remove_client(int fd);
+	void teardown();
+	void trim_history();
 	void remove_channel(Channel *channel);
+	void persist(Channel *channel);
 	static void handle_signal(int sig);
+	static void handle_upgrade_signal(int sig);
+	static void handle_report_signal(int sig);
+	static void block_signals(sigset_t &saved);
+	static void restore_signals(sigset_t const &saved);
+	void set_executable(std::string const &path);
+	bool hot_upgrade();
+	void restore_upgrade(int sock);
+	void drop_tls_clients(std::string const &reason);
 	void send_response(std::string response, int fd);
 	void send_response(rType responseType, std::string sender, std::string recipient, std::string response);
+	void transmit(int fd, std::string const &data);
+	void send_common(Client *user, std::string const &line, bool include_user);
+	void quit_channels(Client *user, std::string const &msg);
+	void begin_batch();
+	void end_batch();
 	std::vector<std::string> split_recived_buffer(std::string str);
+	std::vector<std::string> split_list(std::string const &list);
 	void exec_cmd(Message &newmsg, int fd);
+	void tick();
+	long long get_clock() const;
+	std::string const &get_timestamp();
+	unsigned long long new_msgid();
+	std::string format_msgid(unsigned long long msgid) const;
+	unsigned long long parse_msgid(std::string const &text) const;
+	bool flush_deferred(bool &held);
 	bool nickname_in_use(std::string &nickname);
+	void set_nickname(Client *client, std::string &nickname);
 	bool is_valid_nickname(std::string &nickname);
+	void welcome(Client *user);
 
 
 	// CMDS
+	void cap(Message &cmd, int fd);
 	void nick(std::string nickname, int fd);
 	void username(std::vector<std::string> username, int fd);
 	void join(Message &cmd, int fd);
+	void join_channel(Client *user, std::string const &name, std::string const &key);
+	void part(Message &cmd, int fd);
+	void names(Message &cmd, int fd);
+	void list(Message &cmd, int fd);
+	void who(Message &cmd, int fd);
+	void whois(Message &cmd, int fd);
+	std::string who_reply(Client *user, Client *target, Channel *channel);
 	void pass(std::string pass, int fd);
 	void quit(int fd);
+	void quit(int fd, std::string const &reason);
 	void quit(Message &cmd, int fd);
 	void privmsg(Message &cmd, int fd);
 	void mode(Message &cmd, int fd);
 	void invite(Message &cmd, int fd);
 	void topic(Message &cmd, int fd);
 	void kick(Message &cmd, int fd);
+	void chathistory(Message &cmd, int fd);
+
+	// Server links
+	void load_links(std::string const &path);
+	void set_links_file(std::string const &path);
+	LinkBlock const *find_link_block(std::string const &name) const;
+	void connect_links();
+	void open_link(LinkBlock &block, std::string const &address);
+	void finish_link(int fd);
+	void server_cmd(Message &msg, int fd);
+	void link_cmd(Message &msg, Client *link);
+	std::string introduction(Client *user);
+	void burst(Client *link);
+	void introduce(Client *user);
+	void send_links(std::string const &line, Client *except);
+	void propagate(Message &msg, std::string const &nick, Client *origin);
+	bool resolve_collision(Client *existing, time_t ts);
+	void remote_user(std::vector<std::string> const &params, Client *link);
+	void remove_remote(Client *user, std::string const &reason);
+	void remove_server(std::string const &name, std::string const &reason);
+	void split_link(Client *link);
+	void drop_links(std::string const &reason);
 };
 
 #endif
@@ -0,0 +1,75 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+#define SNAPSHOT_FILE "ircserv.snapshot"
+#define SNAPSHOT_MAGIC "IRCSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_INITIAL_SLOTS 1024
+
+#define SNAPSHOT_NAME_LEN 64
+#define SNAPSHOT_KEY_LEN 32
+#define SNAPSHOT_TOPIC_LEN 400
+
+struct SnapshotHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t slots; // number of records following the header
+	char reserved[48];
+};
+
+// One fixed-size record per channel, so a change rewrites its slot in place
+struct ChannelRecord
+{
+	uint8_t in_use;
+	uint8_t modes;
+	uint16_t reserved;
+	uint32_t limit;
+	char name[SNAPSHOT_NAME_LEN];
+	char key[SNAPSHOT_KEY_LEN];
+	char topic[SNAPSHOT_TOPIC_LEN];
+	char padding[8];
+};
+
+// Channel state persisted to a memory-mapped file. Every change is stored
+// straight into the mapping; on startup only the name index is built and
+// the channels themselves are recreated when they are first joined. Names
+// are matched under the same casemapping as the channel registry.
+class Snapshot
+{
+public:
+	Snapshot();
+	~Snapshot();
+
+	bool open(std::string const &path);
+	void close();
+	bool is_open() const;
+
+	ChannelRecord const *find(std::string const &name) const;
+	void store(std::string const &name, unsigned char modes, unsigned int limit, std::string const &key, std::string const &topic);
+	void erase(std::string const &name);
+	size_t size() const;
+
+private:
+	Snapshot(Snapshot const &);
+	Snapshot &operator=(Snapshot const &);
+
+	int fd;
+	char *map;
+	size_t map_size;
+	uint32_t slots;
+	std::unordered_map<std::string, uint32_t> index; // casefolded name -> slot, the record keeps the name as created
+	std::vector<uint32_t> free_slots;
+
+	bool map_file(uint32_t slots);
+	bool grow();
+	ChannelRecord *slot(uint32_t i) const;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <thread>
+
+// Bounded lock-free queue between exactly one producer thread and one consumer
+// thread. The capacity is rounded up to a power of two.
+template <typename T>
+class SpscQueue
+{
+public:
+	explicit SpscQueue(size_t capacity)
+		: head(0), tail(0)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size *= 2;
+		this->ring.resize(size);
+		this->mask = size - 1;
+	}
+
+	// Producer side, false if the queue is full
+	bool try_push(T &item)
+	{
+		size_t tail = this->tail.load(std::memory_order_relaxed);
+		if (tail - this->head.load(std::memory_order_acquire) > this->mask)
+			return (false);
+		this->ring[tail & this->mask] = std::move(item);
+		this->tail.store(tail + 1, std::memory_order_release);
+		return (true);
+	}
+
+	// Producer side, waits for the consumer to make room
+	void push(T &item)
+	{
+		while (!this->try_push(item))
+			std::this_thread::yield();
+	}
+
+	// Consumer side, false if the queue is empty
+	bool pop(T &item)
+	{
+		size_t head = this->head.load(std::memory_order_relaxed);
+		if (head == this->tail.load(std::memory_order_acquire))
+			return (false);
+		item = std::move(this->ring[head & this->mask]);
+		this->head.store(head + 1, std::memory_order_release);
+		return (true);
+	}
+
+private:
+	std::vector<T> ring;
+	size_t mask;
+	alignas(64) std::atomic<size_t> head; // next slot to pop, written by the consumer
+	alignas(64) std::atomic<size_t> tail; // next slot to push, written by the producer
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <string>
+#include <unordered_map>
+#include <cstddef>
+
+// A string kept once in a process-wide table and shared by everything that
+// holds it: every client on the same host shares one copy of the host, and
+// two symbols are equal when they point to the same entry, so comparing them
+// is comparing pointers. Entries are reference counted and dropped with their
+// last holder. Symbols are only used by the thread running the commands.
+class Symbol
+{
+public:
+	Symbol();
+	Symbol(std::string const &str);
+	Symbol(Symbol const &other);
+	Symbol &operator=(Symbol const &other);
+	~Symbol();
+
+	static Symbol find(std::string const &str); // the symbol if someone holds it, empty otherwise
+	static size_t table_size();
+
+	std::string const &str() const;
+	bool empty() const;
+	bool operator==(Symbol const &other) const;
+	bool operator!=(Symbol const &other) const;
+
+private:
+	typedef std::unordered_map<std::string, size_t> Table; // string -> holders
+	Table::value_type *entry; // NULL for the empty string
+
+	static Table &table();
+	void release();
+};
+
+#endif
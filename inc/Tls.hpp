@@ -0,0 +1,71 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <string>
+#include <mutex>
+#include <memory>
+#include <ctime>
+#include <sys/types.h>
+#include <openssl/ssl.h>
+
+#define TLS_HANDSHAKE_TIMEOUT 10 // seconds a connection may take to finish its handshake
+
+// The TLS state of one connection. The handshake runs in userspace, then the
+// record encryption is handed to the kernel (kTLS) if it can take it, so the
+// I/O threads keep sending and receiving with plain send()/recv() on the
+// socket. If it can't, they go through OpenSSL, one of them at a time.
+class TlsSession
+{
+public:
+	explicit TlsSession(SSL *ssl);
+	~TlsSession();
+	static std::shared_ptr<TlsSession> kernel_only(); // a session handed over by a hot upgrade
+
+	int handshake(); // 1 once established, 0 while in progress, -1 on failure
+	bool wants_write() const;
+	ssize_t receive(int fd, char *buff, size_t size);
+	ssize_t send(int fd, char const *data, size_t size);
+	bool has_buffered();
+	void shutdown();
+	bool is_kernel_send() const;
+	bool is_kernel_receive() const;
+	bool is_kernel() const;
+
+private:
+	TlsSession(TlsSession const &);
+	TlsSession &operator=(TlsSession const &);
+
+	SSL *ssl;
+	bool kernel_send;	 // the kernel encrypts what is sent
+	bool kernel_receive; // the kernel decrypts what is received
+	bool want_write;	 // the handshake is waiting for the socket to be writable
+	std::mutex lock;	 // OpenSSL calls on one session may not overlap
+};
+
+// A TLS connection accepted but not established yet, handled by the logic thread
+struct TlsHandshake
+{
+	std::shared_ptr<TlsSession> session;
+	std::string address;
+	time_t started;
+};
+
+// The server's certificate and key, shared by every TLS connection
+class TlsContext
+{
+public:
+	TlsContext();
+	~TlsContext();
+
+	void load(std::string const &certificate, std::string const &key);
+	bool is_loaded() const;
+	std::shared_ptr<TlsSession> accept(int fd) const;
+
+private:
+	TlsContext(TlsContext const &);
+	TlsContext &operator=(TlsContext const &);
+
+	SSL_CTX *ctx;
+};
+
+#endif
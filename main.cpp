@@ -1,5 +1,6 @@
 #include "Server.hpp"
 #include "Client.hpp"
+#include <climits>
 
 void welcome_message()
 {	
@@ -48,19 +49,26 @@ int arg_check(const std::string &port, const std::string &pass)
 
 int main(int argc, char **argv)
 {
-	if (argc != 3)
+	if (argc != 3 && argc != 4)
 	{
-		std::cerr << "Wrong args - ./ircserv port password" << std::endl;
+		std::cerr << "Wrong args - ./ircserv port password [links file]" << std::endl;
 		return (1);
 	}
 	welcome_message();
 	if (arg_check(argv[1], argv[2]))
 		return (1);
 	Server serv(std::stoi(argv[1]), argv[2]);
+	char executable[PATH_MAX];
+	serv.set_executable(realpath(argv[0], executable) ? executable : argv[0]);
+	if (argc == 4)
+		serv.set_links_file(realpath(argv[3], executable) ? executable : argv[3]);
 	try
 	{
 		std::signal(SIGINT, Server::handle_signal);
 		std::signal(SIGQUIT, Server::handle_signal);
+		std::signal(SIGUSR2, Server::handle_upgrade_signal); // hot upgrade to the binary at the same path
+		std::signal(SIGUSR1, Server::handle_report_signal);	 // memory use to stdout
+		std::signal(SIGPIPE, SIG_IGN);						 // OpenSSL writes to TLS sockets without MSG_NOSIGNAL
 		serv.server_init();
 	}
 	catch (std::exception &e)
@@ -0,0 +1,30 @@
+#include "Plugin.hpp"
+
+// The quote bot of bot.py, running inside the server: answers "!quote" in any channel
+class Quote : public Plugin
+{
+public:
+	std::string name() const
+	{
+		return ("quote");
+	}
+
+	void on_message(PluginHost &host, std::string const &channel, std::string const &, std::string const &text)
+	{
+		if (text.find("!quote") != std::string::npos)
+			host.say("Spoof", channel, "Insanity is doing the same thing over and over again and expecting different results.");
+	}
+
+	// Tells people who join how to use it
+	void on_join(PluginHost &host, std::string const &, std::string const &nickname)
+	{
+		host.notice("Spoof", nickname, "Type !quote to get a random quote.");
+	}
+};
+
+extern "C" Plugin *ircserv_plugin(int api_version)
+{
+	if (api_version != PLUGIN_API_VERSION)
+		return (NULL);
+	return (new Quote());
+}
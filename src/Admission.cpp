@@ -0,0 +1,206 @@
+#include "Admission.hpp"
+#include <algorithm>
+#include <sstream>
+#include <cmath>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define KEY_ADDRESS 0
+#define KEY_PREFIX 1
+
+Admission::Admission()
+	: cells(ADMISSION_DEPTH * ADMISSION_WIDTH, Cell{0, 0}), last_decay(std::time(NULL)), refused(0)
+{
+	this->limits = AdmissionLimits{ADMISSION_ADDRESS_OPEN, ADMISSION_PREFIX_OPEN, ADMISSION_ADDRESS_RATE, ADMISSION_PREFIX_RATE};
+}
+
+void Admission::set_limits(AdmissionLimits const &limits)
+{
+	this->limits = limits;
+}
+
+AdmissionLimits const &Admission::get_limits() const
+{
+	return (this->limits);
+}
+
+// Deciding on a new connection, it counts as open from here on if admitted.
+// Refused connects count towards the rate too, so a flood stays refused until it stops.
+std::string Admission::admit(std::string const &address, time_t now)
+{
+	unsigned char key[ADMISSION_KEY_SIZE];
+	if (!parse(address, key))
+		return ("");
+	this->decay(now);
+	size_t slots[ADMISSION_DEPTH];
+	this->locate(key, slots);
+	bool v4 = IN6_IS_ADDR_V4MAPPED((struct in6_addr const *)(key + 1));
+	unsigned char prefix[ADMISSION_KEY_SIZE] = {KEY_PREFIX};
+	memcpy(prefix + 1, key + 1, 8);
+	size_t prefix_slots[ADMISSION_DEPTH];
+	this->locate(prefix, prefix_slots);
+	std::string reason;
+	std::string source = address;
+	if (this->limits.address_open && this->open_count(slots) >= this->limits.address_open)
+		reason = "Too many connections from your address";
+	else if (this->limits.address_rate && this->recent_count(slots) >= this->limits.address_rate)
+		reason = "Connecting too fast";
+	else if (!v4 && this->limits.prefix_open && this->open_count(prefix_slots) >= this->limits.prefix_open)
+		reason = "Too many connections from your network";
+	else if (!v4 && this->limits.prefix_rate && this->recent_count(prefix_slots) >= this->limits.prefix_rate)
+		reason = "Your network is connecting too fast";
+	if (!reason.empty() && reason.find("network") != std::string::npos)
+		source = prefix_text(prefix);
+	int open = reason.empty() ? 1 : 0;
+	this->add(slots, open, 1);
+	if (!v4) // an IPv4 address is one host already, its neighbours aren't grouped
+		this->add(prefix_slots, open, 1);
+	if (!reason.empty())
+		this->refuse(source, reason);
+	return (reason);
+}
+
+void Admission::opened(std::string const &address)
+{
+	unsigned char key[ADMISSION_KEY_SIZE];
+	if (!parse(address, key))
+		return;
+	size_t slots[ADMISSION_DEPTH];
+	this->locate(key, slots);
+	this->add(slots, 1, 0);
+	if (IN6_IS_ADDR_V4MAPPED((struct in6_addr const *)(key + 1)))
+		return;
+	key[0] = KEY_PREFIX;
+	memset(key + 9, 0, 8);
+	this->locate(key, slots);
+	this->add(slots, 1, 0);
+}
+
+void Admission::closed(std::string const &address)
+{
+	unsigned char key[ADMISSION_KEY_SIZE];
+	if (!parse(address, key))
+		return;
+	size_t slots[ADMISSION_DEPTH];
+	this->locate(key, slots);
+	this->add(slots, -1, 0);
+	if (IN6_IS_ADDR_V4MAPPED((struct in6_addr const *)(key + 1)))
+		return;
+	key[0] = KEY_PREFIX;
+	memset(key + 9, 0, 8);
+	this->locate(key, slots);
+	this->add(slots, -1, 0);
+}
+
+std::string Admission::report() const
+{
+	std::ostringstream out;
+	out << "  refused connections: " << this->refused << std::endl;
+	std::vector<Offender> sorted = this->offenders;
+	std::sort(sorted.begin(), sorted.end(), [](Offender const &a, Offender const &b)
+			  { return (a.refused > b.refused); });
+	for (auto &offender : sorted)
+		out << "    " << offender.source << ": " << offender.refused << " (" << offender.reason << ")" << std::endl;
+	return (out.str());
+}
+
+// The key of an address, IPv4 as mapped IPv6. False for addresses that aren't limited.
+bool Admission::parse(std::string const &address, unsigned char key[ADMISSION_KEY_SIZE])
+{
+	struct in_addr v4;
+	struct in6_addr v6;
+	memset(key, 0, ADMISSION_KEY_SIZE);
+	key[0] = KEY_ADDRESS;
+	if (inet_pton(AF_INET, address.c_str(), &v4) == 1)
+	{
+		if ((ntohl(v4.s_addr) >> 24) == 127)
+			return (false);
+		key[11] = 0xff;
+		key[12] = 0xff;
+		memcpy(key + 13, &v4, 4);
+		return (true);
+	}
+	if (inet_pton(AF_INET6, address.c_str(), &v6) != 1 || IN6_IS_ADDR_LOOPBACK(&v6))
+		return (false);
+	memcpy(key + 1, &v6, 16);
+	return (true);
+}
+
+std::string Admission::prefix_text(unsigned char const key[ADMISSION_KEY_SIZE])
+{
+	char text[INET6_ADDRSTRLEN];
+	inet_ntop(AF_INET6, key + 1, text, sizeof(text));
+	return (std::string(text) + "/64");
+}
+
+// One counter per row, the row hashes derived from a single FNV-1a hash
+void Admission::locate(unsigned char const key[ADMISSION_KEY_SIZE], size_t slots[ADMISSION_DEPTH]) const
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < ADMISSION_KEY_SIZE; i++)
+		hash = (hash ^ key[i]) * 1099511628211ULL;
+	uint64_t step = (hash >> 29) * 0x9e3779b97f4a7c15ULL | 1;
+	for (size_t row = 0; row < ADMISSION_DEPTH; row++)
+		slots[row] = row * ADMISSION_WIDTH + ((hash + row * step) & (ADMISSION_WIDTH - 1));
+}
+
+uint32_t Admission::open_count(size_t const slots[ADMISSION_DEPTH]) const
+{
+	uint32_t count = this->cells[slots[0]].open;
+	for (size_t row = 1; row < ADMISSION_DEPTH; row++)
+		count = std::min(count, this->cells[slots[row]].open);
+	return (count);
+}
+
+float Admission::recent_count(size_t const slots[ADMISSION_DEPTH]) const
+{
+	float count = this->cells[slots[0]].recent;
+	for (size_t row = 1; row < ADMISSION_DEPTH; row++)
+		count = std::min(count, this->cells[slots[row]].recent);
+	return (count);
+}
+
+void Admission::add(size_t const slots[ADMISSION_DEPTH], int open, float recent)
+{
+	for (size_t row = 0; row < ADMISSION_DEPTH; row++)
+	{
+		Cell &cell = this->cells[slots[row]];
+		if (open >= 0 || cell.open > 0)
+			cell.open += open;
+		cell.recent += recent;
+	}
+}
+
+// Scaling every connect count down by the time passed, in steps so it stays cheap
+void Admission::decay(time_t now)
+{
+	if (now - this->last_decay < ADMISSION_DECAY_STEP)
+		return;
+	float factor = std::exp2(-(double)(now - this->last_decay) / ADMISSION_HALF_LIFE);
+	for (auto &cell : this->cells)
+		cell.recent *= factor;
+	this->last_decay = now;
+}
+
+// Keeping the most refused sources in a fixed list: a new source takes the
+// place of the least refused one and inherits its count (space-saving).
+void Admission::refuse(std::string const &source, std::string const &reason)
+{
+	this->refused++;
+	for (auto &offender : this->offenders)
+		if (offender.source == source)
+		{
+			offender.refused++;
+			offender.reason = reason;
+			return;
+		}
+	if (this->offenders.size() < ADMISSION_OFFENDERS)
+	{
+		this->offenders.push_back(Offender{source, 1, reason});
+		return;
+	}
+	auto least = std::min_element(this->offenders.begin(), this->offenders.end(), [](Offender const &a, Offender const &b)
+								  { return (a.refused < b.refused); });
+	*least = Offender{source, least->refused + 1, reason};
+}
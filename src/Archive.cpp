@@ -0,0 +1,77 @@
+#include "Archive.hpp"
+#include <cstring>
+#include <stdexcept>
+
+void Archive::put_u8(uint8_t value)
+{
+	this->buffer.push_back(static_cast<char>(value));
+}
+
+void Archive::put_u32(uint32_t value)
+{
+	this->buffer.append(reinterpret_cast<char const *>(&value), sizeof(value));
+}
+
+void Archive::put_u64(uint64_t value)
+{
+	this->buffer.append(reinterpret_cast<char const *>(&value), sizeof(value));
+}
+
+void Archive::put_str(std::string const &value)
+{
+	this->put_u32(value.size());
+	this->buffer.append(value);
+}
+
+std::string const &Archive::data() const
+{
+	return (this->buffer);
+}
+
+Reader::Reader(std::string const &data) : buffer(data), pos(0)
+{
+}
+
+void Reader::need(size_t n)
+{
+	if (this->buffer.size() - this->pos < n)
+		throw(std::runtime_error("truncated state archive"));
+}
+
+uint8_t Reader::get_u8()
+{
+	this->need(1);
+	return (static_cast<uint8_t>(this->buffer[this->pos++]));
+}
+
+uint32_t Reader::get_u32()
+{
+	uint32_t value;
+	this->need(sizeof(value));
+	memcpy(&value, this->buffer.data() + this->pos, sizeof(value));
+	this->pos += sizeof(value);
+	return (value);
+}
+
+uint64_t Reader::get_u64()
+{
+	uint64_t value;
+	this->need(sizeof(value));
+	memcpy(&value, this->buffer.data() + this->pos, sizeof(value));
+	this->pos += sizeof(value);
+	return (value);
+}
+
+bool Reader::at_end() const
+{
+	return (this->pos == this->buffer.size());
+}
+
+std::string Reader::get_str()
+{
+	uint32_t len = this->get_u32();
+	this->need(len);
+	std::string value = this->buffer.substr(this->pos, len);
+	this->pos += len;
+	return (value);
+}
@@ -0,0 +1,64 @@
+#include "Capabilities.hpp"
+
+static struct
+{
+	char const *name;
+	unsigned char bit;
+} const capabilities[] = {
+	{"server-time", CAP_SERVER_TIME},
+	{"message-tags", CAP_MESSAGE_TAGS},
+	{"account-tag", CAP_ACCOUNT_TAG},
+	{"echo-message", CAP_ECHO_MESSAGE},
+};
+
+// The bit of a capability we offer, 0 if we don't know it
+unsigned char capability_bit(std::string const &name)
+{
+	for (auto &cap : capabilities)
+		if (name == cap.name)
+			return (cap.bit);
+	return (0);
+}
+
+// The names of the capabilities in caps, space separated
+std::string capability_names(unsigned char caps)
+{
+	std::string names;
+	for (auto &cap : capabilities)
+		if (caps & cap.bit)
+			names += (names.empty() ? "" : " ") + std::string(cap.name);
+	return (names);
+}
+
+Variants::Variants(std::string const &line, std::string const &time, std::string const &msgid, std::string const &account)
+	: line(line), time(time), msgid(msgid), account(account)
+{
+}
+
+// The line as a client with these capabilities gets it
+std::string const &Variants::get(unsigned char caps)
+{
+	unsigned char cls = caps & CAP_RENDERED;
+	if (cls == 0)
+		return (this->line);
+	std::string &variant = this->rendered[cls];
+	if (!variant.empty())
+		return (variant);
+	std::string tags;
+	if ((cls & CAP_SERVER_TIME) && !this->time.empty())
+		tags += ";time=" + this->time;
+	if ((cls & CAP_MESSAGE_TAGS) && !this->msgid.empty())
+		tags += ";msgid=" + this->msgid;
+	if ((cls & CAP_ACCOUNT_TAG) && !this->account.empty())
+		tags += ";account=" + this->account;
+	if (tags.empty())
+		variant = this->line;
+	else
+		variant = "@" + tags.substr(1) + " " + this->line;
+	return (variant);
+}
+
+std::string const &Variants::get_line() const
+{
+	return (this->line);
+}
@@ -0,0 +1,75 @@
+#include "Capture.hpp"
+#include <stdexcept>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+Capture::Capture() : fd(-1), last(0)
+{
+}
+
+Capture::~Capture()
+{
+	this->flush();
+	if (this->fd != -1)
+		::close(this->fd);
+}
+
+void Capture::open(std::string const &path)
+{
+	this->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (this->fd == -1)
+		throw(std::runtime_error("failed to open the capture file " + path));
+	struct stat info;
+	if (fstat(this->fd, &info) == 0 && info.st_size == 0)
+	{
+		this->pending.put_str(CAPTURE_MAGIC);
+		this->pending.put_u32(CAPTURE_VERSION);
+	}
+	std::cout << "Capturing the inbound traffic to " << path << std::endl;
+}
+
+bool Capture::is_open() const
+{
+	return (this->fd != -1);
+}
+
+void Capture::line(unsigned long connection, std::string const &line, long long now)
+{
+	if (this->opened.insert(connection).second)
+		this->record(CAPTURE_OPEN, connection, now);
+	this->record(CAPTURE_LINE, connection, now);
+	this->pending.put_str(line);
+	if (this->pending.data().size() >= CAPTURE_FLUSH_SIZE)
+		this->flush();
+}
+
+void Capture::close(unsigned long connection, long long now)
+{
+	if (this->opened.erase(connection))
+		this->record(CAPTURE_CLOSE, connection, now);
+}
+
+// Writing the buffered records, a capture that can't be written is given up
+void Capture::flush()
+{
+	std::string const &data = this->pending.data();
+	if (this->fd == -1 || data.empty())
+		return;
+	if (write(this->fd, data.data(), data.size()) != (ssize_t)data.size())
+	{
+		std::cerr << "Capture: write failed, capture stopped" << std::endl;
+		::close(this->fd);
+		this->fd = -1;
+	}
+	this->pending = Archive();
+}
+
+void Capture::record(CaptureRecord kind, unsigned long connection, long long now)
+{
+	this->pending.put_u8(kind);
+	this->pending.put_u32(connection);
+	this->pending.put_u32(this->last ? now - this->last : 0);
+	this->last = now;
+}
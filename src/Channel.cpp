@@ -1,42 +1,75 @@
 #include "Channel.hpp"
 #include "Server.hpp"
 
-Channel::Channel(std::string const &name, Client *client, Server &server) : name(name), server(server), topic_str(""), modes(0), limit(0)
+Channel::Channel(std::string const &name, Client *client, Server &server) : name(name), id(NO_CHANNEL), server(server), topic_str(""), topic_time(0), modes(0), limit(0), names_empty_chunks(0), accounted(0)
 {
 	add_client(client);
 	add_op(client);
 }
 
+// Recreating a channel from its snapshot record, it has no members until someone joins.
+// Its operators and invites are gone: the key stands in for an invite, and without
+// one +i is dropped, as nobody would be left to invite anyone.
+Channel::Channel(std::string const &name, ChannelRecord const &record, Server &server)
+	: name(name), id(NO_CHANNEL), server(server), key(std::string(record.key, strnlen(record.key, SNAPSHOT_KEY_LEN))),
+	  topic_str(std::string(record.topic, strnlen(record.topic, SNAPSHOT_TOPIC_LEN))), topic_time(0), modes(record.modes), limit(record.limit), names_empty_chunks(0), accounted(0)
+{
+	if ((this->modes & MODE_I) && this->key.empty())
+		this->modes &= ~MODE_I;
+	account();
+}
+
+Channel::Channel(std::string const &name, Server &server) : name(name), id(NO_CHANNEL), server(server), topic_str(""), topic_time(0), modes(0), limit(0), names_empty_chunks(0), accounted(0)
+{
+	account();
+}
+
+Channel::~Channel()
+{
+	Memory::add(MEM_CHANNELS, -(long long)this->accounted);
+}
+
 void Channel::join(Client *client, std::string const &key)
 {
-	if (!invite_check(client))
+	bool first = this->clients.empty(); // only a restored channel can be joined while empty
+	if (!first && !invite_check(client)) // a restored channel is only joined with its key
 	{
 		std::cerr << "Client could not join channel: invite only" << std::endl;
-		server.send_response(ERR_INVITEONLYCHAN(server.get_name(), client->get_nickname(), this->name), client->get_fd());
+		server.send_response(ERR_INVITEONLYCHAN(server.get_name(), client->get_nickname(), this->name.str()), client->get_fd());
+		return;
+	}
+	if (is_banned(client) && get_invite(client) == NULL)
+	{
+		std::cerr << "Client could not join channel: banned" << std::endl;
+		server.send_response(ERR_BANNEDFROMCHAN(server.get_name(), client->get_nickname(), this->name.str()), client->get_fd());
 		return;
 	}
 	if (!key_check(key))
 	{
 		std::cerr << "Client could not join channel: wrong key" << std::endl;
-		server.send_response(ERR_BADCHANNELKEY(this->name), client->get_fd());
+		server.send_response(ERR_BADCHANNELKEY(this->name.str()), client->get_fd());
 		return;
 	}
 	if (!limit_check())
 	{
 		std::cerr << "Client could not join channel: channel is full" << std::endl;
-		server.send_response(ERR_CHANNELISFULL(this->name), client->get_fd());
+		server.send_response(ERR_CHANNELISFULL(this->name.str()), client->get_fd());
 		return;
 	}
 	if (get_client(client->get_nickname()) != NULL)
 	{
 		std::cerr << "Client could not join channel: client already in channel" << std::endl;
-		server.send_response(ERR_USERONCHANNEL(server.get_name(), client->get_nickname(), this->name), client->get_fd());
+		server.send_response(ERR_USERONCHANNEL(server.get_name(), client->get_nickname(), this->name.str()), client->get_fd());
 		return;
 	}
 	add_client(client);
+	if (first) // its operators left with the restart, the first one to pass the key check takes over
+		add_op(client);
 	client->add_channel(this);
-	broadcast(CLIENT(client->get_nickname(), client->get_username(), client->get_IPaddr()) + " JOIN " + this->name + CRLF);
+	broadcast(CLIENT(client->get_nickname(), client->get_username(), client->get_host()) + " JOIN " + this->name.str() + CRLF);
 	this->topic(client);
+	this->names(client);
+	server.get_plugins().join(this->name.str(), client->get_nickname());
 }
 
 void Channel::invite(Client *commander, std::string const &nickname)
@@ -44,7 +77,7 @@ void Channel::invite(Client *commander, std::string const &nickname)
 	if (!get_op(commander))
 	{
 		std::cerr << "Client could not invite: not an op" << std::endl;
-		server.send_response(ERR_CHANOPRIVSNEEDED(this->name), commander->get_fd());
+		server.send_response(ERR_CHANOPRIVSNEEDED(this->name.str()), commander->get_fd());
 		return;
 	}
 	Client *client = server.get_client(nickname);
@@ -57,105 +90,230 @@ void Channel::invite(Client *commander, std::string const &nickname)
 	if (get_invite(nickname) != NULL)
 	{
 		std::cerr << "Client could not invite: client already invited" << std::endl;
-		server.send_response(ERR_USERONCHANNEL(server.get_name(), nickname, this->name), commander->get_fd());
+		server.send_response(ERR_USERONCHANNEL(server.get_name(), nickname, this->name.str()), commander->get_fd());
 		return;
 	}
 	add_invite(client);
-	server.send_response(RPL_INVITING(commander->get_nickname(), client->get_nickname(), this->name), commander->get_fd());
-	server.send_response(RPL_INVITED(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_IPaddr()), client->get_nickname(), this->name), client->get_fd());
+	server.send_response(RPL_INVITING(commander->get_nickname(), client->get_nickname(), this->name.str()), commander->get_fd());
+	server.send_response(RPL_INVITED(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_host()), client->get_nickname(), this->name.str()), client->get_fd());
 }
 
 void Channel::kick(Client *commander, std::string const &nickname)
 {
 	if (!get_op(commander))
 	{
-		server.send_response(ERR_CHANOPRIVSNEEDED(this->name), commander->get_fd());
+		server.send_response(ERR_CHANOPRIVSNEEDED(this->name.str()), commander->get_fd());
 		return;
 	}
-	if (get_client(nickname) == NULL)
+	Client *kicked = get_client(nickname);
+	if (kicked == NULL)
 	{
 		server.send_response(ERR_NOSUCHNICK(nickname), commander->get_fd());
 		return;
 	}
-	remove_client(nickname);
-	broadcast(RPL_KICK(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_IPaddr()), this->name, nickname, ""));
-	server.send_response(RPL_KICK(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_IPaddr()), this->name, nickname, ""), server.get_client(nickname)->get_fd());
+	remove_client(kicked);
+	kicked->remove_channel(this);
+	broadcast(RPL_KICK(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_host()), this->name.str(), nickname, ""));
+	server.send_response(RPL_KICK(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_host()), this->name.str(), nickname, ""), kicked->get_fd());
+	server.get_plugins().kick(this->name.str(), commander->get_nickname(), kicked->get_nickname(), "");
+	if (is_empty())
+		server.remove_channel(this);
 }
 
 void Channel::kick(Client *commander, std::string const &nickname, std::string const &msg)
 {
 	if (!get_op(commander))
 	{
-		server.send_response(ERR_CHANOPRIVSNEEDED(this->name), commander->get_fd());
+		server.send_response(ERR_CHANOPRIVSNEEDED(this->name.str()), commander->get_fd());
 		return;
 	}
-	if (get_client(nickname) == NULL)
+	Client *kicked = get_client(nickname);
+	if (kicked == NULL)
 	{
 		server.send_response(ERR_NOSUCHNICK(nickname), commander->get_fd());
 		return;
 	}
-	remove_client(nickname);
-	broadcast(RPL_KICK(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_IPaddr()), this->name, nickname, msg));
-	server.send_response(RPL_KICK(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_IPaddr()), this->name, nickname, msg), server.get_client(nickname)->get_fd());
+	remove_client(kicked);
+	kicked->remove_channel(this);
+	broadcast(RPL_KICK(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_host()), this->name.str(), nickname, msg));
+	server.send_response(RPL_KICK(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_host()), this->name.str(), nickname, msg), kicked->get_fd());
+	server.get_plugins().kick(this->name.str(), commander->get_nickname(), kicked->get_nickname(), msg[0] == ':' ? msg.substr(1) : msg);
+	if (is_empty())
+		server.remove_channel(this);
 }
 
-void Channel::mode(Client *commander, int action, char const &mode)
+// Applying the changes of one MODE command together: one permission check, one snapshot
+// update and MODE lines carrying every change that took effect, at most MODES_PER_LINE
+// parameters each. Changes that would do nothing are left out of them.
+void Channel::mode(Client *commander, std::vector<ModeChange> const &changes)
 {
+	if (changes.empty())
+		return;
 	if (!get_op(commander))
 	{
-		server.send_response(ERR_CHANOPRIVSNEEDED(this->name), commander->get_fd());
+		server.send_response(ERR_CHANOPRIVSNEEDED(this->name.str()), commander->get_fd());
 		return;
 	}
-	if (action == ADD)
-		add_mode(mode);
-	else if (action == REMOVE)
-		remove_mode(mode);
+	std::string source = CLIENT(commander->get_nickname(), commander->get_username(), commander->get_host());
+	std::string letters, params;
+	int sign = -1; // the last sign written to letters
+	size_t count = 0;
+	bool persisted = false;
+	bool listed = false;
+	for (auto &change : changes)
+	{
+		bool applied = false;
+		std::string shown = change.param;
+		switch (change.spec->kind)
+		{
+		case MODE_LIST:
+			applied = change_list(commander, change.adding, change.spec->letter, change.param);
+			break;
+		case MODE_MEMBER:
+			applied = change_member(commander, change.adding, change.param);
+			break;
+		case MODE_ALWAYS: // k
+			applied = change.adding ? this->key != change.param : !this->key.empty();
+			set_key(change.adding ? change.param : NO_KEY);
+			shown = change.adding ? change.param : "*";
+			break;
+		case MODE_SET: // l
+			applied = change.adding ? this->limit != std::stoul(change.param) : this->limit != 0;
+			set_limit(change.adding ? std::stoul(change.param) : 0);
+			break;
+		case MODE_FLAG:
+			applied = ((this->modes & change.spec->flag) != 0) != change.adding;
+			this->modes = change.adding ? this->modes | change.spec->flag : this->modes & ~change.spec->flag;
+			break;
+		}
+		if (!applied)
+			continue;
+		persisted |= change.spec->flag != 0;
+		listed |= change.spec->kind == MODE_LIST;
+		bool param = takes_param(*change.spec, change.adding);
+		if ((param && count == MODES_PER_LINE) || letters.size() + params.size() + shown.size() + 3 > MODE_LINE_MAX)
+		{
+			broadcast(RPL_MODE(source, this->name.str(), letters + params));
+			letters.clear();
+			params.clear();
+			sign = -1;
+			count = 0;
+		}
+		if (sign != change.adding)
+			letters += change.adding ? '+' : '-';
+		sign = change.adding;
+		letters += change.spec->letter;
+		if (param)
+		{
+			params += " " + shown;
+			count++;
+		}
+	}
+	if (!letters.empty())
+		broadcast(RPL_MODE(source, this->name.str(), letters + params));
+	if (persisted)
+		server.persist(this);
+	if (listed)
+	{
+		this->ban_cache.clear();
+		account();
+	}
 }
 
-void Channel::op(Client *commander, int action, std::string const &nickname)
+// The channel's modes, the key only for its members
+void Channel::show_modes(Client *client)
 {
-	if (!get_op(commander))
+	std::string letters = "+", params;
+	for (ModeSpec const &spec : MODE_TABLE)
+		if (spec.flag && (this->modes & spec.flag))
+			letters += spec.letter;
+	if (this->modes & MODE_K)
+		params += " " + (get_client(client) ? this->key : "*");
+	if (this->modes & MODE_L)
+		params += " " + std::to_string(this->limit);
+	server.send_response(RPL_CHANNELMODEIS(server.get_name(), client->get_nickname(), this->name.str(), letters + params), client->get_fd());
+}
+
+// +o/-o on a member, true if it changed anything
+bool Channel::change_member(Client *commander, bool adding, std::string const &nickname)
+{
+	Client *client = server.get_client(nickname);
+	if (client == NULL)
 	{
-		server.send_response(ERR_CHANOPRIVSNEEDED(this->name), commander->get_fd());
-		return;
+		server.send_response(ERR_NOSUCHNICK(nickname), commander->get_fd());
+		return (false);
 	}
-	if (action == ADD)
+	if (get_client(client) == NULL)
 	{
-		if (get_op(nickname) == NULL)
-		{
-			Client *client = server.get_client(nickname);
-			if (client == NULL)
-			{
-				server.send_response(ERR_NOSUCHNICK(nickname), commander->get_fd());
-				return;
-			}
-			add_op(client);
-			broadcast(RPL_YOUREOPER(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_IPaddr()), this->name, nickname));
-		}
+		server.send_response(ERR_USERNOTINCHANNEL(server.get_name(), commander->get_nickname(), nickname, this->name.str()), commander->get_fd());
+		return (false);
 	}
-	else if (action == REMOVE)
+	if ((get_op(client) != NULL) == adding)
+		return (false);
+	if (adding)
+		add_op(client);
+	else
+		remove_op(client);
+	return (true);
+}
+
+// Adding or removing a +b/+e/+I mask, true if the list changed
+bool Channel::change_list(Client *commander, bool adding, char const &mode, std::string const &mask)
+{
+	MaskList *list = get_list(mode);
+	if (list == NULL)
+		return (false);
+	bool changed;
+	if (adding)
 	{
-		if (server.get_client(nickname) == NULL)
+		if (list->size() >= MASKLIST_MAX)
 		{
-			server.send_response(ERR_NOSUCHNICK(nickname), commander->get_fd());
-			return;
+			server.send_response(ERR_MASKLISTFULL(commander->get_nickname(), this->name.str(), mask), commander->get_fd());
+			return (false);
 		}
-		remove_op(nickname);
-		broadcast(RPL_YOURENOTOPER(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_IPaddr()), this->name, nickname));
+		changed = list->add(mask, commander->get_nickname());
 	}
+	else
+		changed = list->remove(mask);
+	return (changed);
+}
+
+// Sending the entries of a +b/+e/+I list
+void Channel::show_list(Client *commander, char const &mode)
+{
+	MaskList *list = get_list(mode);
+	if (list == NULL)
+		return;
+	std::string nick = commander->get_nickname();
+	for (auto entry : list->entries())
+	{
+		std::string time = std::to_string(entry->time);
+		if (mode == 'b')
+			server.send_response(RPL_BANLIST(nick, this->name.str(), entry->mask.get_mask(), entry->setter, time), commander->get_fd());
+		else if (mode == 'e')
+			server.send_response(RPL_EXCEPTLIST(nick, this->name.str(), entry->mask.get_mask(), entry->setter, time), commander->get_fd());
+		else
+			server.send_response(RPL_INVITELIST(nick, this->name.str(), entry->mask.get_mask(), entry->setter, time), commander->get_fd());
+	}
+	if (mode == 'b')
+		server.send_response(RPL_ENDOFBANLIST(nick, this->name.str()), commander->get_fd());
+	else if (mode == 'e')
+		server.send_response(RPL_ENDOFEXCEPTLIST(nick, this->name.str()), commander->get_fd());
+	else
+		server.send_response(RPL_ENDOFINVITELIST(nick, this->name.str()), commander->get_fd());
 }
 
 void Channel::topic(Client *commander)
 {
 	if (this->get_client(commander) == NULL)
 	{
-		server.send_response(ERR_NOTONCHANNEL(this->name), commander->get_fd());
+		server.send_response(ERR_NOTONCHANNEL(this->name.str()), commander->get_fd());
 		return;
 	}
 	if (this->get_topic().empty())
-		server.send_response(RPL_NOTOPIC(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_IPaddr()), this->get_channel_name()), commander->get_fd());
+		server.send_response(RPL_NOTOPIC(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_host()), this->get_channel_name()), commander->get_fd());
 	else
-		server.send_response(RPL_TOPIC(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_IPaddr()), this->get_channel_name(), this->get_topic()), commander->get_fd());
+		server.send_response(RPL_TOPIC(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_host()), this->get_channel_name(), this->get_topic()), commander->get_fd());
 }
 
 void Channel::topic(Client *commander, int action, std::string const &topic)
@@ -164,65 +322,135 @@ void Channel::topic(Client *commander, int action, std::string const &topic)
 	{
 		if (get_client(commander) == NULL)
 		{
-			server.send_response(ERR_NOTONCHANNEL(this->name), commander->get_fd());
+			server.send_response(ERR_NOTONCHANNEL(this->name.str()), commander->get_fd());
 			return;
 		}
 		if (!get_op(commander))
 		{
 			std::cerr << "Client could not set topic: not an op" << std::endl;
-			server.send_response(ERR_CHANOPRIVSNEEDED(this->name), commander->get_fd());
+			server.send_response(ERR_CHANOPRIVSNEEDED(this->name.str()), commander->get_fd());
 			return;
 		}
 		set_topic(topic);
-		this->broadcast(RPL_TOPIC(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_IPaddr()), this->name, this->get_topic()));
+		this->broadcast(RPL_TOPIC(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_host()), this->name.str(), this->get_topic()));
 	}
 	else if (action == REMOVE)
 	{
 		if (!get_op(commander))
 		{
 			std::cerr << "Client could not remove topic: not an op" << std::endl;
-			server.send_response(ERR_CHANOPRIVSNEEDED(this->name), commander->get_fd());
+			server.send_response(ERR_CHANOPRIVSNEEDED(this->name.str()), commander->get_fd());
 			return;
 		}
 		set_topic("");
-		this->broadcast(RPL_NOTOPIC(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_IPaddr()), this->name));
+		this->broadcast(RPL_NOTOPIC(CLIENT(commander->get_nickname(), commander->get_username(), commander->get_host()), this->name.str()));
 	}
 }
 
+// A member quit, the QUIT line was already sent by Server::quit_channels
 void Channel::quit(Client *client)
 {
-	std::cout << "Channel quit!" << std::endl;
-	if (is_client_in_channel(client->get_nickname()) == false)
-	{
-		server.send_response(ERR_NOTONCHANNEL(this->name), client->get_fd());
+	if (get_client(client) == nullptr)
 		return;
-	}
-	broadcast(client, RPL_QUIT(CLIENT(client->get_nickname(), client->get_username(), client->get_IPaddr()), ""));
 	remove_client(client);
 	if (is_empty())
 		server.remove_channel(this);
 }
-void Channel::quit(Client *client, std::string const &msg)
+
+void Channel::part(Client *client, std::string const &msg)
 {
-	std::cout << "Channel quit! msg" << std::endl;
-	if (is_client_in_channel(client->get_nickname()) == false)
+	if (get_client(client) == nullptr)
 	{
-		server.send_response(ERR_NOTONCHANNEL(this->name), client->get_fd());
+		server.send_response(ERR_NOTONCHANNEL(this->name.str()), client->get_fd());
 		return;
 	}
-	broadcast(client, RPL_QUIT(CLIENT(client->get_nickname(), client->get_username(), client->get_IPaddr()), msg));
+	broadcast(RPL_PART(CLIENT(client->get_nickname(), client->get_username(), client->get_host()), this->name.str(), msg));
 	remove_client(client);
+	client->remove_channel(this);
+	server.get_plugins().part(this->name.str(), client->get_nickname(), msg[0] == ':' ? msg.substr(1) : msg);
 	if (is_empty())
 		server.remove_channel(this);
 }
 
+// Modes of a channel first heard of from a linked server
+void Channel::sync_modes(unsigned char modes, unsigned int limit, std::string const &key)
+{
+	this->modes = modes;
+	this->limit = limit;
+	this->key = key;
+}
+
+// A member announced by a linked server, already accepted there so no checks apply
+void Channel::sync_join(Client *client, bool op)
+{
+	if (get_client(client) != NULL)
+		return;
+	add_client(client);
+	if (op)
+		add_op(client);
+	client->add_channel(this);
+	broadcast(CLIENT(client->get_nickname(), client->get_username(), client->get_host()) + " JOIN " + this->name.str() + CRLF);
+	server.get_plugins().join(this->name.str(), client->get_nickname());
+}
+
+// Sending the member list from the cached chunks
+void Channel::names(Client *client)
+{
+	for (auto &chunk : this->names_chunks)
+		if (!chunk.empty())
+			server.send_response(RPL_NAMREPLY(client->get_nickname(), this->name.str(), chunk), client->get_fd());
+	server.send_response(RPL_ENDOFNAMES(client->get_nickname(), this->name.str()), client->get_fd());
+}
+
+// Updating the cached names after the client changed nickname
+void Channel::rename(Client *client)
+{
+	names_refresh(client);
+	this->ban_cache.erase(client);
+	is_banned(client); // the new nick may match different masks
+}
+
+// Following a member's capability change in the fan-out arrays
+void Channel::recap(Client *client)
+{
+	size_t slot = this->slot_of(client);
+	if (slot != NO_SLOT)
+		this->fanout_caps[slot] = client->get_caps();
+}
+
 void Channel::message(Client *sender, std::string const &message)
+{
+	this->message(sender, CLIENT(sender->get_nickname(), sender->get_username(), sender->get_host()), message);
+}
+
+// Sending a message with an already formatted source, for senders hitting several targets
+void Channel::message(Client *sender, std::string const &source, std::string const &message)
 {
 	if (get_client(sender) == nullptr)
 	{
-		server.send_response(ERR_NOTONCHANNEL(this->name), sender->get_fd());
+		server.send_response(ERR_NOTONCHANNEL(this->name.str()), sender->get_fd());
+		return;
+	}
+	if (is_banned(sender) && !is_op(sender))
+	{
+		server.send_response(ERR_CANNOTSENDTOCHAN(sender->get_nickname(), this->name.str()), sender->get_fd());
 		return;
 	}
-	// Broadcasts to all exlude sender
-	broadcast(sender, RPL_PRIVMSG(CLIENT(sender->get_nickname(), sender->get_username(), sender->get_IPaddr()), this->name, message));
+	std::string line = RPL_PRIVMSG(source, this->name.str(), message);
+	unsigned long long msgid = server.new_msgid();
+	this->history.push(line, server.get_clock(), msgid);
+	Variants variants(line, server.get_timestamp(), server.format_msgid(msgid), std::string());
+	// Broadcasts to all exlude sender, unless it asked for its own messages back
+	broadcast(sender->has_cap(CAP_ECHO_MESSAGE) ? NULL : sender, variants);
+	if (!server.get_plugins().empty())
+		server.get_plugins().message(this->name.str(), sender->get_nickname(), message[0] == ':' ? message.substr(1) : message);
+}
+
+// A line from a plugin's service, kept in the history like any message
+void Channel::announce(std::string const &line)
+{
+	unsigned long long msgid = server.new_msgid();
+	this->history.push(line, server.get_clock(), msgid);
+	Variants variants(line, server.get_timestamp(), server.format_msgid(msgid), std::string());
+	broadcast(NULL, variants);
 }
@@ -0,0 +1,90 @@
+#include "ChannelRegistry.hpp"
+#include "Channel.hpp"
+#include "Mask.hpp"
+
+ChannelRegistry::ChannelRegistry()
+	: count(0)
+{
+}
+
+Channel *ChannelRegistry::find(std::string const &name) const
+{
+	auto it = this->index.find(irc_lower(name));
+	if (it == this->index.end())
+		return (NULL);
+	return (this->slots[it->second].channel);
+}
+
+Channel *ChannelRegistry::get(ChannelId id) const
+{
+	uint32_t slot = (uint32_t)id;
+	if (slot >= this->slots.size() || this->slots[slot].generation != (uint32_t)(id >> 32))
+		return (NULL);
+	return (this->slots[slot].channel);
+}
+
+// Registering a channel under its name, the channel learns its id
+ChannelId ChannelRegistry::add(Channel *channel)
+{
+	uint32_t slot;
+	if (!this->free_slots.empty())
+	{
+		slot = this->free_slots.back();
+		this->free_slots.pop_back();
+	}
+	else
+	{
+		slot = this->slots.size();
+		this->slots.push_back(Slot{NULL, 0});
+	}
+	this->slots[slot].channel = channel;
+	this->slots[slot].generation++; // never 0, so no id equals NO_CHANNEL
+	this->index[irc_lower(channel->get_channel_name())] = slot;
+	this->count++;
+	ChannelId id = ((ChannelId)this->slots[slot].generation << 32) | slot;
+	channel->set_id(id);
+	return (id);
+}
+
+void ChannelRegistry::remove(Channel *channel)
+{
+	uint32_t slot = (uint32_t)channel->get_id();
+	if (this->get(channel->get_id()) != channel)
+		return;
+	this->index.erase(irc_lower(channel->get_channel_name()));
+	this->slots[slot].channel = NULL;
+	this->free_slots.push_back(slot);
+	this->count--;
+	channel->set_id(NO_CHANNEL);
+}
+
+// The registered channels, in no particular order
+std::vector<Channel *> ChannelRegistry::list() const
+{
+	std::vector<Channel *> channels;
+	channels.reserve(this->count);
+	for (auto &slot : this->slots)
+		if (slot.channel)
+			channels.push_back(slot.channel);
+	return (channels);
+}
+
+size_t ChannelRegistry::slot_count() const
+{
+	return (this->slots.size());
+}
+
+Channel *ChannelRegistry::at(size_t slot) const
+{
+	return (this->slots[slot].channel);
+}
+
+size_t ChannelRegistry::size() const
+{
+	return (this->count);
+}
+
+bool ChannelRegistry::empty() const
+{
+	return (this->count == 0);
+}
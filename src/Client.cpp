@@ -1,17 +1,35 @@
 #include "Client.hpp"
+#include "Memory.hpp"
+#include "Tls.hpp"
 
 Client::Client()
 {
-	this->nickname = "";
-	this->username = "";
 	this->fd = -1;
 	this->registered = false;
+	this->logged_in = false;
 	this->buffer = "";
-	this->IPaddr = "";
+	this->link = NULL;
+	this->server_link = false;
+	this->introduced = false;
+	this->nick_ts = std::time(NULL);
+	this->serial = 0;
+	this->visited = 0;
+	this->caps = 0;
+	this->negotiating = false;
+	this->closing = false;
+	Memory::add(MEM_CLIENTS, sizeof(Client));
 }
 Client::Client(std::string nickname, std::string username, int fd)
-	: fd(fd), nickname(nickname), username(username)
+	: fd(fd), registered(false), logged_in(false), nickname(nickname), username(username), link(NULL), server_link(false), introduced(false), nick_ts(std::time(NULL)), serial(0), visited(0), caps(0), negotiating(false), closing(false)
 {
+	Memory::add(MEM_CLIENTS, sizeof(Client));
+}
+
+Client::~Client()
+{
+	Memory::add(MEM_CLIENTS, -(long long)sizeof(Client));
+	for (auto &line : this->deferred)
+		Memory::add(MEM_DEFERRED, -(long long)line.size());
 }
 
 int Client::get_fd() const
@@ -19,7 +37,12 @@ int Client::get_fd() const
 	return (this->fd);
 }
 
-std::string Client::get_nickname() const
+std::string const &Client::get_nickname() const
+{
+	return (this->nickname.str());
+}
+
+Symbol const &Client::get_nick_symbol() const
 {
 	return (this->nickname);
 }
@@ -29,9 +52,9 @@ void Client::clear_buffer()
 	this->buffer.clear();
 }
 
-std::string Client::get_username() const
+std::string const &Client::get_username() const
 {
-	return (this->username);
+	return (this->username.str());
 }
 
 std::string Client::get_buffer() const
@@ -39,21 +62,32 @@ std::string Client::get_buffer() const
 	return (this->buffer);
 }
 
-std::string Client::get_IPaddr() const
+std::string const &Client::get_IPaddr() const
+{
+	return (this->IPaddr.str());
+}
+
+std::string const &Client::get_host() const
 {
-	return (this->IPaddr);
+	return (this->host.str());
 }
 
-std::string Client::get_hostname() const
+std::string const &Client::get_hostname() const
 {
-	return (this->hostname);
+	return (this->hostname.str());
 }
 
-std::string Client::get_realname() const
+std::string const &Client::get_realname() const
 {
 	return (this->realname);
 }
 
+// nick!~user@host, what ban masks are matched against
+std::string Client::get_hostmask() const
+{
+	return (this->nickname.str() + "!~" + this->username.str() + "@" + this->host.str());
+}
+
 bool Client::is_registered()
 {
 	return (this->registered);
@@ -64,6 +98,12 @@ bool Client::is_logged_in()
 	return (this->logged_in);
 }
 
+// Registration is complete: the welcome was sent and the hostmask is fixed
+bool Client::is_welcomed() const
+{
+	return (this->registered && !this->negotiating && !this->username.empty() && !this->nickname.empty() && this->nickname.str() != "Changing to");
+}
+
 void Client::set_fd(int fd)
 {
 	this->fd = fd;
@@ -72,6 +112,12 @@ void Client::set_fd(int fd)
 void Client::set_IPaddr(std::string IPaddr)
 {
 	this->IPaddr = IPaddr;
+	this->host = this->IPaddr;
+}
+
+void Client::set_host(std::string const &host)
+{
+	this->host = host;
 }
 
 void Client::set_buffer(std::string buff)
@@ -82,6 +128,7 @@ void Client::set_buffer(std::string buff)
 void Client::set_nickname(std::string &nickname)
 {
 	this->nickname = nickname;
+	this->nick_ts = std::time(NULL);
 }
 
 void Client::set_username(std::string &username)
@@ -109,6 +156,113 @@ void Client::set_realname(std::string &realname)
 	this->realname = realname;
 }
 
+void Client::set_link(Client *link, std::string const &server)
+{
+	this->link = link;
+	this->server = server;
+}
+
+void Client::set_server_link(std::string const &server)
+{
+	this->server_link = true;
+	this->server = server;
+}
+
+void Client::set_introduced(bool value)
+{
+	this->introduced = value;
+}
+
+void Client::set_closing()
+{
+	this->closing = true;
+}
+
+void Client::set_nick_ts(time_t ts)
+{
+	this->nick_ts = ts;
+}
+
+void Client::set_serial(unsigned long serial)
+{
+	this->serial = serial;
+}
+
+unsigned long Client::get_serial() const
+{
+	return (this->serial);
+}
+
+void Client::set_tls(std::shared_ptr<TlsSession> const &tls)
+{
+	this->tls = tls;
+}
+
+std::shared_ptr<TlsSession> const &Client::get_tls() const
+{
+	return (this->tls);
+}
+
+void Client::set_caps(unsigned char caps)
+{
+	this->caps = caps;
+}
+
+void Client::set_negotiating(bool value)
+{
+	this->negotiating = value;
+}
+
+unsigned char Client::get_caps() const
+{
+	return (this->caps);
+}
+
+bool Client::has_cap(unsigned char cap) const
+{
+	return (this->caps & cap);
+}
+
+bool Client::is_negotiating() const
+{
+	return (this->negotiating);
+}
+
+Client *Client::get_link() const
+{
+	return (this->link);
+}
+
+std::string const &Client::get_server() const
+{
+	return (this->server);
+}
+
+bool Client::is_server_link() const
+{
+	return (this->server_link);
+}
+
+bool Client::is_remote() const
+{
+	return (this->link != NULL);
+}
+
+bool Client::is_introduced() const
+{
+	return (this->introduced);
+}
+
+bool Client::is_closing() const
+{
+	return (this->closing);
+}
+
+time_t Client::get_nick_ts() const
+{
+	return (this->nick_ts);
+}
+
 std::vector<Channel *> Client::get_channels() const
 {
 	return (this->channels);
@@ -123,3 +277,109 @@ void Client::remove_channel(Channel *channel)
 {
 	this->channels.erase(std::remove(this->channels.begin(), this->channels.end(), channel), this->channels.end());
 }
+
+void Client::defer(std::string const &line)
+{
+	this->deferred.push_back(line);
+	Memory::add(MEM_DEFERRED, line.size());
+}
+
+// Output that was on its way out, it goes before anything deferred later
+void Client::requeue(std::string const &data)
+{
+	this->deferred.push_front(data);
+	Memory::add(MEM_DEFERRED, data.size());
+}
+
+// Marking the client as reached by a fan-out, false if it already was
+bool Client::visit(unsigned long epoch)
+{
+	if (this->visited == epoch)
+		return (false);
+	this->visited = epoch;
+	return (true);
+}
+
+bool Client::has_deferred() const
+{
+	return (!this->deferred.empty());
+}
+
+// Queuing a stream, it runs once the ones already queued are done
+void Client::add_stream(std::function<bool(size_t)> stream)
+{
+	if (!this->stream)
+	{
+		this->stream = stream;
+		return;
+	}
+	std::function<bool(size_t)> first = this->stream;
+	this->stream = [first, stream](size_t budget) mutable {
+		if (first && first(budget))
+			return (true);
+		first = nullptr;
+		return (stream(budget));
+	};
+}
+
+bool Client::has_stream() const
+{
+	return (static_cast<bool>(this->stream));
+}
+
+void Client::run_stream(size_t budget)
+{
+	if (this->stream && !this->stream(budget))
+		this->stream = nullptr;
+}
+
+std::string Client::pop_deferred()
+{
+	std::string line = this->deferred.front();
+	this->deferred.pop_front();
+	Memory::add(MEM_DEFERRED, -(long long)line.size());
+	return (line);
+}
+
+// Saving everything but the fd and the channels, those are handed over separately
+void Client::save(Archive &out) const
+{
+	out.put_str(this->IPaddr.str());
+	out.put_str(this->host.str());
+	out.put_u8(this->registered);
+	out.put_u8(this->logged_in);
+	out.put_str(this->nickname.str());
+	out.put_str(this->username.str());
+	out.put_str(this->buffer);
+	out.put_str(this->hostname.str());
+	out.put_str(this->realname);
+	out.put_u8(this->introduced); // announced again when the new process relinks
+	out.put_u64(this->nick_ts);
+	out.put_u8(this->caps);
+	out.put_u8(this->negotiating);
+	out.put_u32(this->deferred.size());
+	for (auto &line : this->deferred)
+		out.put_str(line);
+	out.put_u8(this->tls != NULL); // only kTLS sessions are handed over
+}
+
+void Client::load(Reader &in)
+{
+	this->IPaddr = in.get_str();
+	this->host = in.get_str();
+	this->registered = in.get_u8();
+	this->logged_in = in.get_u8();
+	this->nickname = in.get_str();
+	this->username = in.get_str();
+	this->buffer = in.get_str();
+	this->hostname = in.get_str();
+	this->realname = in.get_str();
+	this->introduced = in.get_u8();
+	this->nick_ts = in.get_u64();
+	this->caps = in.get_u8();
+	this->negotiating = in.get_u8();
+	for (uint32_t n = in.get_u32(); n > 0; n--)
+		this->defer(in.get_str());
+	if (in.get_u8())
+		this->tls = TlsSession::kernel_only();
+}
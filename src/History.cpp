@@ -0,0 +1,211 @@
+#include "History.hpp"
+#include "Memory.hpp"
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <climits>
+
+History::History(size_t max_lines, size_t max_bytes)
+	: ring(max_lines), head(0), count(0), bytes(0), max_bytes(max_bytes)
+{
+}
+
+History::~History()
+{
+	Memory::add(MEM_HISTORY, -(long long)this->bytes);
+}
+
+// Storing a line sent at `time` under msgid, false if it's too large to keep
+bool History::push(std::string const &line, long long time, unsigned long long msgid)
+{
+	return (this->append(line, time, msgid));
+}
+
+// Evicting the oldest entries until at most max_bytes are kept
+void History::trim(size_t max_bytes)
+{
+	while (this->count > 0 && this->bytes > max_bytes)
+		this->pop_oldest();
+}
+
+// Storing a new line, evicting the oldest ones until both bounds hold
+bool History::append(std::string const &line, long long time, unsigned long long msgid)
+{
+	if (this->ring.empty() || line.size() > this->max_bytes)
+		return (false);
+	while (this->count > 0 && (this->count == this->ring.size() || this->bytes + line.size() > this->max_bytes))
+		this->pop_oldest();
+	HistoryEntry &slot = this->ring[(this->head + this->count) % this->ring.size()];
+	slot.msgid = msgid;
+	slot.time = time;
+	slot.line = line;
+	this->bytes += line.size();
+	Memory::add(MEM_HISTORY, line.size());
+	this->count++;
+	return (true);
+}
+
+void History::pop_oldest()
+{
+	HistoryEntry &slot = this->ring[this->head];
+	this->bytes -= slot.line.size();
+	Memory::add(MEM_HISTORY, -(long long)slot.line.size());
+	std::string().swap(slot.line); // release the memory, the slot may stay unused for a while
+	this->head = (this->head + 1) % this->ring.size();
+	this->count--;
+}
+
+HistoryEntry const &History::at(size_t i) const
+{
+	return (this->ring[(this->head + i) % this->ring.size()]);
+}
+
+// Index of the first entry with a msgid above the given one, the msgids have gaps
+size_t History::first_above(unsigned long long msgid) const
+{
+	size_t lo = 0, hi = this->count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (this->at(mid).msgid <= msgid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+// Entries in [from, to) counted from the oldest one
+std::vector<HistoryEntry const *> History::range(size_t from, size_t to) const
+{
+	std::vector<HistoryEntry const *> entries;
+	for (size_t i = from; i < to; i++)
+		entries.push_back(&this->at(i));
+	return (entries);
+}
+
+std::vector<HistoryEntry const *> History::latest(size_t limit) const
+{
+	size_t from = this->count > limit ? this->count - limit : 0;
+	return (this->range(from, this->count));
+}
+
+// The last `limit` entries older than msgid
+std::vector<HistoryEntry const *> History::before(unsigned long long msgid, size_t limit) const
+{
+	size_t to = msgid > 0 ? this->first_above(msgid - 1) : 0;
+	size_t from = to > limit ? to - limit : 0;
+	return (this->range(from, to));
+}
+
+// The first `limit` entries newer than msgid
+std::vector<HistoryEntry const *> History::after(unsigned long long msgid, size_t limit) const
+{
+	size_t from = this->first_above(msgid);
+	size_t to = std::min(from + limit, this->count);
+	return (this->range(from, to));
+}
+
+// Smallest msgid stored at or after time (above every stored one if there is none)
+unsigned long long History::first_at_or_after(long long time) const
+{
+	size_t lo = 0, hi = this->count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (this->at(mid).time < time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < this->count ? this->at(lo).msgid : ULLONG_MAX);
+}
+
+// Largest msgid stored at or before time (0 if there is none)
+unsigned long long History::last_at_or_before(long long time) const
+{
+	size_t lo = 0, hi = this->count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (this->at(mid).time <= time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo > 0 ? this->at(lo - 1).msgid : 0);
+}
+
+size_t History::size() const
+{
+	return (this->count);
+}
+
+size_t History::get_bytes() const
+{
+	return (this->bytes);
+}
+
+void History::save(Archive &out) const
+{
+	out.put_u32(this->count);
+	for (size_t i = 0; i < this->count; i++)
+	{
+		out.put_u64(this->at(i).msgid);
+		out.put_u64(this->at(i).time);
+		out.put_str(this->at(i).line);
+	}
+}
+
+// Replacing the content with a saved history, keeping the msgids it had
+void History::load(Reader &in)
+{
+	while (this->count > 0)
+		this->pop_oldest();
+	size_t saved = in.get_u32();
+	for (size_t i = 0; i < saved; i++)
+	{
+		unsigned long long msgid = in.get_u64();
+		long long time = in.get_u64();
+		this->append(in.get_str(), time, msgid);
+	}
+}
+
+long long History::now()
+{
+	return (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// Parsing an IRCv3 server-time timestamp (YYYY-MM-DDThh:mm:ss.sssZ), -1 on error
+long long History::parse_timestamp(std::string const &timestamp)
+{
+	struct tm tm;
+	int ms = 0;
+	int from = 0, to = 0; // where the fraction starts and ends, it may have fewer than 3 digits
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(timestamp.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d.%n%3d%nZ", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			   &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &from, &ms, &to) < 6)
+		return (-1);
+	for (int digits = to - from; to > 0 && digits < 3; digits++)
+		ms *= 10;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	time_t secs = timegm(&tm);
+	if (secs == (time_t)-1)
+		return (-1);
+	return ((long long)secs * 1000 + ms);
+}
+
+std::string History::format_timestamp(long long time)
+{
+	char date[32];
+	char ms[8];
+	struct tm tm;
+	time_t secs = time / 1000;
+	gmtime_r(&secs, &tm);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(ms, sizeof(ms), ".%03dZ", (int)(time % 1000));
+	return (std::string(date) + ms);
+}
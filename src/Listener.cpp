@@ -0,0 +1,200 @@
+#include "Listener.hpp"
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+Listener::Listener(std::string const &address, int port, bool tls)
+	: address(address), port(port), tls(tls), fd(-1), bound(false), rcvbuf(0), sndbuf(0), nodelay(false), defer_accept(0), busy_poll(0)
+{
+	this->name = port ? address + " " + std::to_string(port) : "unix " + address;
+}
+
+// One option of a `listen` line
+bool Listener::set_option(std::string const &option)
+{
+	size_t equal = option.find('=');
+	std::string key = option.substr(0, equal);
+	char *end = NULL;
+	long value = equal == std::string::npos ? 0 : std::strtol(option.c_str() + equal + 1, &end, 10);
+	if (option == "tls")
+		this->tls = true;
+	else if (option == "nodelay")
+		this->nodelay = true;
+	else if (equal == std::string::npos || end == option.c_str() + equal + 1 || *end || value < 0 || value > 1 << 30)
+		return (false);
+	else if (key == "rcvbuf")
+		this->rcvbuf = value;
+	else if (key == "sndbuf")
+		this->sndbuf = value;
+	else if (key == "defer_accept")
+		this->defer_accept = value;
+	else if (key == "busy_poll")
+		this->busy_poll = value;
+	else
+		return (false);
+	return (true);
+}
+
+void Listener::open()
+{
+	try
+	{
+		if (this->port)
+			this->bind_tcp();
+		else
+			this->bind_unix();
+		this->apply();
+		if (listen(this->fd, LISTENER_BACKLOG) == -1) // listen for incoming connections and making the socket a passive socket
+			throw(std::runtime_error("listen() faild on " + this->name));
+	}
+	catch (std::exception &)
+	{
+		this->close();
+		throw;
+	}
+}
+
+void Listener::adopt(int fd)
+{
+	this->fd = fd;
+	this->apply(); // the links file may have changed them
+}
+
+void Listener::own()
+{
+	this->bound = this->is_unix() && this->fd != -1;
+}
+
+// TCP_NODELAY and SO_BUSY_POLL are set on each connection, not every system copies them from the listener
+void Listener::tune(int fd) const
+{
+	int on = 1;
+	if (this->nodelay && !this->is_unix())
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	if (this->busy_poll)
+		setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &this->busy_poll, sizeof(this->busy_poll));
+}
+
+void Listener::close()
+{
+	if (this->fd == -1)
+		return;
+	::close(this->fd);
+	this->fd = -1;
+	if (this->bound)
+		unlink(this->address.c_str());
+	this->bound = false;
+}
+
+std::string const &Listener::get_name() const
+{
+	return (this->name);
+}
+
+int Listener::get_fd() const
+{
+	return (this->fd);
+}
+
+bool Listener::is_tls() const
+{
+	return (this->tls);
+}
+
+bool Listener::is_unix() const
+{
+	return (this->port == 0);
+}
+
+// The socket options, the buffer sizes before listen() so the window scale is picked from them
+void Listener::apply() const
+{
+	if (this->rcvbuf && setsockopt(this->fd, SOL_SOCKET, SO_RCVBUF, &this->rcvbuf, sizeof(this->rcvbuf)) == -1)
+		throw(std::runtime_error("failed to set option (SO_RCVBUF) on " + this->name));
+	if (this->sndbuf && setsockopt(this->fd, SOL_SOCKET, SO_SNDBUF, &this->sndbuf, sizeof(this->sndbuf)) == -1)
+		throw(std::runtime_error("failed to set option (SO_SNDBUF) on " + this->name));
+	if (this->is_unix())
+		return;
+	int on = this->nodelay;
+	if (setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1)
+		throw(std::runtime_error("failed to set option (TCP_NODELAY) on " + this->name));
+	if (setsockopt(this->fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &this->defer_accept, sizeof(this->defer_accept)) == -1)
+		throw(std::runtime_error("failed to set option (TCP_DEFER_ACCEPT) on " + this->name));
+	if (this->busy_poll && setsockopt(this->fd, SOL_SOCKET, SO_BUSY_POLL, &this->busy_poll, sizeof(this->busy_poll)) == -1)
+		throw(std::runtime_error("failed to set option (SO_BUSY_POLL) on " + this->name + ", it needs CAP_NET_ADMIN"));
+}
+
+// "*" binds a dual-stack socket to every address, anything else one IPv4 or IPv6 address
+void Listener::bind_tcp()
+{
+	struct sockaddr_storage addr;
+	socklen_t len;
+	memset(&addr, 0, sizeof(addr));
+	struct sockaddr_in *v4 = (struct sockaddr_in *)&addr;
+	struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)&addr;
+	if (this->address != "*" && inet_pton(AF_INET, this->address.c_str(), &v4->sin_addr) == 1)
+	{
+		v4->sin_family = AF_INET;
+		v4->sin_port = htons(this->port);
+		len = sizeof(*v4);
+	}
+	else
+	{
+		v6->sin6_family = AF_INET6;
+		v6->sin6_addr = in6addr_any;
+		v6->sin6_port = htons(this->port);
+		len = sizeof(*v6);
+		if (this->address != "*" && inet_pton(AF_INET6, this->address.c_str(), &v6->sin6_addr) != 1)
+			throw(std::runtime_error("invalid listen address " + this->address));
+	}
+	int sock = socket(addr.ss_family, SOCK_STREAM, 0);
+	if (sock == -1)
+		throw(std::runtime_error("failed to create socket"));
+	this->fd = sock;
+	int optset = 0;
+	if (addr.ss_family == AF_INET6 && setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &optset, sizeof(optset)) == -1) // ipv4 too on "*" (dual-stack socket)
+		throw(std::runtime_error("failed to set IPV6_V6ONLY option"));
+	optset = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &optset, sizeof(optset)) == -1) // Set the SO_REUSEADDR option to allow the socket to reuse the address
+		throw(std::runtime_error("failed to set option (SO_REUSEADDR) on socket"));
+	if (fcntl(sock, F_SETFL, O_NONBLOCK) == -1) // set the socket option (O_NONBLOCK) for non-blocking socket
+		throw(std::runtime_error("faild to set option (O_NONBLOCK) on socket"));
+	if (bind(sock, (struct sockaddr *)&addr, len) == -1)
+		throw(std::runtime_error("faild to bind socket to " + this->name));
+}
+
+// A socket file left by a server that didn't exit cleanly is replaced, one still accepting
+// connections or any other file is not
+void Listener::bind_unix()
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (this->address.empty() || this->address.size() >= sizeof(addr.sun_path))
+		throw(std::runtime_error("invalid unix socket path " + this->address));
+	memcpy(addr.sun_path, this->address.c_str(), this->address.size());
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1)
+		throw(std::runtime_error("failed to create socket"));
+	this->fd = sock;
+	struct stat st;
+	if (lstat(this->address.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+	{
+		if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+			throw(std::runtime_error("another server is listening on " + this->address));
+		unlink(this->address.c_str());
+	}
+	if (fcntl(sock, F_SETFL, O_NONBLOCK) == -1)
+		throw(std::runtime_error("faild to set option (O_NONBLOCK) on socket"));
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		throw(std::runtime_error("faild to bind socket to " + this->name));
+	this->bound = true;
+}
@@ -0,0 +1,99 @@
+#include "LoopStats.hpp"
+#include "Message.hpp"
+#include <sstream>
+#include <cstring>
+
+static_assert(IRCCommand::ERROR < LOOP_COMMAND_KINDS, "LOOP_COMMAND_KINDS too small for the commands");
+
+LoopStats::LoopStats()
+	: ticks(0), ready(0), idle(0), waiting(0), processing(0)
+{
+	memset(this->lag.counts, 0, sizeof(this->lag.counts));
+	memset(this->commands, 0, sizeof(this->commands));
+}
+
+// The processing of an iteration ends where the wait for the next one begins
+void LoopStats::polling()
+{
+	this->poll_start = Clock::now();
+	if (this->poll_end == Clock::time_point())
+		return;
+	long long spent = micros(this->poll_start - this->poll_end);
+	this->processing += spent;
+	this->lag.add(spent);
+}
+
+void LoopStats::polled(int ready)
+{
+	this->poll_end = Clock::now();
+	this->waiting += micros(this->poll_end - this->poll_start);
+	this->ticks++;
+	if (ready > 0)
+		this->ready += ready;
+	else
+		this->idle++;
+}
+
+void LoopStats::command(int kind, Clock::duration spent)
+{
+	CommandStats &stats = this->commands[kind];
+	long long us = micros(spent);
+	stats.count++;
+	stats.total += us;
+	if (us > stats.max)
+		stats.max = us;
+}
+
+std::string LoopStats::report() const
+{
+	std::ostringstream out;
+	long long total = this->waiting + this->processing;
+	out << "  " << this->ticks << " iterations, " << this->idle << " woke up with nothing ready, "
+		<< (this->ticks ? (double)this->ready / this->ticks : 0) << " fds ready on average" << std::endl;
+	out << "  waiting " << this->waiting / 1000 << "ms, processing " << this->processing / 1000 << "ms ("
+		<< (total ? this->processing * 100 / total : 0) << "% busy)" << std::endl;
+	out << "  processing per iteration:" << std::endl
+		<< this->lag.report("    ");
+	out << "  commands (count, average, max):" << std::endl;
+	for (int kind = 0; kind < LOOP_COMMAND_KINDS; kind++)
+	{
+		CommandStats const &stats = this->commands[kind];
+		if (stats.count)
+			out << "    " << commandName(static_cast<IRCCommand>(kind)) << ": " << stats.count << ", "
+				<< stats.total / (long long)stats.count << "us, " << stats.max << "us" << std::endl;
+	}
+	return (out.str());
+}
+
+long long LoopStats::micros(Clock::duration spent)
+{
+	return (std::chrono::duration_cast<std::chrono::microseconds>(spent).count());
+}
+
+void LoopStats::Histogram::add(long long micros)
+{
+	int bucket = 0;
+	while (bucket < LOOP_BUCKETS - 1 && micros >= (1LL << bucket))
+		bucket++;
+	this->counts[bucket]++;
+}
+
+// One line per bucket that has counts, by its upper bound
+std::string LoopStats::Histogram::report(std::string const &indent) const
+{
+	std::ostringstream out;
+	for (int bucket = 0; bucket < LOOP_BUCKETS; bucket++)
+	{
+		if (!this->counts[bucket])
+			continue;
+		out << indent;
+		if (bucket == LOOP_BUCKETS - 1)
+			out << "more";
+		else if (bucket >= 10)
+			out << "< " << (1LL << bucket) / 1000 << "ms";
+		else
+			out << "< " << (1LL << bucket) << "us";
+		out << ": " << this->counts[bucket] << std::endl;
+	}
+	return (out.str());
+}
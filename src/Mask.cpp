@@ -0,0 +1,106 @@
+#include "Mask.hpp"
+
+// rfc1459 casemapping: []\~ are the upper case of {}|^
+char irc_tolower(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return (c + ('a' - 'A'));
+	if (c == '[')
+		return ('{');
+	if (c == ']')
+		return ('}');
+	if (c == '\\')
+		return ('|');
+	if (c == '~')
+		return ('^');
+	return (c);
+}
+
+std::string irc_lower(std::string const &str)
+{
+	std::string lower(str);
+	for (auto &c : lower)
+		c = irc_tolower(c);
+	return (lower);
+}
+
+Mask::Mask() : star(false), wildcards(false), min_length(0)
+{
+}
+
+// Splitting the mask on `*` into the anchored prefix, the anchored suffix and the literals in between
+Mask::Mask(std::string const &mask) : mask(mask), star(false), wildcards(false), min_length(0)
+{
+	std::vector<std::string> segments(1);
+	for (char c : mask)
+	{
+		if (c == '*')
+		{
+			this->star = true;
+			segments.push_back(std::string());
+		}
+		else
+			segments.back() += irc_tolower(c);
+		if (c == '*' || c == '?')
+			this->wildcards = true;
+	}
+	this->prefix = segments.front();
+	if (this->star)
+	{
+		this->suffix = segments.back();
+		for (size_t i = 1; i + 1 < segments.size(); i++)
+			if (!segments[i].empty())
+				this->middle.push_back(segments[i]);
+	}
+	for (auto &segment : segments)
+		this->min_length += segment.size();
+}
+
+// Comparing a literal at pos, `?` matches any character
+bool Mask::match_at(std::string const &str, size_t pos, std::string const &literal)
+{
+	for (size_t i = 0; i < literal.size(); i++)
+		if (literal[i] != '?' && literal[i] != irc_tolower(str[pos + i]))
+			return (false);
+	return (true);
+}
+
+// First position in [from, to) where the literal fits entirely, npos if none
+size_t Mask::find(std::string const &str, size_t from, size_t to, std::string const &literal)
+{
+	for (size_t pos = from; pos + literal.size() <= to; pos++)
+		if (match_at(str, pos, literal))
+			return (pos);
+	return (std::string::npos);
+}
+
+bool Mask::match(std::string const &str) const
+{
+	if (str.size() < this->min_length)
+		return (false);
+	if (!this->star)
+		return (str.size() == this->prefix.size() && match_at(str, 0, this->prefix));
+	if (!match_at(str, 0, this->prefix) || !match_at(str, str.size() - this->suffix.size(), this->suffix))
+		return (false);
+	// leftmost placement of each middle literal is enough, stars absorb the rest
+	size_t pos = this->prefix.size();
+	size_t end = str.size() - this->suffix.size();
+	for (auto &literal : this->middle)
+	{
+		pos = find(str, pos, end, literal);
+		if (pos == std::string::npos)
+			return (false);
+		pos += literal.size();
+	}
+	return (true);
+}
+
+bool Mask::has_wildcards() const
+{
+	return (this->wildcards);
+}
+
+std::string const &Mask::get_mask() const
+{
+	return (this->mask);
+}
@@ -0,0 +1,206 @@
+#include "MaskList.hpp"
+#include <algorithm>
+
+MaskList::MaskList() : prefixes(1), suffixes(1), count(0), literals(0)
+{
+}
+
+// Literal characters before the first wildcard
+static std::string literal_prefix(std::string const &mask)
+{
+	return (irc_lower(mask.substr(0, mask.find_first_of("*?"))));
+}
+
+// Literal characters after the last wildcard, reversed so they can be walked from the end
+static std::string literal_suffix(std::string const &mask)
+{
+	size_t pos = mask.find_last_of("*?");
+	std::string suffix = irc_lower(pos == std::string::npos ? mask : mask.substr(pos + 1));
+	std::reverse(suffix.begin(), suffix.end());
+	return (suffix);
+}
+
+// Following (and optionally creating) the path of key, npos if it does not exist
+size_t MaskList::walk(std::vector<Node> &trie, std::string const &key, bool create)
+{
+	size_t node = 0;
+	for (char c : key)
+	{
+		auto it = trie[node].next.find(c);
+		if (it != trie[node].next.end())
+		{
+			node = it->second;
+			continue;
+		}
+		if (!create)
+			return (std::string::npos);
+		trie.push_back(Node());
+		trie[node].next[c] = trie.size() - 1;
+		node = trie.size() - 1;
+	}
+	return (node);
+}
+
+// The candidate list a mask belongs to
+std::vector<size_t> *MaskList::bucket(std::string const &mask, bool create)
+{
+	std::string prefix = literal_prefix(mask);
+	std::string suffix = literal_suffix(mask);
+	size_t node;
+	if (!prefix.empty())
+	{
+		node = walk(this->prefixes, prefix, create);
+		return (node == std::string::npos ? NULL : &this->prefixes[node].masks);
+	}
+	if (!suffix.empty())
+	{
+		node = walk(this->suffixes, suffix, create);
+		return (node == std::string::npos ? NULL : &this->suffixes[node].masks);
+	}
+	return (&this->others);
+}
+
+// Length of the trie key a mask is indexed under, 0 if it's in neither trie
+size_t MaskList::key_length(std::string const &mask)
+{
+	size_t prefix = literal_prefix(mask).size();
+	return (prefix ? prefix : literal_suffix(mask).size());
+}
+
+// Indexing the live masks again in fresh tries, dropping the nodes of removed ones
+void MaskList::rebuild()
+{
+	this->prefixes.assign(1, Node());
+	this->suffixes.assign(1, Node());
+	this->others.clear();
+	for (size_t i = 0; i < this->slots.size(); i++)
+		if (this->slots[i].in_use)
+			this->bucket(this->slots[i].mask.get_mask(), true)->push_back(i);
+}
+
+size_t MaskList::find(std::string const &mask) const
+{
+	auto it = this->slot_of.find(irc_lower(mask));
+	if (it == this->slot_of.end())
+		return (std::string::npos);
+	return (it->second);
+}
+
+bool MaskList::add(std::string const &mask, std::string const &setter)
+{
+	if (mask.empty() || this->count >= MASKLIST_MAX || this->find(mask) != std::string::npos)
+		return (false);
+	size_t i;
+	if (!this->free_slots.empty())
+	{
+		i = this->free_slots.back();
+		this->free_slots.pop_back();
+	}
+	else
+	{
+		i = this->slots.size();
+		this->slots.push_back(MaskEntry());
+	}
+	this->slots[i].mask = Mask(mask);
+	this->slots[i].setter = setter;
+	this->slots[i].time = std::time(NULL);
+	this->slots[i].in_use = true;
+	this->bucket(mask, true)->push_back(i);
+	this->slot_of[irc_lower(mask)] = i;
+	this->count++;
+	this->literals += key_length(mask);
+	return (true);
+}
+
+bool MaskList::remove(std::string const &mask)
+{
+	size_t i = this->find(mask);
+	if (i == std::string::npos)
+		return (false);
+	std::vector<size_t> *list = this->bucket(this->slots[i].mask.get_mask(), false);
+	if (list)
+		list->erase(std::remove(list->begin(), list->end(), i), list->end());
+	this->slots[i].in_use = false;
+	this->slot_of.erase(irc_lower(mask));
+	this->free_slots.push_back(i);
+	this->count--;
+	this->literals -= key_length(this->slots[i].mask.get_mask());
+	if (this->prefixes.size() + this->suffixes.size() > 2 * (this->literals + 2))
+		this->rebuild();
+	return (true);
+}
+
+bool MaskList::check(std::vector<size_t> const &candidates, std::string const &hostmask) const
+{
+	for (size_t i : candidates)
+		if (this->slots[i].mask.match(hostmask))
+			return (true);
+	return (false);
+}
+
+// Walking the hostmask through both tries, every node passed holds masks whose literal matches
+bool MaskList::match(std::string const &hostmask) const
+{
+	if (this->count == 0)
+		return (false);
+	size_t node = 0;
+	for (size_t i = 0; i < hostmask.size(); i++)
+	{
+		auto it = this->prefixes[node].next.find(irc_tolower(hostmask[i]));
+		if (it == this->prefixes[node].next.end())
+			break;
+		node = it->second;
+		if (check(this->prefixes[node].masks, hostmask))
+			return (true);
+	}
+	node = 0;
+	for (size_t i = hostmask.size(); i > 0; i--)
+	{
+		auto it = this->suffixes[node].next.find(irc_tolower(hostmask[i - 1]));
+		if (it == this->suffixes[node].next.end())
+			break;
+		node = it->second;
+		if (check(this->suffixes[node].masks, hostmask))
+			return (true);
+	}
+	return (check(this->others, hostmask));
+}
+
+std::vector<MaskEntry const *> MaskList::entries() const
+{
+	std::vector<MaskEntry const *> list;
+	for (auto &entry : this->slots)
+		if (entry.in_use)
+			list.push_back(&entry);
+	return (list);
+}
+
+size_t MaskList::size() const
+{
+	return (this->count);
+}
+
+void MaskList::save(Archive &out) const
+{
+	out.put_u32(this->count);
+	for (auto &entry : this->slots)
+	{
+		if (!entry.in_use)
+			continue;
+		out.put_str(entry.mask.get_mask());
+		out.put_str(entry.setter);
+		out.put_u64(entry.time);
+	}
+}
+
+void MaskList::load(Reader &in)
+{
+	for (uint32_t n = in.get_u32(); n > 0; n--)
+	{
+		std::string mask = in.get_str();
+		std::string setter = in.get_str();
+		time_t time = in.get_u64();
+		if (this->add(mask, setter))
+			this->slots[this->find(mask)].time = time;
+	}
+}
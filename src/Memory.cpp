@@ -0,0 +1,44 @@
+#include "Memory.hpp"
+#include <sstream>
+
+std::atomic<long long> Memory::counters[MEM_KINDS];
+
+void Memory::add(MemoryKind kind, long long delta)
+{
+	counters[kind].fetch_add(delta, std::memory_order_relaxed);
+}
+
+long long Memory::used(MemoryKind kind)
+{
+	return (counters[kind].load(std::memory_order_relaxed));
+}
+
+long long Memory::total()
+{
+	long long sum = 0;
+	for (int kind = 0; kind < MEM_KINDS; kind++)
+		sum += used(static_cast<MemoryKind>(kind));
+	return (sum);
+}
+
+// Only what dropping connections gives back counts here
+bool Memory::io_over_budget()
+{
+	return (used(MEM_RECV) + used(MEM_SEND) > (long long)MEMORY_IO_SHARE);
+}
+
+bool Memory::over_share(MemoryKind kind, unsigned long share)
+{
+	return (used(kind) > (long long)share);
+}
+
+// One line per kind, in KB, then the total against the budget
+std::string Memory::report()
+{
+	static const char *names[MEM_KINDS] = {"recv buffers", "send queues", "deferred output", "history", "channels", "clients"};
+	std::ostringstream out;
+	for (int kind = 0; kind < MEM_KINDS; kind++)
+		out << names[kind] << ": " << used(static_cast<MemoryKind>(kind)) / 1024 << "KB" << std::endl;
+	out << "total: " << total() / 1024 << "KB of " << MEMORY_BUDGET / 1024 << "KB" << std::endl;
+	return (out.str());
+}
@@ -1,40 +1,56 @@
 #include "Server.hpp"
 #include "Message.hpp"
 
+static const std::string commandNames[22] ={ "JOIN", "NICK", "USER","PASS","CAP","MODE","KICK","PING","PONG","INVITE","PRIVMSG","QUIT","TOPIC","PART","WHO","WHOIS","CHATHISTORY","NAMES", "LIST", "SERVER", "ERROR"};
+
 IRCCommand assignCommand(std::string cmd)
 {
-    static const std::string array[18] ={ "JOIN", "NICK", "USER","PASS","CAP","MODE","KICK","PING","PONG","INVITE","PRIVMSG","QUIT","TOPIC","PART","WHO","WHOIS", "ERROR"};
     for (int i = 0; i < IRCCommand::ERROR; i++)
     {
-        if (cmd == array[i])
+        if (cmd == commandNames[i])
             return (static_cast<IRCCommand>(i));
     }
     return IRCCommand::ERROR;
 }
 
+const std::string &commandName(IRCCommand command)
+{
+    return commandNames[command];
+}
+
 Message::Message(const std::string& msg) : rawMessage(msg) {
     Message::parse();
 }
 
 std::string Message::getPrefix() const { return prefix; }
+const std::string &Message::getTags() const { return tags; }
 IRCCommand Message::getCommand() const { return command; }
 std::vector<std::string> Message::getParams() const { return params; }
 const std::string &Message::getRawCmd(){ return rawCmd; }
+const std::string &Message::getRawMessage() const { return rawMessage; }
+std::string Message::getBody() const { return rawMessage.substr(bodyStart); } // the line without its prefix
+std::string Message::getSourceNick() const { return prefix.substr(0, prefix.find('!')); }
 
 void Message::parse()
 {
         size_t prefixEnd = 0;
+        if (rawMessage[0] == '@') {
+            size_t tagsEnd = rawMessage.find(' ');
+            tags = rawMessage.substr(1, tagsEnd - 1);
+            rawMessage.erase(0, rawMessage.find_first_not_of(' ', tagsEnd));
+        } // tags are split off, the rest of the server sees the plain line
         if (rawMessage[0] == ':') {
             prefixEnd = rawMessage.find(' ');
             prefix = rawMessage.substr(1, prefixEnd - 1);
             prefixEnd++;
         } // this might not necessarily exist as per irc rules, prefixes are not mandatory
 
+        bodyStart = prefixEnd < rawMessage.size() ? prefixEnd : rawMessage.size();
         // Find command
         size_t commandEnd = rawMessage.find(' ', prefixEnd);
         rawCmd = rawMessage.substr(prefixEnd, commandEnd - prefixEnd);
         command = assignCommand(rawCmd);
-        size_t start = commandEnd + 1;
+        size_t start = commandEnd == rawMessage.npos ? rawMessage.length() : commandEnd + 1; // a bare command has no parameters
 
         while (start < rawMessage.length()) {
             size_t end;
@@ -0,0 +1,478 @@
+#include "Pipeline.hpp"
+#include "Message.hpp"
+#include "Memory.hpp"
+#include "Tls.hpp"
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <sys/socket.h>
+#include <iostream>
+
+static void open_wake_pipe(int fds[2])
+{
+	if (pipe(fds) == -1)
+		throw(std::runtime_error("pipeline: pipe() failed"));
+	for (int i = 0; i < 2; i++)
+		if (fcntl(fds[i], F_SETFL, O_NONBLOCK) == -1 || fcntl(fds[i], F_SETFD, FD_CLOEXEC) == -1)
+			throw(std::runtime_error("pipeline: fcntl() failed"));
+}
+
+Pipeline::Pipeline()
+	: input(PIPELINE_QUEUE_SIZE), output(PIPELINE_QUEUE_SIZE), watches(PIPELINE_QUEUE_SIZE), retired(PIPELINE_QUEUE_SIZE), shed(PIPELINE_QUEUE_SIZE), secured(PIPELINE_QUEUE_SIZE), stopping(false), running(false),
+	  backlogs(new std::atomic<uint32_t>[PIPELINE_TRACKED_FDS]())
+{
+	open_wake_pipe(this->logic_wake);
+	open_wake_pipe(this->reader_wake);
+	open_wake_pipe(this->writer_wake);
+}
+
+Pipeline::~Pipeline()
+{
+	std::map<int, std::string> partial, unsent;
+	if (this->running)
+		this->stop(partial, unsent);
+	for (int *fds : {this->logic_wake, this->reader_wake, this->writer_wake})
+	{
+		::close(fds[0]);
+		::close(fds[1]);
+	}
+}
+
+void Pipeline::start()
+{
+	this->stopping = false;
+	this->reader_fds.clear();
+	struct pollfd wakeup = {this->reader_wake[0], POLLIN, 0};
+	this->reader_fds.push_back(wakeup);
+	this->reader = std::thread(&Pipeline::reader_loop, this);
+	this->writer = std::thread(&Pipeline::writer_loop, this);
+	this->running = true;
+}
+
+// Stopping both threads, returning per connection the input not run yet and the output not sent yet
+void Pipeline::stop(std::map<int, std::string> &partial, std::map<int, std::string> &unsent)
+{
+	this->stopping = true;
+	wake(this->reader_wake[1]);
+	wake(this->writer_wake[1]);
+	this->reader.join();
+	this->writer.join();
+	this->running = false;
+	drain(this->logic_wake[0]);
+
+	std::vector<Inbound> inputs;
+	this->held.swap(inputs);
+	for (std::vector<Inbound> batch; this->input.pop(batch);)
+		inputs.insert(inputs.end(), batch.begin(), batch.end());
+	for (auto &in : inputs)
+		for (auto &msg : in.messages)
+			partial[in.fd] += msg.getRawMessage() + "\r\n";
+	for (auto &connection : this->connections)
+	{
+		partial[connection.first] += connection.second.partial;
+		Memory::add(MEM_RECV, -(long long)connection.second.partial.size());
+	}
+	for (Watch watch; this->watches.pop(watch);)
+		partial[watch.fd] += watch.partial;
+	this->connections.clear();
+
+	std::vector<Outbound> outputs;
+	for (std::vector<Outbound> batch; this->output.pop(batch);)
+		outputs.insert(outputs.end(), batch.begin(), batch.end());
+	this->apply_secured();
+	for (auto &out : outputs)
+	{
+		if (this->dropped.count(out.fd) == 0)
+			this->queue(out.fd, out.data);
+		if (out.close)
+		{
+			this->flush(out.fd);
+			this->drop_pending(out.fd);
+			this->dropped.erase(out.fd);
+			this->end_session(out.fd);
+			::close(out.fd);
+		}
+	}
+	for (int fd; this->retired.pop(fd);)
+		::close(fd);
+	for (Shed gone; this->shed.pop(gone);)
+		;
+	for (auto &left : this->pending)
+		if (!left.second.empty())
+			unsent[left.first] = left.second;
+	while (!this->pending.empty())
+		this->drop_pending(this->pending.begin()->first);
+	this->sessions.clear(); // the connections stay up, the sessions go back with the clients
+}
+
+bool Pipeline::is_running() const
+{
+	return (this->running);
+}
+
+int Pipeline::get_wakeup_fd() const
+{
+	return (this->logic_wake[0]);
+}
+
+void Pipeline::acknowledge()
+{
+	drain(this->logic_wake[0]);
+}
+
+bool Pipeline::receive(std::vector<Inbound> &batch)
+{
+	return (this->input.pop(batch));
+}
+
+void Pipeline::watch(int fd, unsigned long serial, std::string const &partial, std::shared_ptr<TlsSession> const &tls)
+{
+	if (tls)
+	{
+		Watch session = {fd, serial, std::string(), tls};
+		this->secured.push(session);
+	}
+	Watch watch = {fd, serial, partial, tls};
+	this->watches.push(watch);
+	wake(this->reader_wake[1]);
+}
+
+void Pipeline::send(std::vector<Outbound> &batch)
+{
+	this->output.push(batch);
+	wake(this->writer_wake[1]);
+}
+
+void Pipeline::close(int fd, std::string const &data)
+{
+	std::vector<Outbound> batch(1, Outbound{fd, data, true});
+	this->send(batch);
+}
+
+/// READER ///
+
+void Pipeline::reader_loop()
+{
+	while (!this->stopping)
+	{
+		// while the logic thread is behind, the sockets are left alone so the kernel pushes back
+		int timeout = this->held.empty() ? -1 : 1;
+		if (poll(&this->reader_fds[0], this->reader_fds.size(), timeout) == -1)
+		{
+			if (errno != EINTR)
+				std::cerr << "Pipeline: reader poll() failed" << std::endl;
+			continue;
+		}
+		if (this->reader_fds[0].revents & POLLIN)
+			drain(this->reader_wake[0]);
+		std::vector<Inbound> batch;
+		this->apply_retired();
+		this->apply_shed(batch);
+		this->apply_watches(batch);
+		if (this->held.empty())
+			for (size_t i = 1; i < this->reader_fds.size(); i++)
+				if (this->reader_fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+					i -= this->read_from(i, batch);
+		if (!batch.empty())
+			this->held.insert(this->held.end(), batch.begin(), batch.end());
+		if (!this->held.empty() && this->input.try_push(this->held))
+		{
+			this->held.clear();
+			wake(this->logic_wake[1]);
+		}
+	}
+}
+
+// Connections the logic thread started to watch, some may arrive with complete lines
+void Pipeline::apply_watches(std::vector<Inbound> &batch)
+{
+	for (Watch watch; this->watches.pop(watch);)
+	{
+		struct pollfd new_poll = {watch.fd, POLLIN, 0};
+		this->reader_fds.push_back(new_poll);
+		Connection &connection = this->connections[watch.fd];
+		connection.serial = watch.serial;
+		connection.partial = watch.partial;
+		connection.tls = watch.tls;
+		Memory::add(MEM_RECV, connection.partial.size());
+		this->frame(watch.fd, connection, batch);
+		if (connection.tls && connection.tls->has_buffered()) // arrived along with the handshake, poll() won't tell
+			this->read_from(this->reader_fds.size() - 1, batch);
+	}
+}
+
+// Sockets the writer is done with
+void Pipeline::apply_retired()
+{
+	for (int fd; this->retired.pop(fd);)
+	{
+		for (size_t i = 1; i < this->reader_fds.size(); i++)
+			if (this->reader_fds[i].fd == fd)
+			{
+				this->reader_fds.erase(this->reader_fds.begin() + i);
+				break;
+			}
+		this->forget(fd);
+		::close(fd);
+	}
+}
+
+// Connections the writer gave up on, reported to the logic thread as closed
+void Pipeline::apply_shed(std::vector<Inbound> &batch)
+{
+	for (Shed gone; this->shed.pop(gone);)
+	{
+		auto connection = this->connections.find(gone.fd);
+		if (connection == this->connections.end()) // already closed or reported
+			continue;
+		batch.push_back(Inbound{gone.fd, connection->second.serial, std::vector<Message>(), true, gone.reason});
+		for (size_t i = 1; i < this->reader_fds.size(); i++)
+			if (this->reader_fds[i].fd == gone.fd)
+			{
+				this->reader_fds.erase(this->reader_fds.begin() + i);
+				break;
+			}
+		this->forget(gone.fd);
+	}
+}
+
+void Pipeline::forget(int fd)
+{
+	auto connection = this->connections.find(fd);
+	if (connection == this->connections.end())
+		return;
+	Memory::add(MEM_RECV, -(long long)connection->second.partial.size());
+	this->connections.erase(connection);
+}
+
+// Reading a ready socket, true if it left the poll set
+bool Pipeline::read_from(size_t i, std::vector<Inbound> &batch)
+{
+	char buff[PIPELINE_READ_SIZE];
+	int fd = this->reader_fds[i].fd;
+	Connection &connection = this->connections[fd];
+	std::string reason;
+	while (true)
+	{
+		ssize_t bytes = connection.tls ? connection.tls->receive(fd, buff, sizeof(buff)) : recv(fd, buff, sizeof(buff), 0);
+		if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return (false);
+		if (bytes <= 0)
+			break;
+		connection.partial.append(buff, bytes);
+		Memory::add(MEM_RECV, bytes);
+		this->frame(fd, connection, batch);
+		if (connection.partial.size() > RECVQ_MAX)
+		{
+			reason = "RecvQ exceeded"; // no line end in sight, the peer is not speaking IRC
+			break;
+		}
+		// OpenSSL decrypts whole records, what didn't fit in buff waits where poll() can't see it
+		if (!connection.tls || !connection.tls->has_buffered())
+			return (false);
+	}
+	// the peer is gone, the socket stays open until the logic thread closes it
+	batch.push_back(Inbound{fd, connection.serial, std::vector<Message>(), true, reason});
+	this->reader_fds.erase(this->reader_fds.begin() + i);
+	this->forget(fd);
+	return (true);
+}
+
+// Cutting the complete lines off the buffer, CR, LF and CRLF all end a line
+void Pipeline::frame(int fd, Connection &connection, std::vector<Inbound> &batch)
+{
+	size_t end = connection.partial.find_last_of("\r\n");
+	if (end == std::string::npos)
+		return;
+	Inbound in = {fd, connection.serial, std::vector<Message>(), false, std::string()};
+	size_t start = 0;
+	while (start <= end)
+	{
+		size_t stop = connection.partial.find_first_of("\r\n", start);
+		if (stop > start)
+			in.messages.push_back(Message(connection.partial.substr(start, stop - start)));
+		start = stop + 1;
+	}
+	connection.partial.erase(0, end + 1);
+	Memory::add(MEM_RECV, -(long long)(end + 1));
+	if (!in.messages.empty())
+		batch.push_back(in);
+}
+
+/// WRITER ///
+
+void Pipeline::writer_loop()
+{
+	std::vector<struct pollfd> set;
+	while (!this->stopping)
+	{
+		set.clear();
+		struct pollfd wakeup = {this->writer_wake[0], POLLIN, 0};
+		set.push_back(wakeup);
+		for (auto &out : this->pending) // sockets whose buffer was full last time
+		{
+			struct pollfd blocked = {out.first, POLLOUT, 0};
+			set.push_back(blocked);
+		}
+		if (poll(&set[0], set.size(), -1) == -1)
+		{
+			if (errno != EINTR)
+				std::cerr << "Pipeline: writer poll() failed" << std::endl;
+			continue;
+		}
+		if (set[0].revents & POLLIN)
+			drain(this->writer_wake[0]);
+		std::vector<int> closing;
+		for (std::vector<Outbound> batch; this->output.pop(batch);)
+			for (auto &out : batch)
+			{
+				if (this->dropped.count(out.fd) == 0)
+					this->queue(out.fd, out.data);
+				if (out.close)
+					closing.push_back(out.fd);
+			}
+		this->apply_secured(); // pushed before any output for their connection
+		std::vector<int> done;
+		for (auto &out : this->pending)
+			if (this->flush(out.first))
+				done.push_back(out.first);
+		for (int fd : done)
+			this->drop_pending(fd);
+		// a closing socket gets one last try, what doesn't fit in its kernel buffer is dropped
+		for (int fd : closing)
+		{
+			this->drop_pending(fd);
+			this->dropped.erase(fd);
+			this->end_session(fd);
+			this->retired.push(fd);
+		}
+		this->enforce_budget();
+		if (!closing.empty())
+			wake(this->reader_wake[1]);
+	}
+}
+
+// TLS sessions of the connections the logic thread started to watch
+void Pipeline::apply_secured()
+{
+	for (Watch watch; this->secured.pop(watch);)
+		this->sessions[watch.fd] = watch.tls;
+}
+
+// Saying goodbye on a TLS connection that is about to be closed
+void Pipeline::end_session(int fd)
+{
+	auto session = this->sessions.find(fd);
+	if (session == this->sessions.end())
+		return;
+	session->second->shutdown();
+	this->sessions.erase(session);
+}
+
+// Sending as much as the socket takes, true once nothing is left (or the socket failed)
+bool Pipeline::flush(int fd)
+{
+	std::string &data = this->pending[fd];
+	auto session = this->sessions.find(fd);
+	TlsSession *tls = session == this->sessions.end() ? NULL : session->second.get();
+	size_t sent = 0;
+	while (sent < data.size())
+	{
+		ssize_t n = tls ? tls->send(fd, data.c_str() + sent, data.size() - sent) : ::send(fd, data.c_str() + sent, data.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				std::cerr << "Response send() failed to fd: " << fd << std::endl;
+				return (true);
+			}
+			break;
+		}
+		sent += n;
+	}
+	data.erase(0, sent);
+	Memory::add(MEM_SEND, -(long long)sent);
+	this->set_backlog(fd, data.size());
+	return (data.empty());
+}
+
+void Pipeline::queue(int fd, std::string const &data)
+{
+	if (data.empty())
+		return;
+	std::string &queued = this->pending[fd];
+	queued += data;
+	Memory::add(MEM_SEND, data.size());
+	this->set_backlog(fd, queued.size());
+}
+
+void Pipeline::drop_pending(int fd)
+{
+	auto out = this->pending.find(fd);
+	if (out == this->pending.end())
+		return;
+	Memory::add(MEM_SEND, -(long long)out->second.size());
+	this->pending.erase(out);
+	this->set_backlog(fd, 0);
+}
+
+void Pipeline::set_backlog(int fd, size_t size)
+{
+	if (fd >= 0 && fd < PIPELINE_TRACKED_FDS)
+		this->backlogs[fd].store(size > UINT32_MAX ? UINT32_MAX : size, std::memory_order_relaxed);
+}
+
+size_t Pipeline::backlog(int fd) const
+{
+	if (fd < 0 || fd >= PIPELINE_TRACKED_FDS)
+		return (0);
+	return (this->backlogs[fd].load(std::memory_order_relaxed));
+}
+
+// Giving up on a connection: its output is dropped and the logic thread is told to close it
+void Pipeline::drop_connection(int fd, std::string const &reason)
+{
+	std::cerr << "Pipeline: dropping fd " << fd << ": " << reason << std::endl;
+	this->drop_pending(fd);
+	this->dropped.insert(fd);
+	Shed gone = {fd, reason};
+	this->shed.push(gone);
+	wake(this->reader_wake[1]);
+}
+
+// A connection may not hold more than SENDQ_MAX, and while the input and output
+// buffers are over their share of the budget the largest send queues are dropped
+// first. History and channels are kept within theirs by the logic thread.
+void Pipeline::enforce_budget()
+{
+	std::vector<int> over;
+	for (auto &out : this->pending)
+		if (out.second.size() > SENDQ_MAX)
+			over.push_back(out.first);
+	for (int fd : over)
+		this->drop_connection(fd, "SendQ exceeded");
+	while (Memory::io_over_budget() && !this->pending.empty())
+	{
+		auto largest = this->pending.begin();
+		for (auto it = this->pending.begin(); it != this->pending.end(); ++it)
+			if (it->second.size() > largest->second.size())
+				largest = it;
+		this->drop_connection(largest->first, "Memory budget exceeded");
+	}
+}
+
+void Pipeline::wake(int fd)
+{
+	char c = 0;
+	if (write(fd, &c, 1) == -1 && errno != EAGAIN) // a full pipe already wakes the other side
+		std::cerr << "Pipeline: wakeup failed" << std::endl;
+}
+
+void Pipeline::drain(int fd)
+{
+	char buff[64];
+	while (read(fd, buff, sizeof(buff)) > 0)
+		;
+}
@@ -0,0 +1,123 @@
+#include "Plugins.hpp"
+#include "LoopStats.hpp"
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <dlfcn.h>
+
+Plugins::Plugins(PluginHost &host) : host(host)
+{
+}
+
+// Deleting every plugin before its code is unmapped
+Plugins::~Plugins()
+{
+	for (auto &plugin : this->loaded)
+	{
+		delete plugin.plugin;
+		dlclose(plugin.handle);
+	}
+}
+
+void Plugins::load(std::string const &path, long budget)
+{
+	void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (!handle)
+		throw(std::runtime_error("failed to load the plugin " + path + ": " + dlerror()));
+	PluginEntry entry = reinterpret_cast<PluginEntry>(dlsym(handle, PLUGIN_ENTRY));
+	Plugin *plugin = entry ? entry(PLUGIN_API_VERSION) : NULL;
+	if (!plugin)
+	{
+		dlclose(handle);
+		throw(std::runtime_error("the plugin " + path + (entry ? " doesn't support this server's API" : " has no " PLUGIN_ENTRY " function")));
+	}
+	Loaded loaded = {path, plugin->name(), handle, plugin, budget, 0, 0, 0, false};
+	this->loaded.push_back(loaded);
+	std::cout << "Plugin " << loaded.name << " loaded from " << path << ", " << budget << "us per hook" << std::endl;
+}
+
+bool Plugins::empty() const
+{
+	return (this->loaded.empty());
+}
+
+std::string Plugins::report() const
+{
+	std::ostringstream out;
+	for (auto &plugin : this->loaded)
+		out << "  " << plugin.name << (plugin.disabled ? " (disabled)" : "") << ": " << plugin.calls << " calls, "
+			<< plugin.overruns << " over " << plugin.budget << "us, slowest " << plugin.slowest << "us" << std::endl;
+	return (out.str());
+}
+
+// Calling a hook of every enabled plugin until one returns true, timing each call
+template <typename Call>
+bool Plugins::run(char const *hook, Call call)
+{
+	for (auto &plugin : this->loaded)
+	{
+		if (plugin.disabled)
+			continue;
+		LoopStats::Clock::time_point start = LoopStats::Clock::now();
+		bool done = false;
+		try
+		{
+			done = call(*plugin.plugin);
+		}
+		catch (std::exception &e)
+		{
+			this->disable(plugin, std::string(hook) + " threw: " + e.what());
+		}
+		long long spent = LoopStats::micros(LoopStats::Clock::now() - start);
+		plugin.calls++;
+		if (spent > plugin.slowest)
+			plugin.slowest = spent;
+		if (spent > plugin.budget)
+		{
+			plugin.overruns++;
+			std::cout << "Plugin " << plugin.name << ": " << hook << " took " << spent << "us, over its " << plugin.budget << "us budget" << std::endl;
+			if (plugin.overruns >= PLUGIN_STRIKES && !plugin.disabled)
+				this->disable(plugin, "too slow too often");
+		}
+		if (done)
+			return (true);
+	}
+	return (false);
+}
+
+// A disabled plugin stays loaded, other objects may still point into its code
+void Plugins::disable(Loaded &plugin, std::string const &why)
+{
+	plugin.disabled = true;
+	std::cerr << "Plugin " << plugin.name << " disabled: " << why << std::endl;
+}
+
+bool Plugins::command(std::string const &nickname, std::string const &command, std::vector<std::string> const &params)
+{
+	return (this->run("on_command", [&](Plugin &plugin)
+					  { return (plugin.on_command(this->host, nickname, command, params)); }));
+}
+
+void Plugins::join(std::string const &channel, std::string const &nickname)
+{
+	this->run("on_join", [&](Plugin &plugin)
+			  { plugin.on_join(this->host, channel, nickname); return (false); });
+}
+
+void Plugins::part(std::string const &channel, std::string const &nickname, std::string const &reason)
+{
+	this->run("on_part", [&](Plugin &plugin)
+			  { plugin.on_part(this->host, channel, nickname, reason); return (false); });
+}
+
+void Plugins::message(std::string const &channel, std::string const &nickname, std::string const &text)
+{
+	this->run("on_message", [&](Plugin &plugin)
+			  { plugin.on_message(this->host, channel, nickname, text); return (false); });
+}
+
+void Plugins::kick(std::string const &channel, std::string const &kicker, std::string const &kicked, std::string const &reason)
+{
+	this->run("on_kick", [&](Plugin &plugin)
+			  { plugin.on_kick(this->host, channel, kicker, kicked, reason); return (false); });
+}
@@ -0,0 +1,268 @@
+#include "Resolver.hpp"
+#include <thread>
+#include <iostream>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+Resolver::Shared::Shared() : stopping(false), stubbed(false)
+{
+	if (pipe(this->wake) == -1)
+		throw(std::runtime_error("resolver: pipe() failed"));
+	for (int i = 0; i < 2; i++)
+		if (fcntl(this->wake[i], F_SETFL, O_NONBLOCK) == -1 || fcntl(this->wake[i], F_SETFD, FD_CLOEXEC) == -1)
+			throw(std::runtime_error("resolver: fcntl() failed"));
+	// a stub file answers every lookup instead of the DNS, for tests
+	if (getenv(RESOLVER_STUB_ENV))
+	{
+		this->stubbed = true;
+		std::ifstream file(getenv(RESOLVER_STUB_ENV));
+		std::string line, address, name;
+		while (std::getline(file, line))
+		{
+			std::istringstream fields(line);
+			if (fields >> address >> name && address[0] != '#')
+				this->stub[address] = name;
+		}
+	}
+}
+
+Resolver::Shared::~Shared()
+{
+	close(this->wake[0]);
+	close(this->wake[1]);
+}
+
+Resolver::Resolver() : shared(std::make_shared<Shared>()), running(false)
+{
+}
+
+Resolver::~Resolver()
+{
+	this->stop();
+}
+
+void Resolver::start()
+{
+	if (this->running)
+		return;
+	for (int i = 0; i < RESOLVER_THREADS; i++)
+		std::thread(&Resolver::worker, this->shared).detach();
+	this->running = true;
+}
+
+// Letting the workers go, a lookup in flight finishes on its own and is dropped
+void Resolver::stop()
+{
+	if (!this->running)
+		return;
+	{
+		std::lock_guard<std::mutex> guard(this->shared->lock);
+		this->shared->stopping = true;
+	}
+	this->shared->ready.notify_all();
+	this->shared = std::make_shared<Shared>();
+	this->inflight.clear();
+	this->running = false;
+}
+
+int Resolver::get_wakeup_fd() const
+{
+	return (this->shared->wake[0]);
+}
+
+bool Resolver::lookup(std::string const &address, std::string &host)
+{
+	auto it = this->cache.find(address);
+	if (it == this->cache.end())
+		return (false);
+	if (it->second->expires <= std::time(NULL))
+	{
+		this->lru.erase(it->second);
+		this->cache.erase(it);
+		return (false);
+	}
+	this->lru.splice(this->lru.begin(), this->lru, it->second);
+	host = it->second->host;
+	return (true);
+}
+
+// Looking up the address of a connection, requests for the same address share one lookup
+void Resolver::request(int fd, unsigned long serial, std::string const &address)
+{
+	std::vector<Waiter> &waiters = this->inflight[address];
+	waiters.push_back(Waiter{fd, serial});
+	if (waiters.size() > 1)
+		return;
+	{
+		std::lock_guard<std::mutex> guard(this->shared->lock);
+		this->shared->jobs.push_back(address);
+	}
+	this->shared->ready.notify_one();
+}
+
+// Looking up the address of a host, the answer comes back through receive()
+void Resolver::request_address(std::string const &host)
+{
+	{
+		std::lock_guard<std::mutex> guard(this->shared->lock);
+		this->shared->hosts.push_back(host);
+	}
+	this->shared->ready.notify_one();
+}
+
+// Taking the finished lookups, one Resolution per connection that asked and the addresses found
+bool Resolver::receive(std::vector<Resolution> &done, std::vector<HostAddress> &addresses)
+{
+	std::deque<std::pair<std::string, std::string> > finished;
+	std::deque<HostAddress> found;
+	char buf[64];
+	while (read(this->shared->wake[0], buf, sizeof(buf)) > 0)
+		;
+	{
+		std::lock_guard<std::mutex> guard(this->shared->lock);
+		finished.swap(this->shared->done);
+		found.swap(this->shared->found);
+	}
+	addresses.insert(addresses.end(), found.begin(), found.end());
+	for (auto &result : finished)
+	{
+		this->remember(result.first, result.second);
+		auto it = this->inflight.find(result.first);
+		if (it == this->inflight.end())
+			continue;
+		for (auto &waiter : it->second)
+			done.push_back(Resolution{waiter.fd, waiter.serial, result.first, result.second});
+		this->inflight.erase(it);
+	}
+	return (!done.empty());
+}
+
+void Resolver::remember(std::string const &address, std::string const &host)
+{
+	auto it = this->cache.find(address);
+	if (it != this->cache.end())
+	{
+		this->lru.erase(it->second);
+		this->cache.erase(it);
+	}
+	time_t ttl = host.empty() ? RESOLVER_NEGATIVE_TTL : RESOLVER_TTL;
+	this->lru.push_front(CacheEntry{address, host, std::time(NULL) + ttl});
+	this->cache[address] = this->lru.begin();
+	if (this->lru.size() > RESOLVER_CACHE_SIZE)
+	{
+		this->cache.erase(this->lru.back().address);
+		this->lru.pop_back();
+	}
+}
+
+void Resolver::worker(std::shared_ptr<Shared> shared)
+{
+	std::unique_lock<std::mutex> guard(shared->lock);
+	while (true)
+	{
+		shared->ready.wait(guard, [&shared] { return shared->stopping || !shared->jobs.empty() || !shared->hosts.empty(); });
+		if (shared->stopping)
+			return;
+		bool reverse = !shared->jobs.empty();
+		std::string name = reverse ? shared->jobs.front() : shared->hosts.front();
+		if (reverse)
+			shared->jobs.pop_front();
+		else
+			shared->hosts.pop_front();
+		guard.unlock();
+		std::string answer = reverse ? resolve(*shared, name) : address_of(*shared, name);
+		guard.lock();
+		if (shared->stopping)
+			return;
+		if (reverse)
+			shared->done.push_back(std::make_pair(name, answer));
+		else
+			shared->found.push_back(HostAddress{name, answer});
+		char c = 0;
+		if (write(shared->wake[1], &c, 1) == -1 && errno != EAGAIN) // a full pipe already wakes the logic thread
+			std::cerr << "Resolver: wakeup failed" << std::endl;
+	}
+}
+
+// The name of an address, only if the name resolves back to the address
+std::string Resolver::resolve(Shared &shared, std::string const &address)
+{
+	if (shared.stubbed)
+	{
+		auto it = shared.stub.find(address);
+		return (it == shared.stub.end() ? std::string() : it->second);
+	}
+	struct sockaddr_storage addr;
+	socklen_t len;
+	memset(&addr, 0, sizeof(addr));
+	if (inet_pton(AF_INET, address.c_str(), &((struct sockaddr_in *)&addr)->sin_addr) == 1)
+	{
+		addr.ss_family = AF_INET;
+		len = sizeof(struct sockaddr_in);
+	}
+	else if (inet_pton(AF_INET6, address.c_str(), &((struct sockaddr_in6 *)&addr)->sin6_addr) == 1)
+	{
+		addr.ss_family = AF_INET6;
+		len = sizeof(struct sockaddr_in6);
+	}
+	else
+		return (std::string());
+	char name[NI_MAXHOST];
+	if (getnameinfo((struct sockaddr *)&addr, len, name, sizeof(name), NULL, 0, NI_NAMEREQD) != 0)
+		return (std::string());
+	std::string host(name);
+	// the name ends up in every hostmask, it must be a plain hostname
+	if (host.size() > RESOLVER_HOST_MAX || host.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-") != std::string::npos)
+		return (std::string());
+	struct addrinfo hints;
+	struct addrinfo *found;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = addr.ss_family;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(name, NULL, &hints, &found) != 0)
+		return (std::string());
+	bool confirmed = false;
+	for (struct addrinfo *it = found; it && !confirmed; it = it->ai_next)
+	{
+		if (addr.ss_family == AF_INET)
+			confirmed = memcmp(&((struct sockaddr_in *)it->ai_addr)->sin_addr, &((struct sockaddr_in *)&addr)->sin_addr, sizeof(struct in_addr)) == 0;
+		else
+			confirmed = memcmp(&((struct sockaddr_in6 *)it->ai_addr)->sin6_addr, &((struct sockaddr_in6 *)&addr)->sin6_addr, sizeof(struct in6_addr)) == 0;
+	}
+	freeaddrinfo(found);
+	return (confirmed ? host : std::string());
+}
+
+// The first address a host resolves to, in numeric form
+std::string Resolver::address_of(Shared &shared, std::string const &host)
+{
+	struct in6_addr numeric;
+	if (inet_pton(AF_INET, host.c_str(), &numeric) == 1 || inet_pton(AF_INET6, host.c_str(), &numeric) == 1)
+		return (host);
+	if (shared.stubbed)
+	{
+		for (auto &entry : shared.stub)
+			if (entry.second == host)
+				return (entry.first);
+		return (std::string());
+	}
+	struct addrinfo hints;
+	struct addrinfo *found;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), NULL, &hints, &found) != 0)
+		return (std::string());
+	char address[NI_MAXHOST];
+	bool ok = getnameinfo(found->ai_addr, found->ai_addrlen, address, sizeof(address), NULL, 0, NI_NUMERICHOST) == 0;
+	freeaddrinfo(found);
+	return (ok ? std::string(address) : std::string());
+}
@@ -2,89 +2,156 @@
 #include "Message.hpp"
 
 // Static variable
-bool Server::signal = false;
+volatile sig_atomic_t Server::signal = false;
+volatile sig_atomic_t Server::upgrade = false;
+volatile sig_atomic_t Server::report = false;
 
 Server::Server(int port, const std::string &password)
-	: port(port), name("LOL"), password(password)
+	: port(port), name("LOL"), password(password), handed_over(false), batch_depth(0), last_link_attempt(0), next_remote_fd(-2), next_serial(0), fanout_epoch(0), msgid_epoch(History::now()), next_msgid(1), clock(History::now()), plugins(*this)
 {
-	this->server_socket = -1;
+	this->listeners.push_back(Listener("*", port, false));
 }
 
 Server::~Server()
 {
 	for (auto client : clients)
 		delete client;
-	for (auto channel : channels)
-		delete channel.second;
+	for (auto channel : this->channels.list())
+		delete channel;
 }
 
-// Creeating the server socket
-void Server::create_server_socket()
+// Adding a listener, one on the same address and port as an earlier one replaces it
+void Server::add_listener(Listener const &listener)
 {
-	struct pollfd new_poll;
-	int optset;
+	for (auto &existing : this->listeners)
+		if (existing.get_name() == listener.get_name())
+		{
+			existing = listener;
+			return;
+		}
+	this->listeners.push_back(listener);
+}
 
-	struct sockaddr_in6 addr; // sockaddr_in6 for dual-stack socket ipv6 & ipv4
-	memset(&addr, 0, sizeof(addr));
-	addr.sin6_family = AF_INET6;							// set the address family to ipv6
-	addr.sin6_addr = in6addr_any;							// set the address to any local machine address
-	addr.sin6_port = htons(this->port);						// convert the port to network byte order
-	this->server_socket = socket(AF_INET6, SOCK_STREAM, 0); // create the server socket
-	if (this->server_socket == -1)							// check if created
-		throw(std::runtime_error("failed to create socket"));
-	optset = 0;
-	if (setsockopt(this->server_socket, IPPROTO_IPV6, IPV6_V6ONLY, &optset, sizeof(optset)) == -1) // Set the IPV6_V6ONLY option to 0 to allow ipv4 (dual-stack socket)
-		throw(std::runtime_error("failed to set IPV6_V6ONLY option"));
-	optset = 1;
-	if (setsockopt(this->server_socket, SOL_SOCKET, SO_REUSEADDR, &optset,sizeof(optset)) == -1) // Set the SO_REUSEADDR option to allow the socket to reuse the address
-		throw(std::runtime_error("failed to set option (SO_REUSEADDR) on socket"));
-	if (fcntl(this->server_socket, F_SETFL, O_NONBLOCK) == -1) // set the socket option (O_NONBLOCK) for non-blocking socket
-		throw(std::runtime_error("faild to set option (O_NONBLOCK) on socket"));
-	if (bind(this->server_socket, (struct sockaddr *)&addr, sizeof(addr)) == -1) // bind the socket to the address
-		throw(std::runtime_error("faild to bind socket"));
-	if (listen(this->server_socket, SOMAXCONN) == -1) // listen for incoming connections and making the socket a passive socket
-		throw(std::runtime_error("listen() faild"));
-	new_poll.fd = this->server_socket; // add the server socket to the pollfd
-	new_poll.events = POLLIN;		   // set the event to POLLIN for reading data
-	new_poll.revents = 0;			   // set the revents to 0
-	this->fds.push_back(new_poll);	   // add the server socket to the pollfd
+// Creeating the listening sockets
+void Server::open_listeners()
+{
+	for (auto &listener : this->listeners)
+		listener.open();
 }
 
 // Initializing the server and running the poll loop
 void Server::server_init()
 {
-	this->create_server_socket();
-	std::cout << GREEN << "Server " << this->server_socket << " Connected" << WHITE << std::endl;
+	if (!this->links_file.empty()) // before the sockets, it may ask for more listeners
+		this->load_links(this->links_file);
+	if (getenv(UPGRADE_ENV)) // started by a hot upgrade, the sockets come from the old process
+		this->restore_upgrade(std::atoi(getenv(UPGRADE_ENV)));
+	else
+		this->open_listeners();
+	if (this->snapshot.open(SNAPSHOT_FILE))
+		std::cout << "Snapshot: " << this->snapshot.size() << " channels to restore" << std::endl;
+	for (auto &listener : this->listeners)
+		std::cout << GREEN << "Server " << listener.get_fd() << " Connected on " << listener.get_name() << (listener.is_tls() ? " (TLS)" : "") << WHITE << std::endl;
 	std::cout << "Waiting to accept a connection..." << std::endl;
+	this->start_pipeline();
+	sigset_t saved;
+	Server::block_signals(saved);
+	this->resolver.start();
+	Server::restore_signals(saved);
+	if (getenv(CAPTURE_ENV))
+		this->capture.open(getenv(CAPTURE_ENV));
+	std::vector<struct pollfd> events;
 	while (Server::signal == false) // run the server until the signal is received
 	{
-		if ((poll(&this->fds[0], this->fds.size(), -1) == -1) && Server::signal == false) // wait for an event
-			throw(std::runtime_error("poll() faild"));
-		for (size_t i = 0; i < this->fds.size(); i++) // check all fd's
+		bool held = false;
+		int timeout = this->flush_deferred(held) ? 0 : -1; // don't block while paced output is still pending
+		if (timeout == -1 && held)
+			timeout = PACED_WAIT; // output held back for full send queues, the writer doesn't tell when they drain
+		if (timeout == -1 && !this->link_blocks.empty())
+			timeout = LINK_RETRY * 1000; // wake up to retry the links that are down
+		if ((!this->handshakes.empty() || !this->connecting.empty()) && (timeout == -1 || timeout > 1000))
+			timeout = 1000; // wake up to drop the handshakes and link connects that take too long
+		if (Server::upgrade && this->handshakes.empty())
+			timeout = 0; // the hot upgrade waited for the last handshake
+		this->connect_links();
+		this->expire_handshakes();
+		// client sockets are polled by the pipeline, this thread only waits for parsed input, new connections and TLS handshakes
+		events.clear();
+		events.push_back({this->pipeline.get_wakeup_fd(), POLLIN, 0});
+		events.push_back({this->resolver.get_wakeup_fd(), POLLIN, 0});
+		for (auto &listener : this->listeners) // no new TLS handshakes while a hot upgrade waits for the current ones
+			events.push_back({Server::upgrade && listener.is_tls() ? -1 : listener.get_fd(), POLLIN, 0});
+		for (auto &handshake : this->handshakes)
+			events.push_back({handshake.first, (short)(handshake.second.session->wants_write() ? POLLOUT : POLLIN), 0});
+		size_t connects = events.size(); // then the links being connected
+		for (auto &connect : this->connecting)
+			events.push_back({connect.first, POLLOUT, 0});
+		this->loop_stats.polling();
+		int ready = poll(events.data(), events.size(), timeout); // wait for an event
+		this->loop_stats.polled(ready);
+		if (ready == -1)
 		{
-			if (this->fds[i].revents & POLLIN) // check if there is data to read
-			{
-				if (this->fds[i].fd == this->server_socket)
-					this->accept_new_client(); // accept new client
-				else
-					this->receive_new_data(this->fds[i].fd); // receive new data from a registered client
-			}
+			if (errno != EINTR && Server::signal == false)
+				throw(std::runtime_error("poll() faild"));
+			if (Server::upgrade == false && Server::report == false)
+				continue; // interrupted, revents are not valid
 		}
+		this->tick(); // one timestamp for everything this iteration sends
+		if (Server::report)
+		{
+			Server::report = false;
+			std::cout << YELLOW << "Memory use, " << this->clients.size() << " clients, " << this->channels.size() << " channels, " << Symbol::table_size() << " interned strings:" << std::endl
+					  << Memory::report() << "Admission:" << std::endl
+					  << this->admission.report() << "Main loop:" << std::endl
+					  << this->loop_stats.report();
+			if (!this->plugins.empty())
+				std::cout << "Plugins:" << std::endl
+						  << this->plugins.report();
+			std::cout << WHITE << std::flush;
+		}
+		if (Server::upgrade && this->handshakes.empty()) // a connection mid-handshake can't be handed over nor told why it's closed
+		{
+			Server::upgrade = false;
+			this->drop_links("Hot upgrade");
+			this->drop_tls_clients("Server restarting, please reconnect");
+			this->teardown(); // the links go out through the pipeline, their SQUIT first
+			this->stop_pipeline(); // the sockets and their buffers go back to the clients before the handover
+			if (this->hot_upgrade())
+				break;
+			this->start_pipeline();
+			continue;
+		}
+		size_t first = 2 + this->listeners.size(); // the handshakes come after the listeners
+		for (size_t i = first; i < connects; i++)
+			if (events[i].revents)
+				this->advance_handshake(events[i].fd);
+		for (size_t i = connects; i < events.size(); i++)
+			if (events[i].revents)
+				this->finish_link(events[i].fd);
+		for (size_t i = 2; i < first; i++)
+			if (events[i].revents & POLLIN)
+				this->accept_new_client(this->listeners[i - 2]); // TLS ones start their handshake right away
+		if (events[0].revents & POLLIN)
+			this->receive_new_data(); // run the commands the reader parsed
+		if (events[1].revents & POLLIN)
+			this->receive_resolutions(); // hostnames of new connections, addresses of the links
+		this->teardown(); // the clients that quit during this iteration
+		this->trim_history();
 	}
 	this->close_fds(); // close the fd's when the server gets signal and breaks the loop
 }
 
 // Accepting new clients
-void Server::accept_new_client()
+void Server::accept_new_client(Listener const &listener)
 {
-	struct sockaddr_in usraddr;
-	struct pollfd new_poll;
+	struct sockaddr_storage peer;
+	struct sockaddr_in6 &usraddr = (struct sockaddr_in6 &)peer;
+	char address[INET6_ADDRSTRLEN];
 	socklen_t len;
 	int usr_fd;
 
-	Client *usr = new Client(); // create a new client
-	len = sizeof(usraddr);
-	usr_fd = accept(this->server_socket, (sockaddr *)&(usraddr), &len); // accept the new client
+	len = sizeof(peer);
+	usr_fd = accept(listener.get_fd(), (sockaddr *)&(peer), &len); // accept the new client
 	if (usr_fd == -1)
 	{
 		std::cout << "accept() failed" << std::endl;
@@ -93,66 +160,200 @@ void Server::accept_new_client()
 	if (fcntl(usr_fd, F_SETFL, O_NONBLOCK) == -1) // set the socket option (O_NONBLOCK) for non-blocking socket
 	{
 		std::cout << "fcntl() failed" << std::endl;
+		close(usr_fd);
 		return;
 	}
-	new_poll.fd = usr_fd;							  // add the client socket to the pollfd
-	new_poll.events = POLLIN;						  // set the event to POLLIN for reading data
-	new_poll.revents = 0;							  //  set the revents to 0
-	(*usr).set_fd(usr_fd);							  // set the client fd
-	(*usr).set_IPaddr(inet_ntoa((usraddr.sin_addr))); // convert the ip address to string and set it
-	clients.push_back(usr);							  // add the client to the vector of clients
-	this->fds.push_back(new_poll);					  // add the client socket to the fd's vector
-	std::cout << GREEN << "Client <" << usr_fd << "> Connected" << WHITE << std::endl;
+	listener.tune(usr_fd);
+	if (peer.ss_family == AF_UNIX) // a local bot or bouncer
+		strcpy(address, LISTENER_UNIX_ADDRESS);
+	else if (peer.ss_family == AF_INET) // a listener on one ipv4 address
+		inet_ntop(AF_INET, &((struct sockaddr_in &)peer).sin_addr, address, sizeof(address));
+	else if (IN6_IS_ADDR_V4MAPPED(&usraddr.sin6_addr)) // ipv4 clients of the dual-stack socket, shown as plain ipv4
+		inet_ntop(AF_INET, &usraddr.sin6_addr.s6_addr[12], address, sizeof(address));
+	else
+		inet_ntop(AF_INET6, &usraddr.sin6_addr, address, sizeof(address));
+	std::string ip = address[0] == ':' ? "0" + std::string(address) : address; // "::1" would read as a trailing parameter
+	std::string refusal = this->admission.admit(ip, this->clock / 1000);
+	if (!refusal.empty()) // turned away before anything is allocated for it
+	{
+		if (!listener.is_tls())
+		{
+			std::string line = "ERROR :Closing link: " + refusal + CRLF;
+			send(usr_fd, line.c_str(), line.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+		}
+		close(usr_fd);
+		return;
+	}
+	if (listener.is_tls())
+		this->start_handshake(usr_fd, ip);
+	else
+		this->add_client(usr_fd, ip, std::shared_ptr<TlsSession>());
 }
 
-// Recieving the data from the client and sending to the parser
-void Server::receive_new_data(int fd)
+// Registering an accepted connection, TLS ones once their handshake is done
+void Server::add_client(int fd, std::string const &address, std::shared_ptr<TlsSession> const &tls)
 {
-	std::vector<std::string> cmd_vec;
-	char buff[1024];									 // buffer for the received data
-	memset(buff, 0, sizeof(buff));						 // clear the buffer
-	Client *user = get_client(fd);						 // get the client by fd
-	ssize_t bytes = recv(fd, buff, sizeof(buff) - 1, 0); // receive the data
-	if (bytes <= 0)										 // check if the client disconnected
-		quit(fd);
-	else
+	Client *usr = new Client();		// create a new client
+	(*usr).set_fd(fd);				// set the client fd
+	(*usr).set_IPaddr(address);		// set the client address
+	(*usr).set_tls(tls);			// the I/O threads encrypt through it
+	this->track(usr);				// add the client to the vector of clients
+	this->watch(usr);				// the reader thread takes it from here
+	std::cout << GREEN << "Client <" << fd << "> Connected" << (tls ? " over TLS" : "") << WHITE << std::endl;
+	if (address != LISTENER_UNIX_ADDRESS) // nothing to look up
+		this->lookup_host(usr);
+}
+
+// Starting the TLS handshake of a new connection, it goes on as the socket gets ready
+void Server::start_handshake(int fd, std::string const &address)
+{
+	std::shared_ptr<TlsSession> session = this->tls.accept(fd);
+	if (!session)
 	{
-		user->set_buffer(buff);
-		if (user->get_buffer().find_first_of("\r\n") == std::string::npos) // each msg from client ends with \r \n
-			return;
-		cmd_vec = split_recived_buffer(user->get_buffer());
-		for (auto e : cmd_vec)
+		std::cerr << "TLS: failed to start a session" << std::endl;
+		this->admission.closed(address);
+		close(fd);
+		return;
+	}
+	TlsHandshake handshake = {session, address, std::time(NULL)};
+	this->handshakes[fd] = handshake;
+	this->advance_handshake(fd);
+}
+
+// Continuing a handshake, the connection becomes a client once it's established
+void Server::advance_handshake(int fd)
+{
+	auto it = this->handshakes.find(fd);
+	if (it == this->handshakes.end())
+		return;
+	int state = it->second.session->handshake();
+	if (state == 0)
+		return;
+	TlsHandshake done = it->second;
+	this->handshakes.erase(it);
+	if (state == -1)
+	{
+		std::cerr << "TLS: handshake with " << done.address << " failed" << std::endl;
+		done.session.reset();
+		this->admission.closed(done.address);
+		close(fd);
+		return;
+	}
+	std::cout << GREEN << "TLS: " << done.address << " established, kernel offload: send "
+			  << (done.session->is_kernel_send() ? "on" : "off") << ", receive " << (done.session->is_kernel_receive() ? "on" : "off") << WHITE << std::endl;
+	this->add_client(fd, done.address, done.session);
+}
+
+// Closing the connections that didn't finish their handshake in time
+void Server::expire_handshakes()
+{
+	time_t now = std::time(NULL);
+	for (auto it = this->handshakes.begin(); it != this->handshakes.end();)
+	{
+		if (now - it->second.started < TLS_HANDSHAKE_TIMEOUT)
 		{
-			Message newmsg(e);
-			this->exec_cmd(newmsg, fd);
+			++it;
+			continue;
 		}
-		if (get_client(fd)) // check if the client is still connected. Fixes the bug when the client disconnects.
-			user->clear_buffer();
+		std::cerr << "TLS: handshake with " << it->second.address << " timed out" << std::endl;
+		int fd = it->first;
+		this->admission.closed(it->second.address);
+		it = this->handshakes.erase(it);
+		close(fd);
 	}
 }
 
+// Running the commands the reader thread received and parsed
+void Server::receive_new_data()
+{
+	std::vector<Inbound> batch;
+	this->pipeline.acknowledge();
+	while (this->pipeline.receive(batch))
+	{
+		if (this->capture.is_open()) // written before the batch runs, so a crash keeps the line that caused it
+		{
+			for (auto &input : batch)
+			{
+				Client *user = get_client(input.fd);
+				if (!user || user->get_serial() != input.serial || user->is_server_link())
+					continue;
+				for (auto &newmsg : input.messages)
+					this->capture.line(input.serial, newmsg.getTags().empty() ? newmsg.getRawMessage() : "@" + newmsg.getTags() + " " + newmsg.getRawMessage(), this->clock);
+			}
+			this->capture.flush();
+		}
+		this->begin_batch(); // one handoff to the writer for everything this batch triggers
+		for (auto &input : batch)
+		{
+			Client *user = get_client(input.fd);
+			if (!user || user->get_serial() != input.serial) // the connection was closed meanwhile
+				continue;
+			bool captured = this->capture.is_open() && !user->is_server_link();
+			for (auto &newmsg : input.messages)
+			{
+				LoopStats::Clock::time_point start = LoopStats::Clock::now();
+				Symbol nickname = user->get_nick_symbol(); // the user may be gone after the command
+				if (user->is_server_link())
+					this->link_cmd(newmsg, user);
+				else
+					this->exec_cmd(newmsg, input.fd);
+				LoopStats::Clock::duration spent = LoopStats::Clock::now() - start;
+				this->loop_stats.command(newmsg.getCommand(), spent);
+				if (LoopStats::micros(spent) > SLOW_COMMAND_US)
+					std::cout << YELLOW << "Slow command: " << newmsg.getRawCmd() << " from <" << input.fd << "> " << nickname.str() << " took "
+							  << LoopStats::micros(spent) / 1000 << "ms" << WHITE << std::endl;
+				if (user->is_closing()) // the connection was closed by this line
+					break;
+			}
+			if (input.closed && !user->is_closing()) // check if the client disconnected
+			{
+				if (input.reason.empty())
+					quit(input.fd);
+				else
+					quit(input.fd, input.reason);
+			}
+			if (captured && user->is_closing())
+				this->capture.close(input.serial, this->clock);
+		}
+		this->end_batch();
+	}
+	this->capture.flush(); // the close records
+}
+
 // Parser
 void Server::exec_cmd(Message &newmsg, int fd)
 {
+	Client *source = get_client(fd);
+	bool introduced = source->is_introduced();
+	std::string nickname = source->get_nickname();
+	Client *origin = source->get_link();
+	if (!source->is_remote() && source->is_registered() && this->plugins.command(nickname, newmsg.getRawCmd(), newmsg.getParams()))
+		return; // a plugin took care of it
 	switch (newmsg.getCommand())
 	{
 	case IRCCommand::CAP:
+		cap(newmsg, fd);
+		break;
 	case IRCCommand::PING:
 	case IRCCommand::PONG:
-	case IRCCommand::WHOIS:
+		break;
 	case IRCCommand::WHO:
+		who(newmsg, fd);
+		break;
+	case IRCCommand::WHOIS:
+		whois(newmsg, fd);
 		break;
 	case IRCCommand::JOIN:
 		join(newmsg, fd);
 		break;
 	case IRCCommand::NICK:
-		nick(*newmsg.getParams().begin(), fd);
+		nick(newmsg.getParams().empty() ? std::string() : newmsg.getParams()[0], fd);
 		break;
 	case IRCCommand::USER:
 		username(newmsg.getParams(), fd);
 		break;
 	case IRCCommand::PASS:
-		pass(*newmsg.getParams().begin(), fd);
+		pass(newmsg.getParams().empty() ? std::string() : newmsg.getParams()[0], fd);
 		break;
 	case IRCCommand::QUIT:
 		quit(newmsg, fd);
@@ -172,8 +373,27 @@ void Server::exec_cmd(Message &newmsg, int fd)
 	case IRCCommand::KICK:
 		kick(newmsg, fd);
 		break;
+	case IRCCommand::PART:
+		part(newmsg, fd);
+		break;
+	case IRCCommand::NAMES:
+		names(newmsg, fd);
+		break;
+	case IRCCommand::LIST:
+		list(newmsg, fd);
+		break;
+	case IRCCommand::CHATHISTORY:
+		chathistory(newmsg, fd);
+		break;
+	case IRCCommand::SERVER:
+		server_cmd(newmsg, fd);
+		return;
 	default:
 		this->send_response(ERR_CMDNOTFOUND(std::string("*"), newmsg.getRawCmd()), fd);
 		break;
 	}
+	if (introduced)
+		this->propagate(newmsg, nickname, origin);
+	else if ((source = get_client(fd)) && source->is_welcomed())
+		this->introduce(source);
 }
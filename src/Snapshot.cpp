@@ -0,0 +1,198 @@
+#include "Snapshot.hpp"
+#include "Mask.hpp"
+#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static_assert(sizeof(SnapshotHeader) == 64, "snapshot header layout changed");
+static_assert(sizeof(ChannelRecord) == 512, "snapshot record layout changed");
+
+static void copy_field(char *dst, std::string const &src, size_t size)
+{
+	size_t len = std::min(src.size(), size - 1);
+	memcpy(dst, src.c_str(), len);
+	memset(dst + len, 0, size - len);
+}
+
+Snapshot::Snapshot() : fd(-1), map(NULL), map_size(0), slots(0)
+{
+}
+
+Snapshot::~Snapshot()
+{
+	this->close();
+}
+
+// Mapping the snapshot file, creating it if needed, and indexing the stored channel names
+bool Snapshot::open(std::string const &path)
+{
+	struct stat st;
+
+	this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (this->fd == -1 || fstat(this->fd, &st) == -1)
+	{
+		std::cerr << "Snapshot: could not open " << path << std::endl;
+		this->close();
+		return (false);
+	}
+	uint32_t count = SNAPSHOT_INITIAL_SLOTS;
+	bool fresh = true;
+	if ((size_t)st.st_size >= sizeof(SnapshotHeader))
+	{
+		SnapshotHeader header;
+		if (pread(this->fd, &header, sizeof(header), 0) == sizeof(header) && memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 && header.version == SNAPSHOT_VERSION && (size_t)st.st_size >= sizeof(SnapshotHeader) + (size_t)header.slots * sizeof(ChannelRecord))
+		{
+			count = header.slots;
+			fresh = false;
+		}
+		else
+			std::cerr << "Snapshot: " << path << " is not a version " << SNAPSHOT_VERSION << " snapshot, starting empty" << std::endl;
+	}
+	if (fresh && ftruncate(this->fd, 0) == -1)
+	{
+		this->close();
+		return (false);
+	}
+	if (!this->map_file(count))
+	{
+		this->close();
+		return (false);
+	}
+	if (fresh)
+	{
+		SnapshotHeader *header = reinterpret_cast<SnapshotHeader *>(this->map);
+		memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+		header->version = SNAPSHOT_VERSION;
+	}
+	for (uint32_t i = 0; i < this->slots; i++)
+	{
+		ChannelRecord *record = this->slot(i);
+		// an older file may hold the same channel under two cases, the first record wins
+		if (record->in_use && this->index.emplace(irc_lower(std::string(record->name, strnlen(record->name, SNAPSHOT_NAME_LEN))), i).second)
+			continue;
+		record->in_use = 0;
+	}
+	for (uint32_t i = this->slots; i > 0; i--)
+		if (!this->slot(i - 1)->in_use)
+			this->free_slots.push_back(i - 1);
+	return (true);
+}
+
+// (Re)mapping the file with room for `count` records
+bool Snapshot::map_file(uint32_t count)
+{
+	size_t size = sizeof(SnapshotHeader) + (size_t)count * sizeof(ChannelRecord);
+	if (ftruncate(this->fd, size) == -1)
+	{
+		std::cerr << "Snapshot: ftruncate() failed" << std::endl;
+		return (false);
+	}
+	if (this->map)
+		munmap(this->map, this->map_size);
+	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+	if (addr == MAP_FAILED)
+	{
+		std::cerr << "Snapshot: mmap() failed" << std::endl;
+		this->map = NULL;
+		return (false);
+	}
+	this->map = static_cast<char *>(addr);
+	this->map_size = size;
+	this->slots = count;
+	reinterpret_cast<SnapshotHeader *>(this->map)->slots = count;
+	return (true);
+}
+
+// Doubling the number of records, the new ones are zeroed by ftruncate
+bool Snapshot::grow()
+{
+	uint32_t old_slots = this->slots;
+	if (!this->map_file(old_slots * 2))
+	{
+		this->close();
+		return (false);
+	}
+	for (uint32_t i = this->slots; i > old_slots; i--)
+		this->free_slots.push_back(i - 1);
+	return (true);
+}
+
+void Snapshot::close()
+{
+	if (this->map)
+	{
+		msync(this->map, this->map_size, MS_SYNC);
+		munmap(this->map, this->map_size);
+	}
+	if (this->fd != -1)
+		::close(this->fd);
+	this->map = NULL;
+	this->map_size = 0;
+	this->fd = -1;
+	this->slots = 0;
+	this->index.clear();
+	this->free_slots.clear();
+}
+
+bool Snapshot::is_open() const
+{
+	return (this->map != NULL);
+}
+
+ChannelRecord *Snapshot::slot(uint32_t i) const
+{
+	return (reinterpret_cast<ChannelRecord *>(this->map + sizeof(SnapshotHeader)) + i);
+}
+
+ChannelRecord const *Snapshot::find(std::string const &name) const
+{
+	auto it = this->index.find(irc_lower(name));
+	if (it == this->index.end())
+		return (NULL);
+	return (this->slot(it->second));
+}
+
+// Writing the state of a channel into its record, allocating one if it is new
+void Snapshot::store(std::string const &name, unsigned char modes, unsigned int limit, std::string const &key, std::string const &topic)
+{
+	if (!this->is_open() || name.size() >= SNAPSHOT_NAME_LEN)
+		return;
+	std::string folded = irc_lower(name);
+	auto it = this->index.find(folded);
+	uint32_t i;
+	if (it != this->index.end())
+		i = it->second;
+	else
+	{
+		if (this->free_slots.empty() && !this->grow())
+			return;
+		i = this->free_slots.back();
+		this->free_slots.pop_back();
+		this->index[folded] = i;
+	}
+	ChannelRecord *record = this->slot(i);
+	record->modes = modes;
+	record->limit = limit;
+	copy_field(record->name, name, SNAPSHOT_NAME_LEN);
+	copy_field(record->key, key, SNAPSHOT_KEY_LEN);
+	copy_field(record->topic, topic, SNAPSHOT_TOPIC_LEN);
+	record->in_use = 1;
+}
+
+void Snapshot::erase(std::string const &name)
+{
+	auto it = this->index.find(irc_lower(name));
+	if (it == this->index.end())
+		return;
+	this->slot(it->second)->in_use = 0;
+	this->free_slots.push_back(it->second);
+	this->index.erase(it);
+}
+
+size_t Snapshot::size() const
+{
+	return (this->index.size());
+}
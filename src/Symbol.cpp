@@ -0,0 +1,88 @@
+#include "Symbol.hpp"
+
+Symbol::Symbol() : entry(NULL)
+{
+}
+
+Symbol::Symbol(std::string const &str) : entry(NULL)
+{
+	if (str.empty())
+		return;
+	auto it = table().emplace(str, 0).first; // nodes don't move when the table grows
+	it->second++;
+	this->entry = &*it;
+}
+
+Symbol::Symbol(Symbol const &other) : entry(other.entry)
+{
+	if (this->entry)
+		this->entry->second++;
+}
+
+Symbol &Symbol::operator=(Symbol const &other)
+{
+	if (other.entry)
+		other.entry->second++;
+	this->release();
+	this->entry = other.entry;
+	return (*this);
+}
+
+Symbol::~Symbol()
+{
+	this->release();
+}
+
+void Symbol::release()
+{
+	if (this->entry && --this->entry->second == 0)
+		table().erase(table().find(this->entry->first)); // not by key, the key would go with the node
+	this->entry = NULL;
+}
+
+Symbol::Table &Symbol::table()
+{
+	static Table strings;
+	return (strings);
+}
+
+// Looking a string up without adding it: a string nobody holds can't be equal to any symbol
+Symbol Symbol::find(std::string const &str)
+{
+	Symbol symbol;
+	auto it = table().find(str);
+	if (it != table().end())
+	{
+		it->second++;
+		symbol.entry = &*it;
+	}
+	return (symbol);
+}
+
+size_t Symbol::table_size()
+{
+	return (table().size());
+}
+
+std::string const &Symbol::str() const
+{
+	static const std::string none;
+	if (!this->entry)
+		return (none);
+	return (this->entry->first);
+}
+
+bool Symbol::empty() const
+{
+	return (this->entry == NULL);
+}
+
+bool Symbol::operator==(Symbol const &other) const
+{
+	return (this->entry == other.entry);
+}
+
+bool Symbol::operator!=(Symbol const &other) const
+{
+	return (this->entry != other.entry);
+}
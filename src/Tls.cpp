@@ -0,0 +1,180 @@
+#include "Tls.hpp"
+#include <stdexcept>
+#include <cerrno>
+#include <sys/socket.h>
+#include <openssl/err.h>
+
+TlsSession::TlsSession(SSL *ssl) : ssl(ssl), kernel_send(false), kernel_receive(false), want_write(false)
+{
+}
+
+TlsSession::~TlsSession()
+{
+	SSL_free(this->ssl);
+}
+
+// A session the kernel carries on its own, without OpenSSL state: the
+// keys and record sequence numbers are in the socket
+std::shared_ptr<TlsSession> TlsSession::kernel_only()
+{
+	std::shared_ptr<TlsSession> session = std::make_shared<TlsSession>((SSL *)NULL);
+	session->kernel_send = true;
+	session->kernel_receive = true;
+	return (session);
+}
+
+// Advancing the handshake on a non-blocking socket
+int TlsSession::handshake()
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	int ret = SSL_accept(this->ssl);
+	this->want_write = false;
+	if (ret == 1)
+	{
+		this->kernel_send = BIO_get_ktls_send(SSL_get_wbio(this->ssl));
+		this->kernel_receive = BIO_get_ktls_recv(SSL_get_rbio(this->ssl));
+		return (1);
+	}
+	int err = SSL_get_error(this->ssl, ret);
+	if (err == SSL_ERROR_WANT_READ)
+		return (0);
+	if (err == SSL_ERROR_WANT_WRITE)
+	{
+		this->want_write = true;
+		return (0);
+	}
+	ERR_clear_error();
+	return (-1);
+}
+
+bool TlsSession::wants_write() const
+{
+	return (this->want_write);
+}
+
+// Like recv(): the bytes read, 0 once the peer closed, -1 with errno set (EAGAIN to retry)
+ssize_t TlsSession::receive(int fd, char *buff, size_t size)
+{
+	if (this->kernel_receive)
+		return (::recv(fd, buff, size, 0));
+	std::lock_guard<std::mutex> guard(this->lock);
+	int ret = SSL_read(this->ssl, buff, size);
+	if (ret > 0)
+		return (ret);
+	int err = SSL_get_error(this->ssl, ret);
+	if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+	{
+		errno = EAGAIN;
+		return (-1);
+	}
+	ERR_clear_error();
+	if (err == SSL_ERROR_ZERO_RETURN)
+		return (0);
+	errno = ECONNRESET;
+	return (-1);
+}
+
+// Like send() with MSG_DONTWAIT
+ssize_t TlsSession::send(int fd, char const *data, size_t size)
+{
+	if (this->kernel_send)
+		return (::send(fd, data, size, MSG_NOSIGNAL | MSG_DONTWAIT));
+	std::lock_guard<std::mutex> guard(this->lock);
+	int ret = SSL_write(this->ssl, data, size);
+	if (ret > 0)
+		return (ret);
+	int err = SSL_get_error(this->ssl, ret);
+	if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+	{
+		errno = EAGAIN;
+		return (-1);
+	}
+	ERR_clear_error();
+	errno = EPIPE;
+	return (-1);
+}
+
+// Decrypted bytes OpenSSL holds that poll() can't see
+bool TlsSession::has_buffered()
+{
+	if (this->kernel_receive)
+		return (false);
+	std::lock_guard<std::mutex> guard(this->lock);
+	return (SSL_pending(this->ssl) > 0);
+}
+
+// Sending close_notify, without waiting for the peer's
+void TlsSession::shutdown()
+{
+	if (!this->ssl) // the alert would have to be sent as a kTLS control record, the peer only sees the close
+		return;
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (SSL_is_init_finished(this->ssl))
+		SSL_shutdown(this->ssl);
+	ERR_clear_error();
+}
+
+bool TlsSession::is_kernel_send() const
+{
+	return (this->kernel_send);
+}
+
+bool TlsSession::is_kernel_receive() const
+{
+	return (this->kernel_receive);
+}
+
+// Both directions in the kernel, so the socket alone carries the session
+bool TlsSession::is_kernel() const
+{
+	return (this->kernel_send && this->kernel_receive);
+}
+
+TlsContext::TlsContext() : ctx(NULL)
+{
+}
+
+TlsContext::~TlsContext()
+{
+	if (this->ctx)
+		SSL_CTX_free(this->ctx);
+}
+
+void TlsContext::load(std::string const &certificate, std::string const &key)
+{
+	SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+	if (!ctx)
+		throw(std::runtime_error("tls: SSL_CTX_new() failed"));
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+	// the writer retries from a buffer that may have moved, with whatever it holds by then
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	if (SSL_CTX_use_certificate_chain_file(ctx, certificate.c_str()) != 1 || SSL_CTX_use_PrivateKey_file(ctx, key.c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1)
+	{
+		SSL_CTX_free(ctx);
+		ERR_clear_error();
+		throw(std::runtime_error("tls: failed to load " + certificate + " and " + key));
+	}
+	if (this->ctx)
+		SSL_CTX_free(this->ctx);
+	this->ctx = ctx;
+}
+
+bool TlsContext::is_loaded() const
+{
+	return (this->ctx != NULL);
+}
+
+std::shared_ptr<TlsSession> TlsContext::accept(int fd) const
+{
+	SSL *ssl = SSL_new(this->ctx);
+	if (!ssl)
+		return (std::shared_ptr<TlsSession>());
+	if (SSL_set_fd(ssl, fd) != 1)
+	{
+		SSL_free(ssl);
+		return (std::shared_ptr<TlsSession>());
+	}
+	SSL_set_accept_state(ssl);
+	return (std::make_shared<TlsSession>(ssl));
+}
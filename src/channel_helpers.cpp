@@ -1,16 +1,19 @@
 #include "Channel.hpp"
 #include "Server.hpp"
 
-std::vector<Client *> Channel::get_clients() const
+std::vector<Client *> const &Channel::get_clients() const
 {
 	return (this->clients);
 }
 
 Client *Channel::get_client(std::string const &nickname)
 {
+	Symbol nick = Symbol::find(nickname);
+	if (nick.empty()) // nobody has that nickname
+		return (nullptr);
 	for (const auto &client : clients)
 	{
-		if (client->get_nickname() == nickname)
+		if (client->get_nick_symbol() == nick)
 			return (client);
 	}
 	return (nullptr);
@@ -18,12 +21,7 @@ Client *Channel::get_client(std::string const &nickname)
 
 Client *Channel::get_client(Client *client)
 {
-	for (const auto &c : clients)
-	{
-		if (c == client)
-			return (c);
-	}
-	return (nullptr);
+	return (this->slots.count(client) ? client : nullptr);
 }
 
 void Channel::add_client(Client *client)
@@ -34,6 +32,11 @@ void Channel::add_client(Client *client)
 		return;
 	}
 	this->clients.push_back(client);
+	if (client->get_link())
+		this->links[client->get_link()]++;
+	names_add(client);
+	fanout_add(client);
+	account();
 }
 
 void Channel::remove_client(std::string const &nickname)
@@ -44,9 +47,15 @@ void Channel::remove_client(std::string const &nickname)
 		std::cerr << "Client not in channel" << std::endl;
 		return;
 	}
+	names_remove(client);
+	fanout_remove(client);
+	this->ban_cache.erase(client);
+	if (client->get_link() && --this->links[client->get_link()] == 0)
+		this->links.erase(client->get_link());
 	this->clients.erase(std::remove(this->clients.begin(), this->clients.end(), client), this->clients.end());
 	remove_invite(client);
 	remove_op(client);
+	account();
 }
 void Channel::remove_client(Client *client)
 {
@@ -55,13 +64,24 @@ void Channel::remove_client(Client *client)
 		std::cerr << "Client not in channel" << std::endl;
 		return;
 	}
+	names_remove(client);
+	fanout_remove(client);
+	this->ban_cache.erase(client);
+	if (client->get_link() && --this->links[client->get_link()] == 0)
+		this->links.erase(client->get_link());
 	this->clients.erase(std::remove(this->clients.begin(), this->clients.end(), client), this->clients.end());
 	remove_invite(client);
 	remove_op(client);
+	account();
 }
 
 /// OPS ///
 
+std::map<Client *, size_t> const &Channel::get_links() const
+{
+	return (this->links);
+}
+
 std::vector<Client *> Channel::get_ops() const
 {
 	return (this->ops);
@@ -69,9 +89,12 @@ std::vector<Client *> Channel::get_ops() const
 
 Client *Channel::get_op(std::string const &nickname)
 {
+	Symbol nick = Symbol::find(nickname);
+	if (nick.empty())
+		return (nullptr);
 	for (const auto &op : ops)
 	{
-		if (op->get_nickname() == nickname)
+		if (op->get_nick_symbol() == nick)
 			return (op);
 	}
 	return (nullptr);
@@ -95,6 +118,7 @@ void Channel::add_op(Client *client)
 		return;
 	}
 	this->ops.push_back(client);
+	names_refresh(client);
 }
 
 void Channel::remove_op(std::string const &nickname)
@@ -106,6 +130,7 @@ void Channel::remove_op(std::string const &nickname)
 		return;
 	}
 	this->ops.erase(std::remove(this->ops.begin(), this->ops.end(), op), this->ops.end());
+	names_refresh(op);
 }
 
 void Channel::remove_op(Client *client)
@@ -116,15 +141,131 @@ void Channel::remove_op(Client *client)
 		return;
 	}
 	this->ops.erase(std::remove(this->ops.begin(), this->ops.end(), client), this->ops.end());
+	names_refresh(client);
+}
+
+/// NAMES ///
+
+// Room for the names in one RPL_NAMREPLY line of this channel
+size_t Channel::names_budget() const
+{
+	size_t overhead = std::string(": 353  @  :" CRLF).size() + NAMES_NICK_RESERVE + this->name.str().size();
+	return (overhead < NAMES_LINE_MAX ? NAMES_LINE_MAX - overhead : 0);
+}
+
+// Appending the member to the last chunk, or to a new one if it is full
+void Channel::names_add(Client *client)
+{
+	NameSlot slot;
+	slot.token = (get_op(client) ? "@" : "") + client->get_nickname();
+	if (this->names_chunks.empty() || this->names_chunks.back().size() + 1 + slot.token.size() > this->names_budget())
+		this->names_chunks.push_back(std::string());
+	std::string &chunk = this->names_chunks.back();
+	if (!chunk.empty())
+		chunk += ' ';
+	chunk += slot.token;
+	slot.chunk = this->names_chunks.size() - 1;
+	this->names_index[client] = slot;
+}
+
+// Cutting the member's token out of its chunk, chunks left empty are compacted once they pile up
+void Channel::names_remove(Client *client)
+{
+	auto it = this->names_index.find(client);
+	if (it == this->names_index.end())
+		return;
+	std::string &chunk = this->names_chunks[it->second.chunk];
+	std::string const &token = it->second.token;
+	size_t pos = 0;
+	while ((pos = chunk.find(token, pos)) != std::string::npos)
+	{
+		size_t end = pos + token.size();
+		if ((pos == 0 || chunk[pos - 1] == ' ') && (end == chunk.size() || chunk[end] == ' '))
+			break;
+		pos = end;
+	}
+	if (pos != std::string::npos && pos + token.size() < chunk.size())
+		chunk.erase(pos, token.size() + 1); // the token and the space after it
+	else if (pos != std::string::npos)
+		chunk.erase(pos > 0 ? pos - 1 : 0, token.size() + (pos > 0)); // last token, with the space before it
+	if (chunk.empty() && it->second.chunk + 1 != this->names_chunks.size())
+		this->names_empty_chunks++;
+	this->names_index.erase(it);
+	if (this->names_empty_chunks > this->names_chunks.size() / 2)
+		this->names_rebuild();
+}
+
+// Re-rendering a member whose nickname or op status changed
+void Channel::names_refresh(Client *client)
+{
+	if (this->names_index.find(client) == this->names_index.end())
+		return;
+	names_remove(client);
+	names_add(client);
+}
+
+void Channel::names_rebuild()
+{
+	this->names_chunks.clear();
+	this->names_index.clear();
+	this->names_empty_chunks = 0;
+	for (auto client : this->clients)
+		names_add(client);
+}
+
+/// FAN-OUT ///
+
+size_t Channel::slot_of(Client *client) const
+{
+	auto slot = this->slots.find(client);
+	return (slot == this->slots.end() ? NO_SLOT : slot->second);
+}
+
+void Channel::fanout_add(Client *client)
+{
+	this->slots[client] = this->fanout_fds.size();
+	this->fanout_fds.push_back(client->get_fd());
+	this->fanout_caps.push_back(client->get_caps());
+	this->fanout_members.push_back(client);
+}
+
+// Moving the last slot into the member's, the order of delivery doesn't matter
+void Channel::fanout_remove(Client *client)
+{
+	size_t slot = this->slot_of(client);
+	if (slot == NO_SLOT)
+		return;
+	size_t last = this->fanout_fds.size() - 1;
+	this->fanout_fds[slot] = this->fanout_fds[last];
+	this->fanout_caps[slot] = this->fanout_caps[last];
+	this->fanout_members[slot] = this->fanout_members[last];
+	this->slots[this->fanout_members[slot]] = slot;
+	this->fanout_fds.pop_back();
+	this->fanout_caps.pop_back();
+	this->fanout_members.pop_back();
+	this->slots.erase(client);
+}
+
+void Channel::fanout_rebuild()
+{
+	this->fanout_fds.clear();
+	this->fanout_caps.clear();
+	this->fanout_members.clear();
+	this->slots.clear();
+	for (auto client : this->clients)
+		fanout_add(client);
 }
 
 /// INVITES ///
 
 Client *Channel::get_invite(std::string const &nickname)
 {
+	Symbol nick = Symbol::find(nickname);
+	if (nick.empty())
+		return (nullptr);
 	for (const auto &invite : invite_list)
 	{
-		if (invite->get_nickname() == nickname)
+		if (invite->get_nick_symbol() == nick)
 			return (invite);
 	}
 	return (nullptr);
@@ -178,36 +319,64 @@ unsigned char Channel::get_modes()
 	return (this->modes);
 }
 
-std::string Channel::get_topic() const
+std::string const &Channel::get_topic() const
 {
 	return (this->topic_str);
 }
 
+time_t Channel::get_topic_time() const
+{
+	return (this->topic_time);
+}
+
+std::string Channel::get_key() const
+{
+	return (this->key);
+}
+
+unsigned int Channel::get_limit() const
+{
+	return (this->limit);
+}
+
+History const &Channel::get_history() const
+{
+	return (this->history);
+}
+
+void Channel::trim_history(size_t max_bytes)
+{
+	this->history.trim(max_bytes);
+}
+
 /// SETTERS ///
 
-void Channel::set_key(Client *commander, std::string const &key)
+// +k and -k, persisted by the MODE command once all its changes are in
+void Channel::set_key(std::string const &key)
 {
-	if (!get_op(commander))
-	{
-		std::cerr << "Client could not set key: not an op" << std::endl;
-		return;
-	}
 	this->key = key;
+	if (key.empty())
+		this->modes &= ~MODE_K;
+	else
+		this->modes |= MODE_K;
 }
 
 void Channel::set_topic(std::string topic)
 {
 	this->topic_str = topic;
+	this->topic_time = std::time(NULL);
+	server.persist(this);
+	account();
 }
 
-void Channel::set_limit(Client *commander, unsigned int limit)
+// +l and -l (0), persisted like the key
+void Channel::set_limit(unsigned int limit)
 {
-	if (!get_op(commander))
-	{
-		std::cerr << "Client could not set limit: not an op" << std::endl;
-		return;
-	}
 	this->limit = limit;
+	if (limit)
+		this->modes |= MODE_L;
+	else
+		this->modes &= ~MODE_L;
 }
 
 /// INVITE CHECK ///
@@ -216,8 +385,8 @@ bool Channel::invite_check(Client *client)
 {
 	if (this->modes & MODE_I) // if channel is invite only
 	{
-		if (get_invite(client) != nullptr)
-			return (true); // if client is in invite list
+		if (get_invite(client) != nullptr || this->invexes.match(client->get_hostmask()))
+			return (true); // if client is in invite list or matches an invite exception
 		return (false);	   // if client is not in invite list
 	}
 	return (true); // if channel is not invite only
@@ -245,54 +414,106 @@ bool Channel::limit_check()
 	return (true); // if channel has no user limit
 }
 
-/// MODES ///
+void Channel::broadcast(std::string const &message)
+{
+	this->broadcast(NULL, message);
+}
 
-void Channel::add_mode(char const &mode)
+void Channel::broadcast(Client *sender, std::string const &message)
 {
-	if (mode == 'i')
-		this->modes |= MODE_I;
-	else if (mode == 'k')
-		this->modes |= MODE_K;
-	else if (mode == 'l')
-		this->modes |= MODE_L;
-	else
-		std::cerr << "Unknown mode" << std::endl;
+	Variants variants(message, server.get_timestamp(), std::string(), std::string());
+	this->broadcast(sender, variants);
 }
 
-void Channel::remove_mode(char const &mode)
+// Sending to every member but the sender, in the variant of the member's capability class
+void Channel::broadcast(Client *sender, Variants &variants)
 {
-	if (mode == 'i')
-		this->modes &= ~MODE_I;
-	else if (mode == 'k')
-		this->modes &= ~MODE_K;
-	else if (mode == 'l')
-		this->modes &= ~MODE_L;
-	else
-		std::cerr << "Unknown mode" << std::endl;
+	size_t skip = this->slot_of(sender);
+	size_t count = this->fanout_fds.size();
+	int const *fds = this->fanout_fds.data();
+	unsigned char const *caps = this->fanout_caps.data();
+	for (size_t slot = 0; slot < count; slot++)
+	{
+		if (slot != skip)
+			server.transmit(fds[slot], variants.get(caps[slot]));
+	}
+}
+bool Channel::is_client_in_channel(std::string const &nickname)
+{
+	return (get_client(nickname) != nullptr);
 }
 
-void Channel::broadcast(std::string const &message)
+/// BANS ///
+
+MaskList *Channel::get_list(char const &mode)
 {
-	std::cout << "Broadcasting: " << message << std::endl;
-	server.send_response(rType::ChannelToClients, "P0INTL655", name, message);
+	if (mode == 'b')
+		return (&this->bans);
+	if (mode == 'e')
+		return (&this->excepts);
+	if (mode == 'I')
+		return (&this->invexes);
+	return (NULL);
 }
 
-void Channel::broadcast(Client *sender, std::string const &message)
+// Banned unless an exception matches too, cached for members until a list or their nick changes
+bool Channel::is_banned(Client *client)
 {
-	std::cout << "Broadcasting: " << message << std::endl;
-	server.send_response(rType::ClientToChannel, sender->get_nickname(), name, message);
+	auto it = this->ban_cache.find(client);
+	if (it != this->ban_cache.end())
+		return (it->second);
+	bool banned = false;
+	if (this->bans.size() > 0)
+	{
+		std::string hostmask = client->get_hostmask();
+		banned = this->bans.match(hostmask) && !this->excepts.match(hostmask);
+	}
+	if (get_client(client))
+		this->ban_cache[client] = banned;
+	return (banned);
 }
-bool Channel::is_client_in_channel(std::string const &nickname)
+
+bool Channel::is_op(Client *client)
+{
+	return (get_op(client) != nullptr);
+}
+
+std::string const &Channel::get_channel_name() const
+{
+	return (this->name.str());
+}
+
+ChannelId Channel::get_id() const
+{
+	return (this->id);
+}
+
+void Channel::set_id(ChannelId id)
 {
-	for (size_t i = 0; i < this->clients.size(); i++)
-		if (clients[i]->get_nickname() == nickname)
-			return (true);
-	return (false);
+	this->id = id;
 }
 
-std::string Channel::get_channel_name()
+// Approximate heap use of the channel, the history is accounted on its own
+size_t Channel::footprint() const
 {
-	return (this->name);
+	size_t bytes = sizeof(Channel) + this->name.str().size() + this->key.size() + this->topic_str.size();
+	bytes += (this->clients.size() + this->ops.size() + this->invite_list.size()) * sizeof(Client *);
+	bytes += this->names_index.size() * (sizeof(Client *) + sizeof(NameSlot) + CHANNEL_NODE_OVERHEAD);
+	bytes += this->ban_cache.size() * (sizeof(Client *) + CHANNEL_NODE_OVERHEAD);
+	bytes += this->fanout_fds.capacity() * sizeof(int) + this->fanout_caps.capacity() + this->fanout_members.capacity() * sizeof(Client *);
+	bytes += this->slots.size() * (sizeof(Client *) + sizeof(size_t) + CHANNEL_NODE_OVERHEAD);
+	for (auto &chunk : this->names_chunks)
+		bytes += chunk.capacity();
+	bytes += (this->bans.size() + this->excepts.size() + this->invexes.size()) * CHANNEL_MASK_FOOTPRINT;
+	return (bytes);
+}
+
+// Bringing the channel's share of the memory accounting up to date
+void Channel::account()
+{
+	size_t bytes = this->footprint();
+	Memory::add(MEM_CHANNELS, (long long)bytes - (long long)this->accounted);
+	this->accounted = bytes;
 }
 
 bool Channel::is_empty()
@@ -301,3 +522,78 @@ bool Channel::is_empty()
 		return true;
 	return false;
 }
+
+/// HOT UPGRADE ///
+
+static void save_list(Archive &out, std::vector<Client *> const &list, std::map<Client *, uint32_t> const &ids)
+{
+	std::vector<uint32_t> saved;
+	for (auto client : list)
+		if (ids.count(client)) // users of linked servers don't survive the upgrade
+			saved.push_back(ids.at(client));
+	out.put_u32(saved.size());
+	for (auto id : saved)
+		out.put_u32(id);
+}
+
+static std::vector<Client *> load_list(Reader &in, std::vector<Client *> const &clients)
+{
+	std::vector<Client *> list;
+	for (uint32_t n = in.get_u32(); n > 0; n--)
+	{
+		uint32_t id = in.get_u32();
+		if (id >= clients.size())
+			throw(std::runtime_error("invalid client id in state archive"));
+		list.push_back(clients[id]);
+	}
+	return (list);
+}
+
+// Saving the channel, members are referenced by their index in the handed over clients
+void Channel::save(Archive &out, std::map<Client *, uint32_t> const &ids) const
+{
+	out.put_str(this->name.str());
+	out.put_str(this->key);
+	out.put_str(this->topic_str);
+	out.put_u64(this->topic_time);
+	out.put_u8(this->modes);
+	out.put_u32(this->limit);
+	save_list(out, this->clients, ids);
+	save_list(out, this->ops, ids);
+	save_list(out, this->invite_list, ids);
+	this->history.save(out);
+	this->bans.save(out);
+	this->excepts.save(out);
+	this->invexes.save(out);
+}
+
+Channel *Channel::load(Reader &in, std::vector<Client *> const &clients, Server &server)
+{
+	Channel *channel = new Channel(in.get_str(), server);
+	try
+	{
+		channel->key = in.get_str();
+		channel->topic_str = in.get_str();
+		channel->topic_time = in.get_u64();
+		channel->modes = in.get_u8();
+		channel->limit = in.get_u32();
+		channel->clients = load_list(in, clients);
+		channel->ops = load_list(in, clients);
+		channel->invite_list = load_list(in, clients);
+		channel->history.load(in);
+		channel->bans.load(in);
+		channel->excepts.load(in);
+		channel->invexes.load(in);
+	}
+	catch (std::exception &e)
+	{
+		delete channel;
+		throw;
+	}
+	for (auto client : channel->clients)
+		client->add_channel(channel);
+	channel->names_rebuild();
+	channel->fanout_rebuild();
+	channel->account();
+	return (channel);
+}
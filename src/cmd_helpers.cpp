@@ -3,12 +3,18 @@
 // Checking if the nickname is used already
 bool Server::nickname_in_use(std::string &nickname)
 {
-	for (size_t i = 0; i < this->clients.size(); i++)
-	{
-		if (this->clients[i]->get_nickname() == nickname)
-			return true;
-	}
-	return false;
+	return (this->nicks.find(nickname) != this->nicks.end());
+}
+
+// Changing the nickname of a client and keeping the index in sync
+void Server::set_nickname(Client *client, std::string &nickname)
+{
+	auto it = this->nicks.find(client->get_nickname());
+	if (it != this->nicks.end() && it->second == client)
+		this->nicks.erase(it);
+	client->set_nickname(nickname);
+	if (!nickname.empty())
+		this->nicks[nickname] = client;
 }
 
 // Checking if the nickname is valid
@@ -17,6 +23,8 @@ bool Server::is_valid_nickname(std::string &nickname)
 
 	if (!nickname.empty() && (nickname[0] == '&' || nickname[0] == '#' || nickname[0] == ':'))
 		return false;
+	if (nickname.size() > NICKLEN) // the cached NAMES lines only leave room for that much
+		return false;
 	for (size_t i = 1; i < nickname.size(); i++)
 	{
 		if (!std::isalnum(nickname[i]) && nickname[i] != '_')
@@ -24,3 +32,15 @@ bool Server::is_valid_nickname(std::string &nickname)
 	}
 	return true;
 }
+
+// The welcome of a client that finished registering, with the features it can rely on
+void Server::welcome(Client *user)
+{
+	std::string classes[4]; // CHANMODES=A,B,C,D from the mode table
+	for (ModeSpec const &spec : MODE_TABLE)
+		if (spec.kind != MODE_MEMBER)
+			classes[spec.kind == MODE_LIST ? 0 : spec.kind - 1] += spec.letter;
+	std::string tokens = "CHANTYPES=# PREFIX=(o)@ CHANMODES=" + classes[0] + "," + classes[1] + "," + classes[2] + "," + classes[3] + " MODES=" + std::to_string(MODES_PER_LINE) + " EXCEPTS INVEX ELIST=MNTU NICKLEN=" + std::to_string(NICKLEN);
+	this->send_response(RPL_CONNECTED(user->get_nickname()), user->get_fd());
+	this->send_response(RPL_ISUPPORT(this->name, user->get_nickname(), tokens), user->get_fd());
+}
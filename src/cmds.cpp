@@ -1,6 +1,55 @@
 #include "Server.hpp"
 #include "Message.hpp"
 
+// CAP command: CAP LS [302], CAP LIST, CAP REQ :cap -cap, CAP END.
+// Registration is held from the first LS or REQ until END.
+void Server::cap(Message &cmd, int fd)
+{
+	Client *user = get_client(fd);
+	std::vector<std::string> params = cmd.getParams();
+	std::string nick = user->get_nickname().empty() ? "*" : user->get_nickname();
+	std::string sub = params.empty() ? "" : params[0];
+	std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+	if ((sub == "LS" || sub == "REQ") && !user->is_welcomed())
+		user->set_negotiating(true);
+	if (sub == "LS")
+		this->send_response(RPL_CAP(this->name, nick, "LS", capability_names(CAP_RENDERED | CAP_ECHO_MESSAGE)), fd);
+	else if (sub == "LIST")
+		this->send_response(RPL_CAP(this->name, nick, "LIST", capability_names(user->get_caps())), fd);
+	else if (sub == "REQ" && params.size() > 1)
+	{
+		// all or nothing: one unknown capability rejects the whole request
+		std::istringstream list(params[1][0] == ':' ? params[1].substr(1) : params[1]);
+		unsigned char caps = user->get_caps();
+		std::string token;
+		bool valid = true;
+		while (valid && list >> token)
+		{
+			bool remove = token[0] == '-';
+			unsigned char bit = capability_bit(remove ? token.substr(1) : token);
+			valid = bit != 0;
+			caps = remove ? caps & ~bit : caps | bit;
+		}
+		if (valid)
+		{
+			user->set_caps(caps);
+			for (auto &channel : user->get_channels())
+				channel->recap(user);
+		}
+		this->send_response(RPL_CAP(this->name, nick, (valid ? "ACK" : "NAK"), list.str()), fd);
+	}
+	else if (sub == "END")
+	{
+		if (!user->is_negotiating())
+			return;
+		user->set_negotiating(false);
+		if (user->is_welcomed() && !user->is_logged_in())
+			this->welcome(user);
+	}
+	else
+		this->send_response(ERR_INVALIDCAPCMD(this->name, nick, (sub.empty() ? "*" : sub)), fd);
+}
+
 // PASS command
 void Server::pass(std::string pass, int fd)
 {
@@ -33,7 +82,7 @@ void Server::nick(std::string nickname, int fd)
 	{
 		nick_in_use = "Changing to";
 		if (user->get_nickname().empty())
-			user->set_nickname(nick_in_use);
+			this->set_nickname(user, nick_in_use);
 		this->send_response(ERR_NICKINUSE(this->name, nickname), fd);
 		return;
 	}
@@ -47,29 +96,29 @@ void Server::nick(std::string nickname, int fd)
 		if (user && user->is_registered())
 		{
 			std::string old_nick = user->get_nickname();
-			user->set_nickname(nickname);
+			this->set_nickname(user, nickname);
+			for (auto &channel : user->get_channels())
+				channel->rename(user);
 			if (!old_nick.empty() && old_nick != nickname)
 			{
 				if (old_nick == nick_in_use && !user->get_username().empty())
 				{
 					user->set_logged_in(true);
-					this->send_response(RPL_CONNECTED(user->get_nickname()), fd);
+					this->welcome(user);
 					this->send_response(RPL_NICKCHANGE(old_nick, user->get_nickname()), fd);
 					return;
 				}
-				else if (!get_clients_channel(nickname).empty())
+				else if (!user->get_channels().empty())
 				{
-					std::vector<std::string> clients_channels = get_clients_channel(nickname);
-					for (auto it = clients_channels.begin(); it != clients_channels.end(); ++it)
-						this->channels[*it]->broadcast(RPL_NICKCHANGECHANNEL(old_nick, user->get_username(), user->get_IPaddr(), nickname));
+					this->send_common(user, RPL_NICKCHANGECHANNEL(old_nick, user->get_username(), user->get_host(), nickname), true);
 					return;
 				}
 				else
 					this->send_response(RPL_NICKCHANGE(old_nick, user->get_nickname()), fd);
 			}
 		}
-		if (user && user->is_registered() && !user->get_nickname().empty() && !user->get_username().empty() && user->get_nickname() != nick_in_use && !user->is_logged_in())
-				this->send_response(RPL_CONNECTED(user->get_nickname()), fd);
+		if (user && user->is_welcomed() && !user->is_logged_in())
+				this->welcome(user);
 	}
 }
 
@@ -94,11 +143,11 @@ void Server::username(std::vector<std::string> username, int fd)
 		std::string realname = username[3].substr(1);
 		user->set_realname(realname);
 	}
-	if (user && user->is_registered() && !user->get_nickname().empty() && !user->get_username().empty() && user->get_nickname() != "Changing to" && !user->is_logged_in())
-				this->send_response(RPL_CONNECTED(user->get_nickname()), fd);
+	if (user && user->is_welcomed() && !user->is_logged_in())
+				this->welcome(user);
 }
 
-// JOIN command
+// JOIN command: JOIN #a,#b,#c key1,key2
 void Server::join(Message &cmd, int fd)
 {
 	Client *user = get_client(fd);
@@ -114,65 +163,273 @@ void Server::join(Message &cmd, int fd)
 		this->send_response(ERR_NOTENOUGHPARAM(user->get_nickname()), fd);
 		return;
 	}
+	std::vector<std::string> names = split_list(cmd.getParams().front());
+	std::vector<std::string> keys;
+	if (cmd.getParams().size() > 1)
+		keys = split_list(cmd.getParams()[1]);
+	for (size_t i = 0; i < names.size(); i++)
+		this->join_channel(user, names[i], i < keys.size() ? keys[i] : NO_KEY);
+}
+
+void Server::join_channel(Client *user, std::string const &name, std::string const &key)
+{
+	// channels that existed before a restart are recreated from the snapshot on first join
+	ChannelRecord const *record = NULL;
+	Channel *channel = this->channels.find(name);
+	if (!channel && Memory::over_share(MEM_CHANNELS, MEMORY_CHANNELS_SHARE))
+	{
+		std::cerr << "Client could not join channel: channels over their memory share" << std::endl;
+		this->send_response(ERR_UNAVAILRESOURCE(this->name, user->get_nickname(), name), user->get_fd());
+		return;
+	}
+	if (!channel && (record = this->snapshot.find(name)))
+	{
+		Channel *restored = new Channel(std::string(record->name, strnlen(record->name, SNAPSHOT_NAME_LEN)), *record, *this);
+		this->channels.add(restored);
+		restored->join(user, key);
+		if (restored->is_empty()) // join refused, keep the record but not the channel
+		{
+			this->channels.remove(restored);
+			delete restored;
+		}
+		else
+			this->persist(restored); // +i may have been dropped
+	}
 	// check if channel exists and if not create it
-	if (channels.find(cmd.getParams().front()) == channels.end())
+	else if (!channel)
 	{
-		Channel *new_channel = new Channel(cmd.getParams().front(), user, *this);
-		channels.insert(std::pair<std::string, Channel *>(cmd.getParams().front(), new_channel));
+		Channel *new_channel = new Channel(name, user, *this);
+		this->channels.add(new_channel);
 		user->add_channel(new_channel);
+		this->persist(new_channel);
+		this->send_response(CLIENT(user->get_nickname(), user->get_username(), user->get_host()) + " JOIN " + name + CRLF, user->get_fd());
+		new_channel->names(user);
+		this->plugins.join(name, user->get_nickname());
 	}
 	else
 	{
 		// add user to the channel
-		if (cmd.getParams().size() > 1)
-			channels[cmd.getParams().front()]->join(user, cmd.getParams()[1]);
+		channel->join(user, key);
+	}
+}
+
+// NAMES command: NAMES #a,#b
+void Server::names(Message &cmd, int fd)
+{
+	Client *user = get_client(fd);
+	if (!user->is_registered())
+	{
+		this->send_response(ERR_NOTREGISTERED(this->get_name()), fd);
+		return;
+	}
+	if (cmd.getParams().size() == 0)
+	{
+		this->send_response(RPL_ENDOFNAMES(user->get_nickname(), std::string("*")), fd);
+		return;
+	}
+	std::vector<std::string> names = split_list(cmd.getParams().front());
+	for (auto &name : names)
+	{
+		Channel *channel = this->channels.find(name);
+		if (!channel)
+			this->send_response(RPL_ENDOFNAMES(user->get_nickname(), name), fd);
 		else
-			channels[cmd.getParams().front()]->join(user, NO_KEY);
+			channel->names(user);
 	}
 }
 
-void Server::quit(int fd)
+// The conditions of a LIST (ELIST=MNTU): name masks, `!mask` to leave out,
+// `>n`/`<n` members and `T>n`/`T<n` minutes since the topic was set
+struct ListFilter
 {
-	std::cout << RED << "Client <" << fd << "> Disconnected" << WHITE << std::endl;
-	Client *client = get_client(fd);
-	if (client->get_channels().size() > 0)
+	std::vector<Mask> masks;
+	std::vector<Mask> excluded;
+	long min_users;		 // more than this
+	size_t max_users;	 // fewer than this
+	time_t topic_before; // topic set before this time, 0 for any
+	time_t topic_after;	 // topic set after this time, 0 for any
+
+	ListFilter(std::vector<std::string> const &items)
+		: min_users(-1), max_users(SIZE_MAX), topic_before(0), topic_after(0)
 	{
-		for (auto &channel : client->get_channels())
+		time_t now = std::time(NULL);
+		for (auto &item : items)
 		{
-			channel->quit(client);
+			if (item[0] == '>' || item[0] == '<')
+			{
+				unsigned long n = std::strtoul(item.c_str() + 1, NULL, 10);
+				if (item[0] == '>')
+					this->min_users = n;
+				else
+					this->max_users = n;
+			}
+			else if ((item[0] == 'T' || item[0] == 't') && (item[1] == '>' || item[1] == '<'))
+			{
+				time_t at = now - std::strtol(item.c_str() + 2, NULL, 10) * 60;
+				if (item[1] == '>')
+					this->topic_before = at;
+				else
+					this->topic_after = at;
+			}
+			else if (item[0] == '!')
+				this->excluded.push_back(Mask(item.substr(1)));
+			else
+				this->masks.push_back(Mask(item));
 		}
 	}
-	this->remove_client(fd);
-	close(fd);
+
+	// True if every mask is a plain channel name, they are then looked up instead of scanned for
+	bool is_literal() const
+	{
+		for (auto &mask : this->masks)
+			if (mask.has_wildcards())
+				return (false);
+		return (!this->masks.empty());
+	}
+
+	bool match(Channel *channel) const
+	{
+		size_t users = channel->get_clients().size();
+		if ((long)users <= this->min_users || users >= this->max_users)
+			return (false);
+		if (this->topic_before || this->topic_after)
+		{
+			if (channel->get_topic().empty() || (this->topic_before && channel->get_topic_time() >= this->topic_before) ||
+				(this->topic_after && channel->get_topic_time() <= this->topic_after))
+				return (false);
+		}
+		bool listed = this->masks.empty();
+		for (auto &mask : this->masks)
+			listed = listed || mask.match(channel->get_channel_name());
+		for (auto &mask : this->excluded)
+			listed = listed && !mask.match(channel->get_channel_name());
+		return (listed);
+	}
+};
+
+// The topic as RPL_LIST wants it, TOPIC keeps the ':' of its trailing parameter
+static std::string list_topic(Channel *channel)
+{
+	std::string const &topic = channel->get_topic();
+	return (topic[0] == ':' ? topic.substr(1) : topic);
 }
 
-void Server::quit(Message &cmd, int fd)
+// LIST command: LIST [#a,#b] or LIST with ELIST conditions, e.g. LIST >10,#linux*,!*-off,T<60
+void Server::list(Message &cmd, int fd)
 {
-	std::cout << RED << "Client <" << fd << "> Disconnected" << WHITE << std::endl;
-	Client *client = get_client(fd);
-	if (client->get_channels().size() > 0)
+	Client *user = get_client(fd);
+	if (!user->is_registered())
 	{
-		if (cmd.getParams().size() > 0 && cmd.getParams()[0][0] == ':')
+		this->send_response(ERR_NOTREGISTERED(this->get_name()), fd);
+		return;
+	}
+	ListFilter filter(cmd.getParams().empty() ? std::vector<std::string>() : split_list(cmd.getParams()[0]));
+	if (filter.is_literal())
+	{
+		for (auto &mask : filter.masks)
 		{
-			std::string msg(cmd.getParams().front());
-			for (auto &channel : client->get_channels())
-			{
-				channel->quit(client, msg);
-			}
+			Channel *channel = this->channels.find(mask.get_mask());
+			if (channel && filter.match(channel))
+				this->send_response(RPL_LIST(this->name, user->get_nickname(), channel->get_channel_name(), std::to_string(channel->get_clients().size()), list_topic(channel)), fd);
 		}
-		else
+		this->send_response(RPL_LISTEND(this->name, user->get_nickname()), fd);
+		return;
+	}
+	// walking the registry's slots, a bounded number per loop iteration, the output paced
+	// by the client's send queue. Channels created or removed meanwhile may be missed.
+	size_t next = 0;
+	user->add_stream([this, user, filter, next](size_t budget) mutable {
+		for (size_t scanned = 0; next < this->channels.slot_count() && budget > 0 && scanned < LIST_SCAN_PER_TICK; scanned++)
 		{
-			for (auto &channel : client->get_channels())
+			Channel *channel = this->channels.at(next++);
+			if (channel && filter.match(channel))
 			{
-				channel->quit(client);
+				user->defer(RPL_LIST(this->name, user->get_nickname(), channel->get_channel_name(), std::to_string(channel->get_clients().size()), list_topic(channel)));
+				budget--;
 			}
 		}
+		if (next < this->channels.slot_count())
+			return (true);
+		user->defer(RPL_LISTEND(this->name, user->get_nickname()));
+		return (false);
+	});
+}
+
+// One RPL_WHOREPLY line, channel is NULL for a WHO that is not about a channel
+std::string Server::who_reply(Client *user, Client *target, Channel *channel)
+{
+	std::string flags = (channel && channel->is_op(target)) ? "H@" : "H";
+	return (RPL_WHOREPLY(this->name, user->get_nickname(), (channel ? channel->get_channel_name() : std::string("*")),
+						 target->get_username(), target->get_host(), target->get_nickname(), flags, target->get_realname()));
+}
+
+// WHO command: WHO #channel, WHO nick or WHO mask (e.g. *!*@10.0.*)
+void Server::who(Message &cmd, int fd)
+{
+	Client *user = get_client(fd);
+	if (!user->is_registered())
+	{
+		this->send_response(ERR_NOTREGISTERED(this->get_name()), fd);
+		return;
+	}
+	std::string mask = cmd.getParams().empty() || cmd.getParams()[0] == "0" ? "*" : cmd.getParams()[0];
+	Mask compiled(mask);
+	if (mask[0] == '#')
+	{
+		// walking the member list, resumed by index across loop iterations
+		size_t next = 0;
+		Channel *found = this->channels.find(mask);
+		ChannelId id = found ? found->get_id() : NO_CHANNEL;
+		user->add_stream([this, user, mask, id, next](size_t budget) mutable {
+			Channel *channel = this->channels.get(id); // NULL once the channel is gone
+			if (channel)
+			{
+				std::vector<Client *> const &members = channel->get_clients();
+				for (; next < members.size() && budget > 0; next++, budget--)
+					user->defer(this->who_reply(user, members[next], channel));
+				if (next < members.size())
+					return (true);
+			}
+			user->defer(RPL_ENDOFWHO(this->name, user->get_nickname(), mask));
+			return (false);
+		});
+	}
+	else if (!compiled.has_wildcards())
+	{
+		Client *target = this->get_client(mask);
+		if (target)
+			this->send_response(this->who_reply(user, target, NULL), fd);
+		this->send_response(RPL_ENDOFWHO(this->name, user->get_nickname(), mask), fd);
+	}
+	else
+	{
+		// matching every client, with a bounded number looked at per loop iteration
+		bool full = mask.find_first_of("!@") != std::string::npos;
+		size_t next = 0;
+		user->add_stream([this, user, mask, compiled, full, next](size_t budget) mutable {
+			for (size_t scanned = 0; next < this->clients.size() && budget > 0 && scanned < WHO_SCAN_PER_TICK; scanned++)
+			{
+				Client *target = this->clients[next++];
+				if (target->get_nickname().empty())
+					continue;
+				bool match = full ? compiled.match(target->get_nickname() + "!~" + target->get_username() + "@" + target->get_host())
+								  : compiled.match(target->get_nickname()) || compiled.match(target->get_host()) || compiled.match(target->get_IPaddr()) || compiled.match(target->get_realname());
+				if (match)
+				{
+					user->defer(this->who_reply(user, target, NULL));
+					budget--;
+				}
+			}
+			if (next < this->clients.size())
+				return (true);
+			user->defer(RPL_ENDOFWHO(this->name, user->get_nickname(), mask));
+			return (false);
+		});
 	}
-	this->remove_client(fd);
-	close(fd);
 }
 
-void Server::privmsg(Message &cmd, int fd)
+// WHOIS command: WHOIS nick1,nick2 or WHOIS server nick
+void Server::whois(Message &cmd, int fd)
 {
 	Client *user = get_client(fd);
 	if (!user->is_registered())
@@ -180,36 +437,147 @@ void Server::privmsg(Message &cmd, int fd)
 		this->send_response(ERR_NOTREGISTERED(this->get_name()), fd);
 		return;
 	}
-	if (cmd.getParams().size() < 2)
+	if (cmd.getParams().empty())
 	{
-		this->send_response(ERR_NOTENOUGHPARAM(user->get_nickname()), fd);
+		this->send_response(ERR_NEEDMOREPARAMS(user->get_nickname(), std::string("WHOIS")), fd);
 		return;
 	}
-	if (cmd.getParams().front()[0] == '#') // if the first parameter is a channel
+	std::vector<std::string> nicks = split_list(cmd.getParams().back());
+	for (auto &nick : nicks)
 	{
-		if (channels.find(cmd.getParams().front()) == channels.end())
+		Client *target = this->get_client(nick);
+		if (target == NULL)
+			this->send_response(ERR_NOSUCHNICK(nick), fd);
+		else
 		{
-			this->send_response(ERR_NOSUCHCHANNEL(cmd.getParams().front()), fd);
-			return;
+			std::string list;
+			for (auto &channel : target->get_channels())
+				list += (list.empty() ? "" : " ") + std::string(channel->is_op(target) ? "@" : "") + channel->get_channel_name();
+			this->send_response(RPL_WHOISUSER(this->name, user->get_nickname(), target->get_nickname(), target->get_username(), target->get_host(), target->get_realname()), fd);
+			if (!list.empty())
+				this->send_response(RPL_WHOISCHANNELS(this->name, user->get_nickname(), target->get_nickname(), list), fd);
+			this->send_response(RPL_WHOISSERVER(this->name, user->get_nickname(), target->get_nickname(), (target->is_remote() ? target->get_server() : this->name)), fd);
+			if (target->get_tls())
+				this->send_response(RPL_WHOISSECURE(this->name, user->get_nickname(), target->get_nickname()), fd);
 		}
+		this->send_response(RPL_ENDOFWHOIS(this->name, user->get_nickname(), nick), fd);
+	}
+}
+
+// PART command: PART #a,#b [:reason]
+void Server::part(Message &cmd, int fd)
+{
+	Client *user = get_client(fd);
+	if (!user->is_registered())
+	{
+		this->send_response(ERR_NOTREGISTERED(this->get_name()), fd);
+		return;
+	}
+	if (cmd.getParams().size() == 0)
+	{
+		this->send_response(ERR_NOTENOUGHPARAM(user->get_nickname()), fd);
+		return;
+	}
+	std::string reason = cmd.getParams().size() > 1 ? cmd.getParams()[1] : "";
+	std::vector<std::string> names = split_list(cmd.getParams().front());
+	for (auto &name : names)
+	{
+		Channel *channel = this->channels.find(name);
+		if (!channel)
+			this->send_response(ERR_NOSUCHCHANNEL(name), fd);
 		else
-			channels[cmd.getParams().front()]->message(user, cmd.getParams()[1]);
+			channel->part(user, reason);
 	}
+}
+
+void Server::quit(int fd)
+{
+	Client *client = get_client(fd);
+	if (!client) // quit already this iteration
+		return;
+	std::cout << RED << "Client <" << fd << "> Disconnected" << WHITE << std::endl;
+	if (client->is_server_link())
+		this->split_link(client);
+	else if (client->is_introduced())
+		this->send_links(":" + client->get_nickname() + " QUIT :Connection closed" CRLF, NULL);
+	this->quit_channels(client, "");
+	this->remove_client(fd);
+}
+
+// Closing a connection the server gave up on, the reason is shown to the channels
+void Server::quit(int fd, std::string const &reason)
+{
+	Client *client = get_client(fd);
+	if (!client)
+		return;
+	std::cout << RED << "Client <" << fd << "> Dropped: " << reason << WHITE << std::endl;
+	std::string msg = ":" + reason;
+	if (client->is_server_link())
+		this->split_link(client);
+	else if (client->is_introduced())
+		this->send_links(":" + client->get_nickname() + " QUIT " + msg + CRLF, NULL);
+	this->quit_channels(client, msg);
+	this->remove_client(fd);
+}
+
+void Server::quit(Message &cmd, int fd)
+{
+	std::cout << RED << "Client <" << fd << "> Disconnected" << WHITE << std::endl;
+	Client *client = get_client(fd);
+	if (cmd.getParams().size() > 0 && cmd.getParams()[0][0] == ':')
+		this->quit_channels(client, cmd.getParams().front());
 	else
+		this->quit_channels(client, "");
+	this->remove_client(fd);
+}
+
+// PRIVMSG command: PRIVMSG nick,#channel :text
+void Server::privmsg(Message &cmd, int fd)
+{
+	Client *user = get_client(fd);
+	if (!user->is_registered())
+	{
+		this->send_response(ERR_NOTREGISTERED(this->get_name()), fd);
+		return;
+	}
+	if (cmd.getParams().size() < 2)
+	{
+		this->send_response(ERR_NOTENOUGHPARAM(user->get_nickname()), fd);
+		return;
+	}
+	std::string text = cmd.getParams()[1];
+	std::string source = CLIENT(user->get_nickname(), user->get_username(), user->get_host()); // formatted once for all targets
+	std::vector<std::string> targets = split_list(cmd.getParams().front());
+	for (size_t i = 0; i < targets.size(); i++)
 	{
-		if (get_client(cmd.getParams().front()) == NULL)
+		std::string const &target = targets[i];
+		if (std::find(targets.begin(), targets.begin() + i, target) != targets.begin() + i)
+			continue; // each target gets the message once
+		if (target[0] == '#') // if the target is a channel
 		{
-			this->send_response(ERR_NOSUCHNICK(user->get_nickname()), fd);
-			return;
+			Channel *channel = this->channels.find(target);
+			if (!channel)
+				this->send_response(ERR_NOSUCHCHANNEL(target), fd);
+			else
+				channel->message(user, source, text);
 		}
 		else
 		{
-			Client *recipient = get_client(cmd.getParams().front());
-			this->send_response(RPL_PRIVMSG(CLIENT(user->get_nickname(), user->get_username(), user->get_IPaddr()), recipient->get_nickname(), cmd.getParams()[1]), recipient->get_fd());
+			Client *recipient = get_client(target);
+			if (recipient == NULL)
+				this->send_response(ERR_NOSUCHNICK(target), fd);
+			else
+			{
+				Variants variants(RPL_PRIVMSG(source, recipient->get_nickname(), text), this->get_timestamp(), std::string(), std::string());
+				this->send_response(variants.get(recipient->get_caps()), recipient->get_fd());
+				if (user->has_cap(CAP_ECHO_MESSAGE))
+					this->transmit(fd, variants.get(user->get_caps()));
+			}
 		}
 	}
 }
 
+// MODE command: MODE #a, MODE #a +ikl-o key 50 nick, MODE #a b
 void Server::mode(Message &cmd, int fd)
 {
 	Client *user = get_client(fd);
@@ -218,38 +586,75 @@ void Server::mode(Message &cmd, int fd)
 		this->send_response(ERR_NOTREGISTERED(this->get_name()), fd);
 		return;
 	}
-	if (cmd.getParams().size() < 2)
+	std::vector<std::string> params = cmd.getParams();
+	if (params.empty())
 	{
 		this->send_response(ERR_NOTENOUGHPARAM(user->get_nickname()), fd);
 		return;
 	}
-	if (cmd.getParams().front()[0] == '#')
+	if (params.front()[0] != '#') // no user modes
+		return;
+	Channel *channel = this->channels.find(params.front());
+	if (!channel)
+	{
+		this->send_response(ERR_NOSUCHCHANNEL(params.front()), fd);
+		return;
+	}
+	if (params.size() == 1)
 	{
-		// Channel mode
-		if (channels.find(cmd.getParams().front()) == channels.end())
+		channel->show_modes(user);
+		return;
+	}
+	if (params.back()[0] == ':')
+		params.back().erase(0, 1);
+	// the whole mode string is checked against the table before anything changes
+	std::vector<ModeChange> changes;
+	std::string shown; // lists already sent, MODE #a bb sends it once
+	size_t next = 2;	// the next parameter to consume
+	bool adding = true;
+	for (char letter : params[1])
+	{
+		if (letter == '+' || letter == '-')
 		{
-			this->send_response(ERR_NOSUCHCHANNEL(cmd.getParams().front()), fd);
-			return;
+			adding = letter == '+';
+			continue;
 		}
-		else
+		ModeSpec const *spec = find_mode(letter);
+		if (!spec)
 		{
-			std::string mode = cmd.getParams()[1];
-			if (cmd.getParams()[1][0] == '+')
-			{
-				if (cmd.getParams()[1][1] == 'o')
-					channels[cmd.getParams().front()]->op(user, ADD, cmd.getParams()[2]);
-				else
-					channels[cmd.getParams().front()]->mode(user, ADD, cmd.getParams()[1][1]);
-			}
-			else if (cmd.getParams()[1][0] == '-')
-			{
-				if (cmd.getParams()[1][1] == 'o')
-					channels[cmd.getParams().front()]->op(user, REMOVE, cmd.getParams()[2]);
-				else
-					channels[cmd.getParams().front()]->mode(user, REMOVE, cmd.getParams()[1][1]);
-			}
+			this->send_response(ERR_UNKNOWNMODE(this->name, user->get_nickname(), std::string(1, letter)), fd);
+			continue;
+		}
+		if (spec->kind == MODE_LIST && next >= params.size())
+		{
+			if (shown.find(letter) == std::string::npos)
+				channel->show_list(user, letter);
+			shown += letter;
+			continue;
+		}
+		ModeChange change = {adding, spec, std::string()};
+		if (takes_param(*spec, adding) && next < params.size())
+			change.param = params[next++];
+		else if (takes_param(*spec, adding) && (spec->kind != MODE_ALWAYS || adding))
+		{
+			this->send_response(ERR_NEEDMOREPARAMS(user->get_nickname(), std::string("MODE")), fd);
+			continue;
 		}
+		bool valid = true;
+		if (spec->kind == MODE_ALWAYS && adding) // a key: one word that fits in a JOIN
+			valid = !change.param.empty() && change.param.size() <= CHANNEL_KEY_MAX && change.param[0] != ':' && change.param.find_first_of(", ") == std::string::npos;
+		else if (spec->kind == MODE_SET && adding) // a limit
+			valid = !change.param.empty() && change.param.size() <= 9 && change.param.find_first_not_of("0123456789") == std::string::npos && std::stoul(change.param) > 0;
+		else if (spec->kind == MODE_LIST)
+			valid = !change.param.empty() && change.param[0] != ':';
+		if (!valid)
+		{
+			this->send_response(ERR_INVALIDMODEPARAM(this->name, user->get_nickname(), channel->get_channel_name(), std::string(1, letter), change.param), fd);
+			continue;
+		}
+		changes.push_back(change);
 	}
+	channel->mode(user, changes);
 }
 
 void Server::invite(Message &cmd, int fd)
@@ -265,12 +670,13 @@ void Server::invite(Message &cmd, int fd)
 		this->send_response(ERR_NOTENOUGHPARAM(user->get_nickname()), fd);
 		return;
 	}
-	if (channels.find(cmd.getParams()[1]) == channels.end())
+	Channel *channel = this->channels.find(cmd.getParams()[1]);
+	if (!channel)
 	{
 		this->send_response(ERR_NOSUCHCHANNEL(cmd.getParams().front()), fd);
 		return;
 	}
-	channels[cmd.getParams()[1]]->invite(user, cmd.getParams()[0]);
+	channel->invite(user, cmd.getParams()[0]);
 }
 
 void Server::topic(Message &cmd, int fd)
@@ -286,22 +692,24 @@ void Server::topic(Message &cmd, int fd)
 		this->send_response(ERR_NOTENOUGHPARAM(user->get_nickname()), fd);
 		return;
 	}
-	if (channels.find(cmd.getParams().front()) == channels.end())
+	Channel *channel = this->channels.find(cmd.getParams().front());
+	if (!channel)
 	{
 		this->send_response(ERR_NOSUCHCHANNEL(cmd.getParams().front()), fd);
 		return;
 	}
 	if (cmd.getParams().size() == 1)
-		channels[cmd.getParams().front()]->topic(user);
+		channel->topic(user);
 	else
 	{
 		if (cmd.getParams()[1].size() == 1)
-			channels[cmd.getParams().front()]->topic(user, REMOVE, cmd.getParams()[1]);
+			channel->topic(user, REMOVE, cmd.getParams()[1]);
 		else
-			channels[cmd.getParams().front()]->topic(user, ADD, cmd.getParams()[1]);
+			channel->topic(user, ADD, cmd.getParams()[1]);
 	}
 }
 
+// KICK command: KICK #channel nick1,nick2 [:reason] or KICK #a,#b nick1,nick2 [:reason]
 void Server::kick(Message &cmd, int fd)
 {
 	Client *user = get_client(fd);
@@ -315,21 +723,115 @@ void Server::kick(Message &cmd, int fd)
 		this->send_response(ERR_NOTENOUGHPARAM(user->get_nickname()), fd);
 		return;
 	}
-	if (channels.find(cmd.getParams().front()) == channels.end())
+	std::vector<std::string> names = split_list(cmd.getParams()[0]);
+	std::vector<std::string> nicks = split_list(cmd.getParams()[1]);
+	if (names.empty() || nicks.empty() || (names.size() != 1 && names.size() != nicks.size()))
 	{
-		this->send_response(ERR_NOSUCHCHANNEL(cmd.getParams().front()), fd);
+		this->send_response(ERR_NEEDMOREPARAMS(user->get_nickname(), std::string("KICK")), fd);
+		return;
+	}
+	for (size_t i = 0; i < nicks.size(); i++)
+	{
+		std::string const &name = names.size() == 1 ? names[0] : names[i];
+		Channel *channel = this->channels.find(name);
+		if (!channel)
+		{
+			this->send_response(ERR_NOSUCHCHANNEL(name), fd);
+			continue;
+		}
+		// the channel removes itself once the last member is kicked
+		if (cmd.getParams().size() > 2)
+			channel->kick(user, nicks[i], cmd.getParams()[2]);
+		else
+			channel->kick(user, nicks[i]);
+	}
+}
+
+// CHATHISTORY command: CHATHISTORY <LATEST|BEFORE|AFTER> <#channel> <*|msgid=id|timestamp=ts> <limit>
+void Server::chathistory(Message &cmd, int fd)
+{
+	Client *user = get_client(fd);
+	if (!user->is_registered())
+	{
+		this->send_response(ERR_NOTREGISTERED(this->get_name()), fd);
 		return;
 	}
-	Channel *kick_ch = channels[cmd.getParams().front()];
-	if (cmd.getParams().size() > 2)
+	std::vector<std::string> params = cmd.getParams();
+	if (params.size() < 4)
 	{
-		channels[cmd.getParams().front()]->kick(user, cmd.getParams()[1], cmd.getParams()[2]);
+		this->send_response(FAIL_CHATHISTORY("NEED_MORE_PARAMS", "*", "Missing parameters"), fd);
+		return;
 	}
+	std::string const &sub = params[0];
+	if (sub != "LATEST" && sub != "BEFORE" && sub != "AFTER")
+	{
+		this->send_response(FAIL_CHATHISTORY("INVALID_PARAMS", sub, "Unknown subcommand"), fd);
+		return;
+	}
+	Channel *channel = this->channels.find(params[1]);
+	if (!channel || !channel->is_client_in_channel(user->get_nickname()))
+	{
+		this->send_response(FAIL_CHATHISTORY("INVALID_TARGET", sub + " " + params[1], "No history for that target"), fd);
+		return;
+	}
+	History const &history = channel->get_history();
+	size_t limit = 0;
+	try
+	{
+		limit = std::min<size_t>(std::stoul(params[3]), HISTORY_MAX_QUERY);
+	}
+	catch (std::exception &e)
+	{
+		this->send_response(FAIL_CHATHISTORY("INVALID_PARAMS", sub, "Invalid limit"), fd);
+		return;
+	}
+	// resolving the reference into a msgid bound, depending on the direction of the query
+	std::string const &ref = params[2];
+	unsigned long long bound = 0;
+	if (ref.compare(0, 6, "msgid=") == 0)
+	{
+		bound = this->parse_msgid(ref.substr(6));
+		if (bound == 0)
+		{
+			this->send_response(FAIL_CHATHISTORY("INVALID_MSGREFID", sub + " " + ref.substr(6), "Unknown message id"), fd);
+			return;
+		}
+	}
+	else if (ref.compare(0, 10, "timestamp=") == 0)
+	{
+		long long time = History::parse_timestamp(ref.substr(10));
+		if (time < 0)
+		{
+			this->send_response(FAIL_CHATHISTORY("INVALID_PARAMS", sub, "Invalid timestamp"), fd);
+			return;
+		}
+		bound = (sub == "BEFORE") ? history.first_at_or_after(time) : history.last_at_or_before(time);
+	}
+	else if (ref != "*" || sub != "LATEST")
+	{
+		this->send_response(FAIL_CHATHISTORY("INVALID_PARAMS", sub, "Invalid message reference"), fd);
+		return;
+	}
+	std::vector<HistoryEntry const *> entries;
+	if (sub == "BEFORE")
+		entries = history.before(bound, limit);
+	else if (sub == "AFTER")
+		entries = history.after(bound, limit);
+	else if (ref == "*")
+		entries = history.latest(limit);
 	else
 	{
-		channels[cmd.getParams().front()]->kick(user, cmd.getParams()[1]);
+		entries = history.after(bound, HISTORY_MAX_LINES);
+		if (entries.size() > limit)
+			entries.erase(entries.begin(), entries.end() - limit);
+	}
+	// playback is paced out by the event loop instead of being sent in one burst,
+	// tagged with the time and msgid the messages were first sent with
+	for (auto entry : entries)
+	{
+		if ((user->get_caps() & CAP_RENDERED) == 0)
+			user->defer(entry->line);
+		else
+			user->defer(Variants(entry->line, History::format_timestamp(entry->time), this->format_msgid(entry->msgid), std::string()).get(user->get_caps()));
 	}
-	this->get_client(cmd.getParams()[1])->remove_channel(kick_ch);
-	if (this->channels[cmd.getParams().front()]->is_empty())
-		this->remove_channel(this->channels[cmd.getParams().front()]);
 }
@@ -0,0 +1,497 @@
+#include "Server.hpp"
+#include "Message.hpp"
+#include <fstream>
+#include <netdb.h>
+#include <set>
+#include <algorithm>
+
+// Reading the links file:
+//   server <our name>
+//   link <name> <host> <port> <password> [autoconnect]
+//   tls <port> <certificate file> <key file>
+//   listen <address|*> <port> [options] or listen unix <path> [options], options being
+//     tls nodelay rcvbuf=<bytes> sndbuf=<bytes> defer_accept=<seconds> busy_poll=<microseconds>
+//   plugin <shared object> [budget in microseconds]
+void Server::load_links(std::string const &path)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+		throw(std::runtime_error("failed to open the links file " + path));
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream input(line);
+		std::string keyword;
+		if (!(input >> keyword) || keyword[0] == '#')
+			continue;
+		if (keyword == "server" && input >> this->name)
+			continue;
+		std::string certificate, key;
+		int tls_port;
+		if (keyword == "tls" && input >> tls_port >> certificate >> key)
+		{
+			if (tls_port < 1024 || tls_port > 65535 || tls_port == this->port)
+				throw(std::runtime_error("invalid TLS port in the links file: " + line));
+			this->tls.load(certificate, key);
+			this->add_listener(Listener("*", tls_port, true));
+			continue;
+		}
+		std::string address, where, option;
+		if (keyword == "listen" && input >> address >> where)
+		{
+			int listen_port = address == "unix" ? 0 : std::atoi(where.c_str());
+			if (address != "unix" && (listen_port < 1024 || listen_port > 65535 || where.find_first_not_of("0123456789") != std::string::npos))
+				throw(std::runtime_error("invalid port in the links file: " + line));
+			Listener listener(address == "unix" ? where : address, listen_port, false);
+			while (input >> option)
+				if (!listener.set_option(option))
+					throw(std::runtime_error("invalid listen option " + option + " in the links file: " + line));
+			this->add_listener(listener);
+			continue;
+		}
+		std::string plugin;
+		if (keyword == "plugin" && input >> plugin)
+		{
+			long budget = PLUGIN_BUDGET_US;
+			if (!(input >> budget))
+				budget = PLUGIN_BUDGET_US;
+			this->plugins.load(plugin, budget);
+			continue;
+		}
+		AdmissionLimits limits;
+		if (keyword == "admission")
+		{
+			if (!(input >> limits.address_open >> limits.prefix_open >> limits.address_rate >> limits.prefix_rate))
+				throw(std::runtime_error("invalid admission limits in the links file: " + line));
+			this->admission.set_limits(limits);
+			continue;
+		}
+		LinkBlock block;
+		std::string flag;
+		if (keyword != "link" || !(input >> block.name >> block.host >> block.port >> block.password))
+			throw(std::runtime_error("invalid line in the links file: " + line));
+		block.autoconnect = (input >> flag) && flag == "autoconnect";
+		block.resolving = false;
+		this->link_blocks.push_back(block);
+	}
+	for (auto &listener : this->listeners)
+		if (listener.is_tls() && !this->tls.is_loaded())
+			throw(std::runtime_error("the listener " + listener.get_name() + " needs a tls line in the links file"));
+	std::cout << GREEN << "Server name " << this->name << ", " << this->link_blocks.size() << " link(s) configured" << WHITE << std::endl;
+}
+
+void Server::set_links_file(std::string const &path)
+{
+	this->links_file = path;
+}
+
+LinkBlock const *Server::find_link_block(std::string const &name) const
+{
+	for (auto &block : this->link_blocks)
+		if (block.name == name)
+			return (&block);
+	return (NULL);
+}
+
+// Opening the autoconnect links that are down, at most once every LINK_RETRY seconds.
+// The host is looked up by the resolver and the connect() completes in the loop.
+void Server::connect_links()
+{
+	for (auto it = this->connecting.begin(); it != this->connecting.end();)
+	{
+		if (std::time(NULL) - it->second.started < LINK_CONNECT_TIMEOUT)
+		{
+			++it;
+			continue;
+		}
+		std::cerr << "Link " << it->second.name << ": connect() timed out" << std::endl;
+		close(it->first);
+		it = this->connecting.erase(it);
+	}
+	if (std::time(NULL) - this->last_link_attempt < LINK_RETRY)
+		return;
+	this->last_link_attempt = std::time(NULL);
+	for (auto &block : this->link_blocks)
+	{
+		if (!block.autoconnect || block.resolving || this->network.count(block.name))
+			continue;
+		bool pending = false;
+		for (auto client : this->clients)
+			if (!client->is_remote() && client->get_server() == block.name)
+				pending = true;
+		for (auto &connect : this->connecting)
+			if (connect.second.name == block.name)
+				pending = true;
+		if (pending)
+			continue;
+		block.resolving = true;
+		this->resolver.request_address(block.host);
+	}
+}
+
+// Starting a non-blocking connect() to a link's address, finished by finish_link() once the socket is writable
+void Server::open_link(LinkBlock &block, std::string const &address)
+{
+	block.resolving = false;
+	if (address.empty())
+	{
+		std::cerr << "Link " << block.name << ": can't resolve " << block.host << std::endl;
+		return;
+	}
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV; // no lookup left to do
+	if (getaddrinfo(address.c_str(), block.port.c_str(), &hints, &res) != 0)
+	{
+		std::cerr << "Link " << block.name << ": invalid address " << address << " port " << block.port << std::endl;
+		return;
+	}
+	int sock = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock == -1 || (connect(sock, res->ai_addr, res->ai_addrlen) == -1 && errno != EINPROGRESS))
+	{
+		std::cerr << "Link " << block.name << ": connect() failed" << std::endl;
+		if (sock != -1)
+			close(sock);
+		freeaddrinfo(res);
+		return;
+	}
+	freeaddrinfo(res);
+	this->connecting[sock] = LinkConnect{block.name, std::time(NULL)};
+}
+
+// A link socket became writable: its connect() completed or failed
+void Server::finish_link(int fd)
+{
+	auto it = this->connecting.find(fd);
+	if (it == this->connecting.end())
+		return;
+	std::string name = it->second.name;
+	this->connecting.erase(it);
+	int error = 0;
+	socklen_t len = sizeof(error);
+	LinkBlock const *block = this->find_link_block(name);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0 || !block || this->network.count(name))
+	{
+		if (error != 0)
+			std::cerr << "Link " << name << ": connect() failed: " << strerror(error) << std::endl;
+		close(fd); // or the peer linked to us in the meantime
+		return;
+	}
+	Client *conn = new Client();
+	conn->set_fd(fd);
+	conn->set_IPaddr(block->host);
+	this->admission.opened(block->host); // given back like an accepted one when it closes
+	conn->set_link(NULL, block->name);	 // waiting for the peer's SERVER line
+	this->track(conn);
+	this->watch(conn);
+	this->transmit(fd, "SERVER " + this->name + " " + block->password + " " + LINK_DESCRIPTION + CRLF);
+	std::cout << GREEN << "Link " << block->name << ": connecting" << WHITE << std::endl;
+}
+
+// SERVER <name> <password> :<description> received on a connection that is not a link yet
+void Server::server_cmd(Message &msg, int fd)
+{
+	Client *conn = get_client(fd);
+	std::vector<std::string> params = msg.getParams();
+	LinkBlock const *block = params.size() >= 2 ? this->find_link_block(params[0]) : NULL;
+	if (!block || block->password != params[1] || !conn->get_nickname().empty() || this->network.count(params[0]) || params[0] == this->name)
+	{
+		this->transmit(fd, "ERROR :Link refused" CRLF);
+		std::cerr << RED << "Link refused from <" << fd << ">" << WHITE << std::endl;
+		this->quit(fd);
+		return;
+	}
+	if (conn->get_server() != block->name) // the peer opened the link, answering with our own SERVER line
+		this->transmit(fd, "SERVER " + this->name + " " + block->password + " " + LINK_DESCRIPTION + CRLF);
+	conn->set_server_link(block->name);
+	conn->set_registered(true);
+	NetServer peer = {block->name, this->name, conn, 1};
+	this->network[block->name] = peer;
+	this->send_links(":" + this->name + " SERVER " + block->name + " 2 " + LINK_DESCRIPTION + CRLF, conn);
+	std::cout << GREEN << "Link " << block->name << ": established" << WHITE << std::endl;
+	this->burst(conn);
+}
+
+// Line introducing a user to a linked server
+std::string Server::introduction(Client *user)
+{
+	int hops = user->is_remote() ? this->network[user->get_server()].hops + 1 : 1;
+	std::string server = user->is_remote() ? user->get_server() : this->name;
+	return ("NICK " + user->get_nickname() + " " + std::to_string(hops) + " " + std::to_string(user->get_nick_ts()) + " " + user->get_username() + " " + user->get_host() + " " + server + " :" + user->get_realname() + CRLF);
+}
+
+// Sending a new link everything known on our side of it: servers, users, then channels
+void Server::burst(Client *link)
+{
+	std::vector<NetServer const *> servers;
+	for (auto &entry : this->network)
+		if (entry.second.link != link)
+			servers.push_back(&entry.second);
+	std::sort(servers.begin(), servers.end(), [](NetServer const *a, NetServer const *b) { return (a->hops < b->hops); });
+	for (auto server : servers)
+		this->transmit(link->get_fd(), ":" + server->uplink + " SERVER " + server->name + " " + std::to_string(server->hops + 1) + " " + LINK_DESCRIPTION + CRLF);
+	for (auto client : this->clients)
+		if (client->is_introduced() && !client->is_closing() && client->get_link() != link)
+			this->transmit(link->get_fd(), this->introduction(client));
+	for (auto channel : this->channels.list())
+	{
+		std::string members;
+		for (auto client : channel->get_clients())
+			if (client->get_link() != link && client->is_introduced())
+				members += (members.empty() ? "" : " ") + std::string(channel->is_op(client) ? "@" : "") + client->get_nickname();
+		if (members.empty())
+			continue;
+		this->transmit(link->get_fd(), "SJOIN " + channel->get_channel_name() + " " + std::to_string(channel->get_modes()) + " " + std::to_string(channel->get_limit()) + " " + (channel->get_key().empty() ? "*" : channel->get_key()) + " :" + members + CRLF);
+		if (!channel->get_topic().empty())
+			this->transmit(link->get_fd(), "STOPIC " + channel->get_channel_name() + " " + channel->get_topic() + CRLF);
+	}
+}
+
+// Announcing a local user that just finished registering
+void Server::introduce(Client *user)
+{
+	user->set_introduced(true);
+	this->send_links(this->introduction(user), NULL);
+}
+
+void Server::send_links(std::string const &line, Client *except)
+{
+	for (auto &entry : this->network)
+		if (entry.second.hops == 1 && entry.second.link != except)
+			this->transmit(entry.second.link->get_fd(), line);
+}
+
+// Forwarding a command the user ran to the other servers, channel messages only go
+// to the links that have members of the channel
+void Server::propagate(Message &msg, std::string const &nick, Client *origin)
+{
+	std::string cmd = msg.getRawCmd();
+	std::vector<std::string> params = msg.getParams();
+	if (this->network.empty())
+		return;
+	if (cmd == "PRIVMSG" && params.size() >= 2)
+	{
+		for (auto &target : split_list(params[0]))
+		{
+			std::string line = ":" + nick + " PRIVMSG " + target + " " + params[1] + CRLF;
+			Channel *channel = target[0] == '#' ? this->channels.find(target) : NULL;
+			if (channel)
+			{
+				for (auto &link : channel->get_links())
+					if (link.first != origin)
+						this->transmit(link.first->get_fd(), line);
+			}
+			else if (Client *recipient = this->get_client(target))
+			{
+				if (recipient->is_remote() && recipient->get_link() != origin)
+					this->transmit(recipient->get_link()->get_fd(), line);
+			}
+		}
+	}
+	else if (cmd == "JOIN" || cmd == "PART" || cmd == "KICK" || cmd == "MODE" || cmd == "INVITE" || cmd == "QUIT" || (cmd == "TOPIC" && params.size() > 1))
+		this->send_links(":" + nick + " " + msg.getBody() + CRLF, origin);
+	else if (cmd == "NICK" && params.size() > 0)
+	{
+		Client *user = this->get_client(params[0]);
+		if (user && user->get_nickname() != nick)
+			this->send_links(":" + nick + " NICK " + params[0] + " " + std::to_string(user->get_nick_ts()) + CRLF, origin);
+	}
+}
+
+// A nick collision: the older nick wins, equal ages lose both. Every server applies the
+// same rule so no KILL has to be sent. Returns true if the newcomer may take the nick.
+bool Server::resolve_collision(Client *existing, time_t ts)
+{
+	time_t existing_ts = existing->get_nick_ts();
+	if (existing_ts < ts)
+		return (false);
+	std::cout << YELLOW << "Nick collision on " << existing->get_nickname() << WHITE << std::endl;
+	if (existing->is_remote())
+		this->remove_remote(existing, "Nick collision");
+	else
+	{
+		this->transmit(existing->get_fd(), "ERROR :Closing Link: Nick collision" CRLF);
+		existing->set_introduced(false); // the other servers drop it on their own
+		this->quit(existing->get_fd());
+	}
+	return (existing_ts > ts);
+}
+
+// NICK <nick> <hops> <ts> <user> <host> <server> :<realname>
+void Server::remote_user(std::vector<std::string> const &params, Client *link)
+{
+	std::string nick = params[0];
+	time_t ts = std::atol(params[2].c_str());
+	Client *existing = this->get_client(nick);
+	if (existing && !this->resolve_collision(existing, ts))
+		return;
+	Client *user = new Client();
+	std::string username = params[3];
+	std::string host = params[4];
+	std::string realname = params[6][0] == ':' ? params[6].substr(1) : params[6];
+	user->set_fd(this->next_remote_fd--);
+	user->set_IPaddr(host);
+	this->set_nickname(user, nick);
+	user->set_username(username);
+	user->set_hostname(host);
+	user->set_realname(realname);
+	user->set_registered(true);
+	user->set_logged_in(true);
+	user->set_link(link, params[5]);
+	user->set_introduced(true);
+	user->set_nick_ts(ts);
+	this->track(user);
+	this->send_links(this->introduction(user), link);
+}
+
+// Dropping a user of another server, after a split, a collision or their QUIT
+void Server::remove_remote(Client *user, std::string const &reason)
+{
+	std::string msg = ":" + reason;
+	this->quit_channels(user, msg);
+	this->remove_client(user->get_fd());
+}
+
+// Forgetting a server and everything behind it
+void Server::remove_server(std::string const &name, std::string const &reason)
+{
+	std::set<std::string> gone;
+	gone.insert(name);
+	for (bool grew = true; grew;)
+	{
+		grew = false;
+		for (auto &entry : this->network)
+			if (!gone.count(entry.first) && gone.count(entry.second.uplink))
+				grew = gone.insert(entry.first).second;
+	}
+	std::vector<Client *> users;
+	for (auto client : this->clients)
+		if (client->is_remote() && !client->is_closing() && gone.count(client->get_server()))
+			users.push_back(client);
+	for (auto user : users)
+		this->remove_remote(user, reason);
+	for (auto &server : gone)
+		this->network.erase(server);
+}
+
+// The connection to a linked server is gone: every server behind it splits off
+void Server::split_link(Client *link)
+{
+	std::vector<std::string> lost;
+	for (auto &entry : this->network)
+		if (entry.second.link == link && entry.second.hops == 1)
+			lost.push_back(entry.first);
+	for (auto &server : lost)
+	{
+		std::cout << RED << "Link " << server << ": lost" << WHITE << std::endl;
+		this->remove_server(server, this->name + " " + server);
+		this->send_links(":" + this->name + " SQUIT " + server + " :link lost" CRLF, link);
+	}
+}
+
+// Closing every link, the peers are told we left so they drop our users right away
+void Server::drop_links(std::string const &reason)
+{
+	std::vector<Client *> links;
+	for (auto client : this->clients)
+		if (!client->is_remote() && !client->get_server().empty() && !client->is_closing())
+			links.push_back(client);
+	for (auto link : links)
+	{
+		if (link->is_server_link())
+			this->transmit(link->get_fd(), ":" + this->name + " SQUIT " + this->name + " :" + reason + CRLF);
+		this->quit(link->get_fd(), reason);
+	}
+	for (auto &connect : this->connecting)
+		close(connect.first);
+	this->connecting.clear();
+}
+
+// A line received from a linked server
+void Server::link_cmd(Message &msg, Client *link)
+{
+	std::string cmd = msg.getRawCmd();
+	std::vector<std::string> params = msg.getParams();
+	std::string source = msg.getSourceNick();
+	if (cmd == "SERVER" && params.size() >= 2)
+	{
+		if (params[0] == this->name || this->network.count(params[0]))
+		{
+			// a second path to a known server would make a loop, the tree is kept by dropping this link
+			this->transmit(link->get_fd(), "ERROR :Server " + params[0] + " already exists" CRLF);
+			this->quit(link->get_fd());
+			return;
+		}
+		int hops = std::atoi(params[1].c_str());
+		NetServer server = {params[0], source, link, hops};
+		this->network[params[0]] = server;
+		this->send_links(":" + source + " SERVER " + params[0] + " " + std::to_string(hops + 1) + " " + LINK_DESCRIPTION + CRLF, link);
+	}
+	else if (cmd == "SQUIT" && params.size() >= 1)
+	{
+		if (this->network.count(params[0]))
+		{
+			this->remove_server(params[0], this->network[params[0]].uplink + " " + params[0]);
+			this->send_links(":" + source + " " + msg.getBody() + CRLF, link);
+		}
+	}
+	else if (cmd == "NICK" && params.size() >= 7)
+		this->remote_user(params, link);
+	else if (cmd == "SJOIN" && params.size() >= 5)
+	{
+		// SJOIN <#channel> <modes> <limit> <key|*> :[@]nick [@]nick...
+		Channel *channel = this->channels.find(params[0]);
+		if (!channel)
+		{
+			channel = new Channel(params[0], *this);
+			channel->sync_modes(std::atoi(params[1].c_str()), std::atoi(params[2].c_str()), params[3] == "*" ? NO_KEY : params[3]);
+			this->channels.add(channel);
+		}
+		std::istringstream members(params[4][0] == ':' ? params[4].substr(1) : params[4]);
+		std::string member;
+		while (members >> member)
+		{
+			bool op = member[0] == '@';
+			Client *user = this->get_client(op ? member.substr(1) : member);
+			if (user && user->get_link() == link)
+				channel->sync_join(user, op);
+		}
+		if (channel->is_empty())
+			this->remove_channel(channel);
+		else
+			this->send_links("SJOIN " + msg.getBody().substr(6) + CRLF, link);
+	}
+	else if (cmd == "STOPIC" && params.size() >= 2)
+	{
+		Channel *channel = this->channels.find(params[0]);
+		if (channel && channel->get_topic().empty())
+			channel->set_topic(params[1]);
+		this->send_links(msg.getBody() + CRLF, link);
+	}
+	else if (cmd == "PING")
+		this->transmit(link->get_fd(), "PONG " + this->name + CRLF);
+	else if (cmd == "ERROR")
+		std::cerr << RED << "Link " << link->get_server() << ": " << msg.getBody() << WHITE << std::endl;
+	else if (cmd != "PONG")
+	{
+		// a command from a user on the other side, run as if they were ours
+		Client *user = this->get_client(source);
+		if (user == NULL || user->get_link() != link)
+			return;
+		if (cmd == "NICK" && params.size() >= 1)
+		{
+			time_t ts = params.size() > 1 ? std::atol(params[1].c_str()) : std::time(NULL);
+			Client *existing = this->get_client(params[0]);
+			if (existing && existing != user && !this->resolve_collision(existing, ts))
+			{
+				this->remove_remote(user, "Nick collision");
+				return;
+			}
+			this->exec_cmd(msg, user->get_fd());
+			user->set_nick_ts(ts);
+			return;
+		}
+		this->exec_cmd(msg, user->get_fd());
+	}
+}
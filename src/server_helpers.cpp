@@ -4,46 +4,107 @@
 // Closing all the client fd's and the server socket
 void Server::close_fds()
 {
+	if (this->pipeline.is_running())
+		this->stop_pipeline();
+	if (this->handed_over) // the connections live on in the new process
+	{
+		std::cout << YELLOW << "Handed " << clients.size() << " clients over" << WHITE << std::endl;
+		return;
+	}
 	for (size_t i = 0; i < clients.size(); i++)
 	{
+		if (clients[i]->is_remote()) // a user of another server, no socket of ours
+			continue;
 		std::cout << RED << "Client <" << clients[i]->get_fd() << "> Disconnected" << WHITE << std::endl;
 		close(clients[i]->get_fd());
 	}
-	if (this->server_socket != -1)
+	for (auto &handshake : this->handshakes)
+		close(handshake.first);
+	this->handshakes.clear();
+	for (auto &connect : this->connecting)
+		close(connect.first);
+	this->connecting.clear();
+	for (auto &listener : this->listeners)
 	{
-		std::cout << RED << "Server " << this->server_socket << " disconnected" << WHITE << std::endl;
-		close(this->server_socket);
+		if (listener.get_fd() != -1)
+			std::cout << RED << "Server " << listener.get_fd() << " disconnected" << WHITE << std::endl;
+		listener.close();
 	}
 }
 
-// Removing client from vectors
+// Adding a client to the vector of clients and the fd index
+void Server::track(Client *client)
+{
+	this->slots[client->get_fd()] = this->clients.size();
+	this->clients.push_back(client);
+}
+
+// Marking a client gone: its nickname is free right away, the rest waits for teardown()
+// so nothing still running this iteration holds a dangling pointer to it
 void Server::remove_client(int fd)
 {
+	auto slot = this->slots.find(fd);
+	if (slot == this->slots.end())
+		return;
+	Client *client = this->clients[slot->second];
+	if (client->is_closing())
+		return;
+	auto nick = this->nicks.find(client->get_nickname());
+	if (nick != this->nicks.end() && nick->second == client)
+		this->nicks.erase(nick);
+	client->set_closing();
+	this->closing.push_back(client);
+}
 
-	for (std::vector<pollfd>::iterator it = this->fds.begin(); it != this->fds.end(); ++it)
-	{
-		if (it->fd == fd)
-		{
-			this->fds.erase(it);
-			break;
-		}
-	}
-	for (std::vector<Client *>::iterator it = this->clients.begin(); it != this->clients.end(); ++it)
+// Reclaiming the clients that quit during this loop iteration: the last client moves into
+// each one's slot, so k of them cost O(k) whatever the number of clients. Their sockets
+// are closed here too, once the output queued for them this iteration is on its way.
+void Server::teardown()
+{
+	for (auto client : this->closing)
 	{
-		if ((*it)->get_fd() == fd)
+		int fd = client->get_fd();
+		size_t slot = this->slots[fd];
+		Client *last = this->clients.back();
+		this->clients[slot] = last;
+		this->slots[last->get_fd()] = slot;
+		this->clients.pop_back();
+		this->slots.erase(fd);
+		if (fd >= 0)
 		{
-			delete *it;
-			this->clients.erase(it);
-			break;
+			this->admission.closed(client->get_IPaddr());
+			this->disconnect(fd);
 		}
+		delete client;
 	}
+	this->closing.clear();
 }
+
 void Server::remove_channel(Channel *channel)
 {
-	this->channels.erase(channel->get_channel_name());
+	this->channels.remove(channel);
+	this->snapshot.erase(channel->get_channel_name());
 	delete channel;
 }
 
+// Storing the channel state in the snapshot
+void Server::persist(Channel *channel)
+{
+	this->snapshot.store(channel->get_channel_name(), channel->get_modes(), channel->get_limit(), channel->get_key(), channel->get_topic());
+}
+
+// Keeping the history within its share of the memory budget: every channel is cut
+// down to an equal part of three quarters of it, so the next messages fit again
+void Server::trim_history()
+{
+	if (!Memory::over_share(MEM_HISTORY, MEMORY_HISTORY_SHARE) || this->channels.empty())
+		return;
+	size_t each = MEMORY_HISTORY_SHARE / 4 * 3 / this->channels.size();
+	for (auto channel : this->channels.list())
+		channel->trim_history(each);
+	std::cout << YELLOW << "Memory: history over its share, trimmed to " << each / 1024 << "KB per channel" << WHITE << std::endl;
+}
+
 // Signal handler
 void Server::handle_signal(int sig)
 {
@@ -52,23 +113,269 @@ void Server::handle_signal(int sig)
 	(void)sig;
 	Server::signal = true;
 }
+
+void Server::handle_upgrade_signal(int sig)
+{
+	(void)sig;
+	Server::upgrade = true;
+}
+
+void Server::handle_report_signal(int sig)
+{
+	(void)sig;
+	Server::report = true;
+}
+
+// The signals are for the thread running the loop: one delivered to another
+// thread wouldn't interrupt its poll(). Threads inherit the mask they're
+// created with, so they're created between these two calls.
+void Server::block_signals(sigset_t &saved)
+{
+	sigset_t blocked;
+	sigemptyset(&blocked);
+	for (int sig : {SIGINT, SIGQUIT, SIGUSR1, SIGUSR2})
+		sigaddset(&blocked, sig);
+	pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+}
+
+void Server::restore_signals(sigset_t const &saved)
+{
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+void Server::set_executable(std::string const &path)
+{
+	this->executable = path;
+}
 // Sending response to the client
 void Server::send_response(std::string response, int fd)
 {
 	std::cout << "Response:\n"
 			  << response;
-	if (send(fd, response.c_str(), response.size(), 0) == -1)
-		std::cerr << "Response send() faild" << std::endl;
+	this->transmit(fd, response);
 }
 
-Client *Server::findClient(std::string &nickname) const
+// Sending data to a fd, or holding it until the end of the current batch
+void Server::transmit(int fd, std::string const &data)
+{
+	if (fd < 0) // a user of a linked server, what concerns them is forwarded over the link
+		return;
+	if (this->batch_depth > 0)
+	{
+		this->batched[fd] += data;
+		return;
+	}
+	if (this->pipeline.is_running())
+	{
+		std::vector<Outbound> batch(1, Outbound{fd, data, false});
+		this->pipeline.send(batch);
+	}
+	else if (send(fd, data.c_str(), data.size(), 0) == -1)
+		std::cerr << "Response send() failed to fd: " << fd << std::endl;
+}
+
+// Sending a line once to everyone who shares a channel with the user, however many they share.
+// Recipients are stamped with the fan-out's epoch instead of being collected in a set.
+void Server::send_common(Client *user, std::string const &line, bool include_user)
 {
-	for (auto &client : clients)
+	unsigned long epoch = ++this->fanout_epoch;
+	Variants variants(line, this->get_timestamp(), std::string(), std::string());
+	user->visit(epoch);
+	if (include_user)
+		this->transmit(user->get_fd(), variants.get(user->get_caps()));
+	for (auto &channel : user->get_channels())
 	{
-		if (client->get_nickname() == nickname)
-			return client;
+		for (auto &member : channel->get_clients())
+		{
+			if (member->visit(epoch))
+				this->transmit(member->get_fd(), variants.get(member->get_caps()));
+		}
 	}
-	return nullptr;
+}
+
+// Reading the clock for the loop iteration that starts
+void Server::tick()
+{
+	this->clock = History::now();
+	this->clock_text.clear();
+}
+
+long long Server::get_clock() const
+{
+	return (this->clock);
+}
+
+// Message ids are unique across channels and restarts: `<epoch>-<n>`, the epoch
+// being when the server started and n counting the messages of every channel
+unsigned long long Server::new_msgid()
+{
+	return (this->next_msgid++);
+}
+
+std::string Server::format_msgid(unsigned long long msgid) const
+{
+	return (std::to_string(this->msgid_epoch) + "-" + std::to_string(msgid));
+}
+
+// The counter of one of our msgids, 0 if it isn't one
+unsigned long long Server::parse_msgid(std::string const &text) const
+{
+	std::string prefix = std::to_string(this->msgid_epoch) + "-";
+	if (text.compare(0, prefix.size(), prefix) != 0 || text.size() == prefix.size() || text.find_first_not_of("0123456789", prefix.size()) != std::string::npos)
+		return (0);
+	return (std::strtoull(text.c_str() + prefix.size(), NULL, 10));
+}
+
+// The clock as server-time wants it, formatted once per iteration
+std::string const &Server::get_timestamp()
+{
+	if (this->clock_text.empty())
+		this->clock_text = History::format_timestamp(this->clock);
+	return (this->clock_text);
+}
+
+// Announcing a quit to the user's channels, then leaving them
+void Server::quit_channels(Client *user, std::string const &msg)
+{
+	this->send_common(user, RPL_QUIT(CLIENT(user->get_nickname(), user->get_username(), user->get_host()), msg), false);
+	for (auto &channel : user->get_channels())
+		channel->quit(user);
+}
+
+// Replies produced until the matching end_batch() are coalesced into one send per recipient
+void Server::begin_batch()
+{
+	this->batch_depth++;
+}
+
+void Server::end_batch()
+{
+	if (--this->batch_depth > 0)
+		return;
+	if (this->pipeline.is_running())
+	{
+		std::vector<Outbound> batch;
+		for (auto &pending : this->batched)
+			batch.push_back(Outbound{pending.first, pending.second, false});
+		if (!batch.empty())
+			this->pipeline.send(batch);
+	}
+	else
+		for (auto &pending : this->batched)
+			if (send(pending.first, pending.second.c_str(), pending.second.size(), 0) == -1)
+				std::cerr << "Response send() failed to fd: " << pending.first << std::endl;
+	this->batched.clear();
+}
+
+// Closing a connection once the output queued for it is sent
+void Server::disconnect(int fd)
+{
+	if (fd < 0) // a user of a linked server
+		return;
+	std::string last;
+	auto pending = this->batched.find(fd);
+	if (pending != this->batched.end())
+	{
+		last.swap(pending->second);
+		this->batched.erase(pending);
+	}
+	if (this->pipeline.is_running())
+		this->pipeline.close(fd, last);
+	else
+	{
+		send(fd, last.c_str(), last.size(), MSG_NOSIGNAL);
+		close(fd);
+	}
+}
+
+// Handing a connection to the reader thread, with the input left from before
+void Server::watch(Client *client)
+{
+	if (!this->pipeline.is_running())
+		return;
+	client->set_serial(++this->next_serial);
+	this->pipeline.watch(client->get_fd(), client->get_serial(), client->get_buffer(), client->get_tls());
+	client->clear_buffer();
+}
+
+// Resolving a new connection's hostname, from the cache or on the resolver threads
+void Server::lookup_host(Client *client)
+{
+	std::string host;
+	this->send_response(RPL_HOSTLOOKUP(this->name), client->get_fd());
+	if (!this->resolver.lookup(client->get_IPaddr(), host))
+	{
+		this->resolver.request(client->get_fd(), client->get_serial(), client->get_IPaddr());
+		return;
+	}
+	if (host.empty())
+		this->send_response(RPL_HOSTNOTFOUND(this->name), client->get_fd());
+	else
+	{
+		client->set_host(host);
+		this->send_response(RPL_HOSTFOUND(this->name, host), client->get_fd());
+	}
+}
+
+// Lookups that finished. A client that registered or joined a channel meanwhile keeps its
+// address as host, its hostmask has been seen and checked against bans already.
+void Server::receive_resolutions()
+{
+	std::vector<Resolution> done;
+	std::vector<HostAddress> addresses;
+	this->resolver.receive(done, addresses);
+	for (auto &found : addresses) // links waiting for their host's address
+		for (auto &block : this->link_blocks)
+			if (block.resolving && block.host == found.host)
+				this->open_link(block, found.address);
+	this->begin_batch();
+	for (auto &result : done)
+	{
+		Client *client = get_client(result.fd);
+		if (!client || client->get_serial() != result.serial || client->is_welcomed() || !client->get_channels().empty())
+			continue;
+		if (result.host.empty())
+			this->send_response(RPL_HOSTNOTFOUND(this->name), result.fd);
+		else
+		{
+			client->set_host(result.host);
+			this->send_response(RPL_HOSTFOUND(this->name, result.host), result.fd);
+		}
+	}
+	this->end_batch();
+}
+
+void Server::start_pipeline()
+{
+	sigset_t saved;
+	Server::block_signals(saved);
+	this->pipeline.start();
+	Server::restore_signals(saved);
+	for (auto client : this->clients)
+		if (!client->is_remote())
+			this->watch(client);
+}
+
+// Taking the sockets back from the I/O threads, unread input and unsent output stay with their client
+void Server::stop_pipeline()
+{
+	std::map<int, std::string> partial, unsent;
+	this->pipeline.stop(partial, unsent);
+	for (auto client : this->clients)
+	{
+		if (partial.count(client->get_fd()))
+			client->set_buffer(partial[client->get_fd()]);
+		if (unsent.count(client->get_fd()))
+			client->requeue(unsent[client->get_fd()]);
+	}
+}
+
+Client *Server::findClient(std::string &nickname) const
+{
+	auto it = this->nicks.find(nickname);
+	if (it == this->nicks.end())
+		return nullptr;
+	return it->second;
 }
 
 void Server::send_response(rType responseType, std::string sender, std::string recipient, std::string response)
@@ -77,35 +384,17 @@ void Server::send_response(rType responseType, std::string sender, std::string r
 	{
 	case rType::ChannelToClients:
 	{
-		auto ch = channels[recipient];
-		if (!ch)
-			return;
-		auto clients = ch->get_clients();
-		size_t size = clients.size();
-		for (size_t i = 0; i < size; i++)
-		{
-			if (send(clients[i]->get_fd(), response.c_str(), response.size(), 0) == -1)
-				std::cerr << "Response send() failed to user: " << clients[i]->get_nickname() << std::endl;
-		}
+		Channel *ch = this->channels.find(recipient);
+		if (ch)
+			ch->broadcast(response);
 		return;
-		break;
 	}
 	case rType::ClientToChannel:
 	{
-		auto ch = channels[recipient];
-		if (!ch)
-			return;
-		auto clients = ch->get_clients();
-		size_t size = clients.size();
-		for (size_t i = 0; i < size; i++)
-		{
-			if (clients[i]->get_nickname() == sender)
-				continue;
-			if (send(clients[i]->get_fd(), response.c_str(), response.size(), 0) == -1)
-				std::cerr << "Response send() failed to user: " << clients[i]->get_nickname() << std::endl;
-		}
+		Channel *ch = this->channels.find(recipient);
+		if (ch)
+			ch->broadcast(findClient(sender), response); // the sender is skipped by its slot
 		return;
-		break;
 	}
 	case rType::ClientToClient:
 	case rType::ServerToClient:
@@ -120,35 +409,59 @@ void Server::send_response(rType responseType, std::string sender, std::string r
 				return;
 			}
 			response = ERR_ERRONEUSNICK(recipient);
-			if (send(findSender->get_fd(), response.c_str(), response.size(), 0) == -1)
-				std::cerr << "Response send() failed to user: " << findSender->get_nickname() << std::endl;
+			this->transmit(findSender->get_fd(), response);
 			return;
 		}
 		else
 		{
-			if (send(findRecipient->get_fd(), response.c_str(), response.size(), 0) == -1)
-				std::cerr << "Response send() failed to user: " << findRecipient->get_nickname() << std::endl;
+			this->transmit(findRecipient->get_fd(), response);
 		}
 		return;
 	}
 	}
 }
+// Sending a bounded amount of every client's deferred lines, returns true if some are still pending.
+// Clients whose send queue is too full are skipped and `held` is set.
+bool Server::flush_deferred(bool &held)
+{
+	bool pending = false;
+	this->begin_batch();
+	for (size_t i = 0; i < this->clients.size(); i++)
+	{
+		Client *client = this->clients[i];
+		if ((client->has_deferred() || client->has_stream()) && this->pipeline.backlog(client->get_fd()) > PACED_BACKLOG)
+		{
+			held = true; // what it has in the send queue goes out first
+			continue;
+		}
+		for (size_t sent = 0; sent < DEFERRED_PER_TICK; sent++)
+		{
+			if (!client->has_deferred())
+				client->run_stream(DEFERRED_PER_TICK - sent);
+			if (!client->has_deferred())
+				break;
+			this->send_response(client->pop_deferred(), client->get_fd());
+		}
+		if (client->has_deferred() || client->has_stream())
+			pending = true;
+	}
+	this->end_batch();
+	return (pending);
+}
+
 // Get the specific client
 Client *Server::get_client(int fd)
 {
-	for (size_t i = 0; i < this->clients.size(); i++)
-		if (this->clients[i]->get_fd() == fd)
-			return (this->clients[i]);
-	return (NULL);
+	auto slot = this->slots.find(fd);
+	if (slot == this->slots.end() || this->clients[slot->second]->is_closing())
+		return (NULL);
+	return (this->clients[slot->second]);
 }
 
 // Get the specific client
 Client *Server::get_client(std::string nickname)
 {
-	for (size_t i = 0; i < this->clients.size(); i++)
-		if (this->clients[i]->get_nickname() == nickname)
-			return (this->clients[i]);
-	return (NULL);
+	return (this->findClient(nickname));
 }
 
 // Get server name
@@ -156,6 +469,68 @@ std::string Server::get_name()
 {
 	return (this->name);
 }
+
+Plugins &Server::get_plugins()
+{
+	return (this->plugins);
+}
+
+/// PLUGIN HOST ///
+
+std::string const &Server::server_name() const
+{
+	return (this->name);
+}
+
+// A line from a plugin's service: names with spaces are refused, the text ends at a line break
+static bool service_line(std::string &line, std::string const &service, std::string const &server, std::string const &command, std::string const &target, std::string const &text)
+{
+	if (service.empty() || target.empty() || service.find_first_of(" \r\n:") != std::string::npos || target.find_first_of(" \r\n:,") != std::string::npos)
+		return (false);
+	line = ":" + service + "!service@" + server + " " + command + " " + target + " :" + text.substr(0, text.find_first_of("\r\n")) + CRLF;
+	return (true);
+}
+
+bool Server::say(std::string const &service, std::string const &target, std::string const &text)
+{
+	std::string line;
+	if (!service_line(line, service, this->name, "PRIVMSG", target, text))
+		return (false);
+	if (target[0] == '#')
+	{
+		Channel *channel = this->channels.find(target);
+		if (channel)
+			channel->announce(line);
+		return (channel != NULL);
+	}
+	Client *user = this->get_client(target);
+	if (!user || user->is_remote())
+		return (false);
+	Variants variants(line, this->get_timestamp(), std::string(), std::string());
+	this->transmit(user->get_fd(), variants.get(user->get_caps()));
+	return (true);
+}
+
+bool Server::notice(std::string const &service, std::string const &nickname, std::string const &text)
+{
+	std::string line;
+	Client *user = this->get_client(nickname);
+	if (!user || user->is_remote() || !service_line(line, service, this->name, "NOTICE", nickname, text))
+		return (false);
+	Variants variants(line, this->get_timestamp(), std::string(), std::string());
+	this->transmit(user->get_fd(), variants.get(user->get_caps()));
+	return (true);
+}
+
+std::vector<std::string> Server::members(std::string const &channel) const
+{
+	std::vector<std::string> nicknames;
+	Channel *found = this->channels.find(channel);
+	if (found)
+		for (auto member : found->get_clients())
+			nicknames.push_back(member->get_nickname());
+	return (nicknames);
+}
 // Spliting each of clients input to vector of vector of strings
 std::vector<std::string> Server::split_recived_buffer(std::string str)
 {
@@ -173,11 +548,14 @@ std::vector<std::string> Server::split_recived_buffer(std::string str)
 	}
 	return (vec);
 }
-std::vector<std::string> Server::get_clients_channel(std::string const &nickname)
+// Spliting a comma separated target list, empty entries are dropped
+std::vector<std::string> Server::split_list(std::string const &list)
 {
-	std::vector<std::string> clients_channels;
-	for (auto it = this->channels.begin(); it != this->channels.end(); ++it)
-		if (it->second->is_client_in_channel(nickname) == true)
-			clients_channels.push_back(it->first);
-	return clients_channels;
+	std::vector<std::string> items;
+	std::istringstream input(list);
+	std::string item;
+	while (std::getline(input, item, ','))
+		if (!item.empty())
+			items.push_back(item);
+	return (items);
 }
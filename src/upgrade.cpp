@@ -0,0 +1,274 @@
+#include "Server.hpp"
+#include "Archive.hpp"
+#include <sys/wait.h>
+
+// Writing the whole buffer to a blocking socket
+static bool write_all(int sock, char const *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(sock, data, len);
+		if (n <= 0)
+			return (false);
+		data += n;
+		len -= n;
+	}
+	return (true);
+}
+
+static bool read_all(int sock, char *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = read(sock, data, len);
+		if (n <= 0)
+			return (false);
+		data += n;
+		len -= n;
+	}
+	return (true);
+}
+
+// Sending the state archive and the fds it refers to: a header with both sizes,
+// the fds in chunks of SCM_RIGHTS messages, then the archive itself
+static bool send_state(int sock, std::string const &state, std::vector<int> const &fds)
+{
+	uint32_t nfds = fds.size();
+	uint64_t len = state.size();
+	if (!write_all(sock, (char *)&nfds, sizeof(nfds)) || !write_all(sock, (char *)&len, sizeof(len)))
+		return (false);
+	for (size_t i = 0; i < fds.size(); i += UPGRADE_FDS_PER_MSG)
+	{
+		size_t chunk = std::min<size_t>(UPGRADE_FDS_PER_MSG, fds.size() - i);
+		std::vector<char> control(CMSG_SPACE(chunk * sizeof(int)));
+		char byte = 'F';
+		struct iovec iov = {&byte, 1};
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data();
+		msg.msg_controllen = control.size();
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(chunk * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fds[i], chunk * sizeof(int));
+		if (sendmsg(sock, &msg, 0) != 1)
+			return (false);
+	}
+	return (write_all(sock, state.data(), state.size()));
+}
+
+static bool recv_state(int sock, std::string &state, std::vector<int> &fds)
+{
+	uint32_t nfds;
+	uint64_t len;
+	if (!read_all(sock, (char *)&nfds, sizeof(nfds)) || !read_all(sock, (char *)&len, sizeof(len)))
+		return (false);
+	while (fds.size() < nfds)
+	{
+		size_t chunk = std::min<size_t>(UPGRADE_FDS_PER_MSG, nfds - fds.size());
+		std::vector<char> control(CMSG_SPACE(chunk * sizeof(int)));
+		char byte;
+		struct iovec iov = {&byte, 1};
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data();
+		msg.msg_controllen = control.size();
+		if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1)
+			return (false);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(chunk * sizeof(int)))
+			return (false);
+		std::vector<int> received(chunk);
+		memcpy(received.data(), CMSG_DATA(cmsg), chunk * sizeof(int));
+		fds.insert(fds.end(), received.begin(), received.end());
+	}
+	state.resize(len);
+	return (read_all(sock, &state[0], len));
+}
+
+// Disconnecting the TLS clients a hot upgrade can't hand over: unless the kernel
+// does both directions, their session keys only exist in this process' OpenSSL state
+void Server::drop_tls_clients(std::string const &reason)
+{
+	std::vector<Client *> dropped;
+	for (auto client : this->clients)
+		if (!client->is_remote() && client->get_server().empty() && client->get_tls() && !client->get_tls()->is_kernel() && !client->is_closing())
+			dropped.push_back(client);
+	for (auto client : dropped)
+	{
+		this->transmit(client->get_fd(), "ERROR :Closing link: " + reason + CRLF);
+		this->quit(client->get_fd(), reason);
+	}
+}
+
+// Starting the new binary and handing it the sockets and the state, returns true once it took over
+bool Server::hot_upgrade()
+{
+	int sv[2];
+	std::cout << YELLOW << "Hot upgrade: starting " << this->executable << WHITE << std::endl;
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+	{
+		std::cerr << "Hot upgrade: socketpair() failed" << std::endl;
+		return (false);
+	}
+	// the child only makes async-signal-safe calls: another thread may hold the malloc lock at fork()
+	std::vector<int> owned; // the new process only gets the sockets through SCM_RIGHTS
+	for (auto &listener : this->listeners)
+		owned.push_back(listener.get_fd());
+	for (auto client : this->clients)
+		if (!client->is_remote())
+			owned.push_back(client->get_fd());
+	owned.push_back(sv[0]);
+	std::vector<std::string> args = {this->executable, std::to_string(this->port), this->password};
+	if (!this->links_file.empty())
+		args.push_back(this->links_file);
+	std::vector<std::string> env;
+	for (char **var = environ; *var; var++)
+		if (strncmp(*var, UPGRADE_ENV "=", strlen(UPGRADE_ENV "=")) != 0)
+			env.push_back(*var);
+	env.push_back(UPGRADE_ENV "=" + std::to_string(sv[1]));
+	std::vector<char *> argv, envp;
+	for (auto &arg : args)
+		argv.push_back(&arg[0]);
+	argv.push_back(NULL);
+	for (auto &var : env)
+		envp.push_back(&var[0]);
+	envp.push_back(NULL);
+
+	pid_t pid = fork();
+	if (pid == -1)
+	{
+		std::cerr << "Hot upgrade: fork() failed" << std::endl;
+		close(sv[0]);
+		close(sv[1]);
+		return (false);
+	}
+	if (pid == 0)
+	{
+		for (int fd : owned)
+			close(fd);
+		execve(argv[0], argv.data(), envp.data());
+		_exit(127);
+	}
+	close(sv[1]);
+
+	Archive state;
+	std::vector<int> handed;
+	std::map<Client *, uint32_t> ids;
+	state.put_u32(UPGRADE_VERSION);
+	state.put_u64(this->msgid_epoch); // the msgids in the histories stay valid
+	state.put_u64(this->next_msgid);
+	state.put_u32(this->listeners.size());
+	for (auto &listener : this->listeners)
+	{
+		state.put_str(listener.get_name());
+		handed.push_back(listener.get_fd());
+	}
+	// server links were dropped before, the new process opens them again,
+	// and so were the TLS clients whose session isn't all in the kernel
+	std::vector<Client *> local;
+	for (auto client : this->clients)
+		if (!client->is_remote() && client->get_server().empty())
+			local.push_back(client);
+	state.put_u32(local.size());
+	for (size_t i = 0; i < local.size(); i++)
+	{
+		ids[local[i]] = i;
+		handed.push_back(local[i]->get_fd());
+		local[i]->save(state);
+	}
+	std::vector<Channel *> kept;
+	for (auto channel : this->channels.list())
+		for (auto client : channel->get_clients())
+			if (ids.count(client))
+			{
+				kept.push_back(channel);
+				break;
+			}
+	state.put_u32(kept.size());
+	for (auto channel : kept)
+		channel->save(state, ids);
+
+	struct timeval timeout = {UPGRADE_TIMEOUT, 0};
+	setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	char ack = 0;
+	bool ok = send_state(sv[0], state.data(), handed) && read(sv[0], &ack, 1) == 1 && ack == 'K';
+	close(sv[0]);
+	if (!ok)
+	{
+		std::cerr << RED << "Hot upgrade failed, keeping the current process" << WHITE << std::endl;
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return (false);
+	}
+	std::cout << GREEN << "Hot upgrade: handed over to pid " << pid << WHITE << std::endl;
+	this->handed_over = true;
+	return (true);
+}
+
+// Taking over the sockets and the state from the process that exec'd us
+void Server::restore_upgrade(int sock)
+{
+	std::string blob;
+	std::vector<int> handed;
+	unsetenv(UPGRADE_ENV);
+	if (!recv_state(sock, blob, handed) || handed.empty())
+		throw(std::runtime_error("hot upgrade: failed to receive the state"));
+	Reader state(blob);
+	if (state.get_u32() != UPGRADE_VERSION)
+		throw(std::runtime_error("hot upgrade: incompatible state version"));
+	this->msgid_epoch = state.get_u64();
+	this->next_msgid = state.get_u64();
+
+	// the listeners are matched by address and port, the links file may have added or dropped some
+	size_t first = state.get_u32(); // index of the first client socket
+	if (first > handed.size())
+		throw(std::runtime_error("hot upgrade: listeners are missing"));
+	for (size_t i = 0; i < first; i++)
+	{
+		std::string name = state.get_str();
+		auto listener = this->listeners.begin();
+		while (listener != this->listeners.end() && listener->get_name() != name)
+			++listener;
+		if (listener == this->listeners.end() || listener->get_fd() != -1)
+		{
+			close(handed[i]);
+			if (name.compare(0, 5, "unix ") == 0) // dropped from the links file, nobody listens on it anymore
+				unlink(name.c_str() + 5);
+		}
+		else
+			listener->adopt(handed[i]);
+	}
+	for (auto &listener : this->listeners)
+		if (listener.get_fd() == -1)
+			listener.open();
+	uint32_t nclients = state.get_u32();
+	if (nclients != handed.size() - first)
+		throw(std::runtime_error("hot upgrade: client count does not match the fds"));
+	for (uint32_t i = 0; i < nclients; i++)
+	{
+		Client *usr = new Client();
+		usr->set_fd(handed[i + first]);
+		this->track(usr);
+		usr->load(state);
+		this->admission.opened(usr->get_IPaddr());
+		if (!usr->get_nickname().empty())
+			this->nicks[usr->get_nickname()] = usr;
+	}
+	for (uint32_t n = state.get_u32(); n > 0; n--)
+	{
+		Channel *channel = Channel::load(state, this->clients, *this);
+		this->channels.add(channel);
+	}
+	if (write(sock, "K", 1) != 1)
+		throw(std::runtime_error("hot upgrade: failed to acknowledge"));
+	close(sock);
+	for (auto &listener : this->listeners) // the old process exits without removing anything
+		listener.own();
+	std::cout << GREEN << "Hot upgrade: took over " << nclients << " clients and " << this->channels.size() << " channels" << WHITE << std::endl;
+}